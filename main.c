@@ -1,519 +1,9003 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
-#define MAX_STATIONS 150
-#define MAX_NAME_LENGTH 100
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Per-thread counters, phase timers and the --metrics exporter; build with
+// -DROUTER_METRICS=0 to compile them out
+#ifndef ROUTER_METRICS
+#define ROUTER_METRICS 1
+#endif
 
 typedef struct
 {
+    int from;
+    int to;
     int time;
     int price;
 } Edge;
 
+// name and color are offsets of interned strings in MetroSystem.names
 typedef struct
 {
-    char name[MAX_NAME_LENGTH];
-    Edge connections[MAX_STATIONS];
-    char color[50];
+    uint32_t name;
+    uint32_t color;
 } Station;
 
+// One slot of an open-addressing string index; value is owner-defined and -1 when unset
+typedef struct
+{
+    uint32_t string;
+    int value;
+} InternSlot;
+
+#define EMPTY_SLOT UINT32_MAX
+
+// Append-only pool of NUL-terminated strings, each stored once, with a
+// hash index from string to its offset and an int value
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    InternSlot *slots;
+    uint32_t numSlots;
+    uint32_t count;
+} StringPool;
+
+// Stations and connections are collected with addStation/addConnection and
+// then packed into a compressed-sparse-row graph by finalizeMetroSystem:
+// the neighbours of station i are neighbors[offsets[i]] .. neighbors[offsets[i + 1] - 1],
+// with the matching weights at the same index in times/prices.
+// In names, the value of a station name is the first station added under it.
+// A network loaded from a compiled image points into image until it is modified.
 typedef struct
 {
-    Station stations[MAX_STATIONS];
+    Station *stations;
     int numStations;
+    int stationCapacity;
+    StringPool names;
+
+    Edge *edges;
+    int numEdges;
+    int edgeCapacity;
+
+    int *offsets;
+    int *neighbors;
+    int *times;
+    int *prices;
+    int numArcs;
+    int finalized;
+
+    void *image;
+    size_t imageSize;
 } MetroSystem;
 
-void initializeMetroSystem(MetroSystem *metro)
+void *checkedRealloc(void *ptr, size_t size)
 {
-    metro->numStations = 0;
+    void *result = realloc(ptr, size);
+    if (result == NULL && size != 0)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return result;
 }
 
-void addStation(MetroSystem *metro, const char *name, const char *color)
+void freeStringPool(StringPool *pool)
 {
-    if (metro->numStations >= MAX_STATIONS)
+    free(pool->data);
+    free(pool->slots);
+    memset(pool, 0, sizeof(*pool));
+}
+
+uint32_t hashString(const char *text)
+{
+    uint32_t hash = 2166136261u;
+    while (*text)
     {
-        printf("Error: Maximum number of stations reached.\n");
-        return;
+        hash ^= (unsigned char)*text++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Returns the slot holding text, or the empty slot where it would be inserted
+InternSlot *findInternSlot(const StringPool *pool, const char *text)
+{
+    uint32_t mask = pool->numSlots - 1;
+    uint32_t index = hashString(text) & mask;
+    for (;;)
+    {
+        InternSlot *slot = &pool->slots[index];
+        if (slot->string == EMPTY_SLOT || strcmp(pool->data + slot->string, text) == 0)
+        {
+            return slot;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void growStringIndex(StringPool *pool)
+{
+    InternSlot *old = pool->slots;
+    uint32_t oldSlots = pool->numSlots;
+
+    pool->numSlots = oldSlots ? oldSlots * 2 : 256;
+    pool->slots = checkedRealloc(NULL, (size_t)pool->numSlots * sizeof(InternSlot));
+    for (uint32_t i = 0; i < pool->numSlots; i++)
+    {
+        pool->slots[i].string = EMPTY_SLOT;
+        pool->slots[i].value = -1;
+    }
+    for (uint32_t i = 0; i < oldSlots; i++)
+    {
+        if (old[i].string != EMPTY_SLOT)
+        {
+            *findInternSlot(pool, pool->data + old[i].string) = old[i];
+        }
+    }
+    free(old);
+}
+
+// Stores text once in the pool and returns its index slot
+InternSlot *internString(StringPool *pool, const char *text)
+{
+    if ((pool->count + 1) * 2 > pool->numSlots)
+    {
+        growStringIndex(pool);
     }
 
-    strcpy(metro->stations[metro->numStations].name, name);
-    strcpy(metro->stations[metro->numStations].color, color);
+    InternSlot *slot = findInternSlot(pool, text);
+    if (slot->string != EMPTY_SLOT)
+    {
+        return slot;
+    }
 
-    // Initialize connections for each station
-    for (int i = 0; i < MAX_STATIONS; i++)
+    size_t length = strlen(text) + 1;
+    if (pool->size + length > pool->capacity)
     {
-        metro->stations[metro->numStations].connections[i].time = -1;
-        metro->stations[metro->numStations].connections[i].price = -1;
+        while (pool->size + length > pool->capacity)
+        {
+            pool->capacity = pool->capacity ? pool->capacity * 2 : 4096;
+        }
+        pool->data = checkedRealloc(pool->data, pool->capacity);
     }
+    memcpy(pool->data + pool->size, text, length);
 
-    metro->numStations++;
+    slot->string = (uint32_t)pool->size;
+    slot->value = -1;
+    pool->size += length;
+    pool->count++;
+    return slot;
 }
 
-void addConnection(MetroSystem *metro, const char *station1, const char *station2, int time, float price)
+// Returns the value stored for text, or -1 if it was never interned
+int lookupString(const StringPool *pool, const char *text)
+{
+    if (pool->numSlots == 0)
+    {
+        return -1;
+    }
+    return findInternSlot(pool, text)->value;
+}
+
+void initializeMetroSystem(MetroSystem *metro)
+{
+    memset(metro, 0, sizeof(*metro));
+}
+
+void freeMetroSystem(MetroSystem *metro)
+{
+    if (metro->image != NULL)
+    {
+        munmap(metro->image, metro->imageSize);
+    }
+    else
+    {
+        free(metro->stations);
+        freeStringPool(&metro->names);
+        free(metro->offsets);
+        free(metro->neighbors);
+        free(metro->times);
+        free(metro->prices);
+    }
+    free(metro->edges);
+    memset(metro, 0, sizeof(*metro));
+}
+
+void *copyOf(const void *data, size_t size)
 {
-    int i, j;
-    for (i = 0; i < metro->numStations; i++)
+    void *copy = checkedRealloc(NULL, size > 0 ? size : 1);
+    if (size > 0)
     {
-        if (strcmp(metro->stations[i].name, station1) == 0)
+        memcpy(copy, data, size);
+    }
+    return copy;
+}
+
+// Moves an image-backed network onto the heap so it can be modified, and
+// recreates the connection list from the CSR arrays
+void ownMetroStorage(MetroSystem *metro)
+{
+    if (metro->image == NULL)
+    {
+        return;
+    }
+
+    int n = metro->numStations;
+    metro->stations = copyOf(metro->stations, (size_t)n * sizeof(Station));
+    metro->stationCapacity = n;
+    metro->names.data = copyOf(metro->names.data, metro->names.size);
+    metro->names.capacity = metro->names.size;
+    metro->names.slots = copyOf(metro->names.slots, (size_t)metro->names.numSlots * sizeof(InternSlot));
+    metro->offsets = copyOf(metro->offsets, (size_t)(n + 1) * sizeof(int));
+    metro->neighbors = copyOf(metro->neighbors, (size_t)metro->numArcs * sizeof(int));
+    metro->times = copyOf(metro->times, (size_t)metro->numArcs * sizeof(int));
+    metro->prices = copyOf(metro->prices, (size_t)metro->numArcs * sizeof(int));
+
+    munmap(metro->image, metro->imageSize);
+    metro->image = NULL;
+    metro->imageSize = 0;
+
+    metro->numEdges = 0;
+    for (int u = 0; u < n; u++)
+    {
+        for (int a = metro->offsets[u]; a < metro->offsets[u + 1]; a++)
         {
-            for (j = 0; j < metro->numStations; j++)
+            if (u <= metro->neighbors[a])
             {
-                if (strcmp(metro->stations[j].name, station2) == 0)
+                if (metro->numEdges == metro->edgeCapacity)
                 {
-                    metro->stations[i].connections[j].time = time;
-                    metro->stations[i].connections[j].price = price;
-                    metro->stations[j].connections[i].time = time;
-                    metro->stations[j].connections[i].price = price;
-                    break;
+                    metro->edgeCapacity = metro->edgeCapacity ? metro->edgeCapacity * 2 : 256;
+                    metro->edges = checkedRealloc(metro->edges, (size_t)metro->edgeCapacity * sizeof(Edge));
                 }
+                Edge *edge = &metro->edges[metro->numEdges++];
+                edge->from = u;
+                edge->to = metro->neighbors[a];
+                edge->time = metro->times[a];
+                edge->price = metro->prices[a];
             }
-            break;
         }
     }
 }
 
-void dijkstra(MetroSystem *metro, int start, int *distances, int *previous, int priority)
+const char *stationName(const MetroSystem *metro, int station)
+{
+    return metro->names.data + metro->stations[station].name;
+}
+
+const char *stationColor(const MetroSystem *metro, int station)
+{
+    return metro->names.data + metro->stations[station].color;
+}
+
+// Returns the id of the first station added under name, or -1
+int findStation(const MetroSystem *metro, const char *name)
+{
+    return lookupString(&metro->names, name);
+}
+
+void addStation(MetroSystem *metro, const char *name, const char *color)
+{
+    ownMetroStorage(metro);
+    if (metro->numStations == metro->stationCapacity)
+    {
+        metro->stationCapacity = metro->stationCapacity ? metro->stationCapacity * 2 : 64;
+        metro->stations = checkedRealloc(metro->stations, (size_t)metro->stationCapacity * sizeof(Station));
+    }
+
+    Station *station = &metro->stations[metro->numStations];
+    station->color = internString(&metro->names, color)->string;
+
+    // Interchanges are added once per line; lookups by name resolve to the first one
+    InternSlot *slot = internString(&metro->names, name);
+    station->name = slot->string;
+    if (slot->value == -1)
+    {
+        slot->value = metro->numStations;
+    }
+
+    metro->numStations++;
+    metro->finalized = 0;
+}
+
+void addEdge(MetroSystem *metro, int from, int to, int time, int price)
+{
+    ownMetroStorage(metro);
+    if (metro->numEdges == metro->edgeCapacity)
+    {
+        metro->edgeCapacity = metro->edgeCapacity ? metro->edgeCapacity * 2 : 256;
+        metro->edges = checkedRealloc(metro->edges, (size_t)metro->edgeCapacity * sizeof(Edge));
+    }
+
+    Edge *edge = &metro->edges[metro->numEdges++];
+    edge->from = from;
+    edge->to = to;
+    edge->time = time;
+    edge->price = price;
+    metro->finalized = 0;
+}
+
+void addConnection(MetroSystem *metro, const char *station1, const char *station2, int time, float price)
+{
+    int i = findStation(metro, station1);
+    int j = findStation(metro, station2);
+
+    if (i == -1 || j == -1)
+    {
+        fprintf(stderr, "Warning: connection %s - %s dropped, unknown station \"%s\".\n",
+                station1, station2, i == -1 ? station1 : station2);
+        return;
+    }
+    addEdge(metro, i, j, time, price);
+}
+
+// Builds the CSR arrays from the edge list. Each connection is stored in both
+// directions; if the same pair was connected more than once the last call wins,
+// and every row is sorted by neighbour id.
+void finalizeMetroSystem(MetroSystem *metro)
 {
-    int visited[MAX_STATIONS] = {0};
-    distances[start] = 0;
+    ownMetroStorage(metro);
+
+    int n = metro->numStations;
+    int arcs = metro->numEdges * 2;
+
+    metro->offsets = checkedRealloc(metro->offsets, (size_t)(n + 1) * sizeof(int));
+    metro->neighbors = checkedRealloc(metro->neighbors, (size_t)arcs * sizeof(int));
+    metro->times = checkedRealloc(metro->times, (size_t)arcs * sizeof(int));
+    metro->prices = checkedRealloc(metro->prices, (size_t)arcs * sizeof(int));
+
+    int *fill = checkedRealloc(NULL, (size_t)(n + 1) * sizeof(int));
+    memset(metro->offsets, 0, (size_t)(n + 1) * sizeof(int));
+
+    for (int e = 0; e < metro->numEdges; e++)
+    {
+        metro->offsets[metro->edges[e].from + 1]++;
+        metro->offsets[metro->edges[e].to + 1]++;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        metro->offsets[i + 1] += metro->offsets[i];
+    }
+    memcpy(fill, metro->offsets, (size_t)(n + 1) * sizeof(int));
+
+    // Edge order is preserved within a row, so later duplicates follow earlier ones
+    for (int e = 0; e < metro->numEdges; e++)
+    {
+        const Edge *edge = &metro->edges[e];
+        int a = fill[edge->from]++;
+        metro->neighbors[a] = edge->to;
+        metro->times[a] = edge->time;
+        metro->prices[a] = edge->price;
+
+        int b = fill[edge->to]++;
+        metro->neighbors[b] = edge->from;
+        metro->times[b] = edge->time;
+        metro->prices[b] = edge->price;
+    }
 
-    for (int count = 0; count < metro->numStations - 1; count++)
+    // Stable insertion sort per row (rows are short), then drop all but the last duplicate
+    int write = 0;
+    for (int i = 0; i < n; i++)
     {
-        int minDistance = INT_MAX, minIndex = -1;
+        int begin = metro->offsets[i];
+        int end = metro->offsets[i + 1];
 
-        for (int i = 0; i < metro->numStations; i++)
+        for (int a = begin + 1; a < end; a++)
         {
-            if (!visited[i] && distances[i] < minDistance)
+            int neighbor = metro->neighbors[a], time = metro->times[a], price = metro->prices[a];
+            int b = a - 1;
+            while (b >= begin && metro->neighbors[b] > neighbor)
             {
-                minDistance = distances[i];
-                minIndex = i;
+                metro->neighbors[b + 1] = metro->neighbors[b];
+                metro->times[b + 1] = metro->times[b];
+                metro->prices[b + 1] = metro->prices[b];
+                b--;
             }
+            metro->neighbors[b + 1] = neighbor;
+            metro->times[b + 1] = time;
+            metro->prices[b + 1] = price;
         }
 
-        visited[minIndex] = 1;
-
-        for (int i = 0; i < metro->numStations; i++)
+        metro->offsets[i] = write;
+        for (int a = begin; a < end; a++)
         {
-            int weight = (priority == 0) ? metro->stations[minIndex].connections[i].time : metro->stations[minIndex].connections[i].price;
-
-            if (!visited[i] && weight != -1 && distances[minIndex] != INT_MAX &&
-                distances[minIndex] + weight < distances[i])
+            if (a + 1 < end && metro->neighbors[a + 1] == metro->neighbors[a])
             {
-                distances[i] = distances[minIndex] + weight;
-                previous[i] = minIndex;
+                continue;
             }
+            metro->neighbors[write] = metro->neighbors[a];
+            metro->times[write] = metro->times[a];
+            metro->prices[write] = metro->prices[a];
+            write++;
         }
     }
+    metro->offsets[n] = write;
+    metro->numArcs = write;
+
+    free(fill);
+    metro->finalized = 1;
 }
 
-char *printRoute(MetroSystem *metro, int *previous, int start, int end, int priority)
+// Returns the CSR index of the arc from -> to, or -1 if the stations are not adjacent
+int findArc(const MetroSystem *metro, int from, int to)
 {
-    char *result = (char *)malloc(1000 * sizeof(char));
-    if (previous[end] == -1)
+    for (int a = metro->offsets[from]; a < metro->offsets[from + 1]; a++)
     {
-        sprintf(result, "No route available.\n");
-        return result;
+        if (metro->neighbors[a] == to)
+        {
+            return a;
+        }
     }
+    return -1;
+}
 
-    sprintf(result, "Route: ");
-    int current = end;
-    int next = previous[current];
-    int junctionCount = 0;
-    int totalTime = 0;
-    int totalPrice = 0;
-    int stationCount = 0;
-    int stationOrder[100];
+// Weight of a connection closed by a disruption, in both times and prices;
+// searches never relax it
+#define ARC_CLOSED INT_MAX
 
-    while (next != -1)
-    {
-        int weight = (priority == 0) ? metro->stations[current].connections[next].time : metro->stations[current].connections[next].price;
+// Largest connection weight a network of numStations may carry. A path is at
+// most numStations - 1 connections, and the bidirectional searches add two
+// path costs while ALT keys add a potential to twice one, so three full paths
+// must still fit in an int.
+int maxConnectionWeight(int numStations)
+{
+    return (INT_MAX - 1) / 3 / (numStations > 1 ? numStations - 1 : 1);
+}
 
-        if (strstr(metro->stations[current].name, "-junction") != NULL)
-        {
-            stationOrder[stationCount++] = current;
-        }
+const int *arcWeights(const MetroSystem *metro, int priority)
+{
+    return (priority == 0) ? metro->times : metro->prices;
+}
 
-        totalTime += metro->stations[current].connections[next].time;
-        totalPrice += metro->stations[current].connections[next].price;
+typedef enum
+{
+    QUEUE_BINARY_HEAP,
+    QUEUE_QUAD_HEAP,
+    QUEUE_BUCKET
+} QueueKind;
 
-        current = next;
-        next = previous[current];
-    }
+// Min-priority queue over station ids, ordered by (key, id) so that ties are
+// broken towards the lower station id exactly like the original linear scan.
+//   QUEUE_BINARY_HEAP: binary heap with lazy deletion, stale entries are skipped by the caller
+//   QUEUE_QUAD_HEAP:   4-ary heap with decrease-key through position[]
+//   QUEUE_BUCKET:      Dial's circular bucket queue, one bucket per integer key in [current, current + maxWeight]
+typedef struct
+{
+    QueueKind kind;
+    int size;
+    int capacity;
+    int *keys;
+    int *nodes;
+    int *position;
+
+    int numBuckets;
+    int current;
+    int *bucketHead;
+    int *bucketNext;
+    int *bucketPrev;
 
-    stationOrder[stationCount++] = start;
+    long operations;
+} PriorityQueue;
 
-    for (int i = stationCount - 1; i >= 0; i--)
+const char *queueKindName(QueueKind kind)
+{
+    switch (kind)
     {
-        char temp[100];
-        sprintf(temp, "%s", metro->stations[stationOrder[i]].name);
-        strcat(result, temp);
+    case QUEUE_BINARY_HEAP:
+        return "binary";
+    case QUEUE_QUAD_HEAP:
+        return "quad";
+    case QUEUE_BUCKET:
+        return "bucket";
+    }
+    return "unknown";
+}
 
-        if (i > 0)
+int parseQueueKind(const char *name, QueueKind *kind)
+{
+    for (int k = QUEUE_BINARY_HEAP; k <= QUEUE_BUCKET; k++)
+    {
+        if (strcmp(name, queueKindName((QueueKind)k)) == 0)
         {
-            strcat(result, " -> ");
+            *kind = (QueueKind)k;
+            return 1;
         }
     }
+    return 0;
+}
 
-    char temp[100];
-    sprintf(temp, " -> %s", metro->stations[end].name);
-    strcat(result, temp);
-
-    sprintf(temp, "\n");
-
-    strcat(result, temp);
+void queueInit(PriorityQueue *queue, QueueKind kind, const MetroSystem *metro)
+{
+    int n = metro->numStations;
+    memset(queue, 0, sizeof(*queue));
+    queue->kind = kind;
 
-    if (priority == 0)
+    if (kind == QUEUE_BINARY_HEAP)
     {
-        sprintf(temp, "Total Time: %d minutes\n", totalTime);
-        strcat(result, temp);
+        // Lazy deletion pushes at most once per relaxed arc plus the source
+        queue->capacity = metro->numArcs + 1;
     }
-    if (priority == 1)
+    else
     {
-        sprintf(temp, "Total Price: %d rupees\n", totalPrice);
-        strcat(result, temp);
+        queue->capacity = n;
+    }
+    queue->keys = checkedRealloc(NULL, (size_t)(queue->capacity > 0 ? queue->capacity : 1) * sizeof(int));
+    queue->nodes = checkedRealloc(NULL, (size_t)(queue->capacity > 0 ? queue->capacity : 1) * sizeof(int));
+    queue->position = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        queue->position[i] = -1;
     }
 
-    return result;
+    if (kind == QUEUE_BUCKET)
+    {
+        // Closed connections are never relaxed, so they do not widen the range
+        int maxWeight = 0;
+        for (int a = 0; a < metro->numArcs; a++)
+        {
+            if (metro->times[a] > maxWeight && metro->times[a] != ARC_CLOSED)
+                maxWeight = metro->times[a];
+            if (metro->prices[a] > maxWeight && metro->prices[a] != ARC_CLOSED)
+                maxWeight = metro->prices[a];
+        }
+        queue->numBuckets = maxWeight + 1;
+        queue->bucketHead = checkedRealloc(NULL, (size_t)queue->numBuckets * sizeof(int));
+        queue->bucketNext = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        queue->bucketPrev = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        for (int b = 0; b < queue->numBuckets; b++)
+        {
+            queue->bucketHead[b] = -1;
+        }
+    }
 }
 
-int main()
+void queueFree(PriorityQueue *queue)
 {
-    MetroSystem metro;
-    initializeMetroSystem(&metro);
+    free(queue->keys);
+    free(queue->nodes);
+    free(queue->position);
+    free(queue->bucketHead);
+    free(queue->bucketNext);
+    free(queue->bucketPrev);
+    memset(queue, 0, sizeof(*queue));
+}
 
-    // purple line
-    addStation(&metro, "Challaghatta", "Purple");
-    addStation(&metro, "Kengeri", "Purple");
-    addStation(&metro, "Kengeri Bus Terminal", "Purple");
-    addStation(&metro, "Pattanagere", "Purple");
-    addStation(&metro, "Jnanabharathi", "Purple");
-    addStation(&metro, "Rajarajeshwari nagar", "Purple");
-    addStation(&metro, "Nayandahalli", "Purple");
-    addStation(&metro, "Mysuru Road", "Purple");
-    addStation(&metro, "Deepanjali Nagar", "Purple");
-    addStation(&metro, "Attiguppe", "Purple");
-    addStation(&metro, "Vijaynagar", "Purple");
-    addStation(&metro, "Hosahalli", "Purple");
-    addStation(&metro, "Magadi Road", "Purple");
-    addStation(&metro, "KSR City Railway Stn", "Purple");
-    addStation(&metro, "Kempegowda Stn. Majestic -junction", "Purple"); // Intersection w greenline
-    addStation(&metro, "Central college", "Purple");
-    addStation(&metro, "Vidhana soudha", "Purple");
-    addStation(&metro, "Cubbon park", "Purple");
-    addStation(&metro, "Mahatma Gandhi Road -junction", "Purple"); // Intersection w pink line
-    addStation(&metro, "Triniti", "Purple");
-    addStation(&metro, "Halasuru", "Purple");
-    addStation(&metro, "Indiranagar", "Purple");
-    addStation(&metro, "Swami Vivekananda Road", "Purple");
-    addStation(&metro, "Bayappanahalli", "Purple");
-    addStation(&metro, "Benniganahalli", "Purple");
-    addStation(&metro, "KR Pura-junction", "Purple"); // Intersection w blue line
-    addStation(&metro, "Singayyaapalya", "Purple");
-    addStation(&metro, "Garudacharpalya", "Purple");
-    addStation(&metro, "Hoodi", "Purple");
-    addStation(&metro, "Seetharam Palya", "Purple");
-    addStation(&metro, "Kundalahalli", "Purple");
-    addStation(&metro, "NallurHalli", "Purple");
-    addStation(&metro, "Sri Sathya Sai Hospital", "Purple");
-    addStation(&metro, "Pattandur Agrahara", "Purple");
-    addStation(&metro, "Kadugodi Tree Park", "Purple");
-    addStation(&metro, "Channasandra (Hopefarm)", "Purple");
-    addStation(&metro, "Whitefield Kadugodi", "Purple");
+int queueLess(const PriorityQueue *queue, int a, int b)
+{
+    return queue->keys[a] < queue->keys[b] || (queue->keys[a] == queue->keys[b] && queue->nodes[a] < queue->nodes[b]);
+}
 
-    // green line
-    addStation(&metro, "Madavara", "Green");
-    addStation(&metro, "Chikkabidarakallu", "Green");
-    addStation(&metro, "Manjunathanagar", "Green");
-    addStation(&metro, "Nagasandra", "Green");
-    addStation(&metro, "Dasarahalli", "Green");
-    addStation(&metro, "Jalahalli", "Green");
-    addStation(&metro, "Peenya Industry", "Green");
-    addStation(&metro, "Peenya", "Green");
-    addStation(&metro, "Goraguntepalya", "Green");
-    addStation(&metro, "Yeshawanthpur", "Green");
-    addStation(&metro, "Sandal Soap Factory", "Green");
-    addStation(&metro, "Mahalakshmi", "Green");
-    addStation(&metro, "Rajaji Nagar", "Green");
-    addStation(&metro, "Kuvempu Road", "Green");
-    addStation(&metro, "Srirampura", "Green");
-    addStation(&metro, "Sampige Road", "Green");
-    addStation(&metro, "Kempegowda Stn. Majestic -junction", "Green"); // Intersection w purpleline
-    addStation(&metro, "Chickpete", "Green");
-    addStation(&metro, "Krishna Rajendra Market", "Green");
-    addStation(&metro, "National College", "Green");
-    addStation(&metro, "Lalbagh", "Green");
-    addStation(&metro, "South End Cirle", "Green");
-    addStation(&metro, "Jayanagar", "Green");
-    addStation(&metro, "Rashtreeya Vidyalaya Road -junction", "Green"); // Intersection w yellow line
-    addStation(&metro, "Banashankari", "Green");
-    addStation(&metro, "Jayaprakash Nagar", "Green");
-    addStation(&metro, "Yelachenahalli", "Green");
-    addStation(&metro, "Konanakunte Cross", "Green");
-    addStation(&metro, "Doddakallasandra", "Green");
-    addStation(&metro, "Vajarahalli", "Green");
-    addStation(&metro, "Thalaghattapura", "Green");
-    addStation(&metro, "Silk Institute", "Green");
+void queueSwap(PriorityQueue *queue, int a, int b)
+{
+    int key = queue->keys[a], node = queue->nodes[a];
+    queue->keys[a] = queue->keys[b];
+    queue->nodes[a] = queue->nodes[b];
+    queue->keys[b] = key;
+    queue->nodes[b] = node;
+    if (queue->kind == QUEUE_QUAD_HEAP)
+    {
+        queue->position[queue->nodes[a]] = a;
+        queue->position[queue->nodes[b]] = b;
+    }
+}
 
-    // pink line
-    addStation(&metro, "Nagawara -junction", "Pink"); // Intersection w blue line
-    addStation(&metro, "Kadagundanahalli", "Pink");
-    addStation(&metro, "Venkateshpura", "Pink");
-    addStation(&metro, "Tannery Road", "Pink");
-    addStation(&metro, "Pottery Town", "Pink");
-    addStation(&metro, "Cantonment", "Pink");
-    addStation(&metro, "Shivajinagar", "Pink");
-    addStation(&metro, "Mahatma Ghandi Road", "Pink"); // Intersection w purple line
-    addStation(&metro, "Rashtriya Military School", "Pink");
-    addStation(&metro, "Langford Town", "Pink");
-    addStation(&metro, "Lakhasandra", "Pink");
-    addStation(&metro, "Dairy Circle", "Pink");
-    addStation(&metro, "Tavarekere", "Pink");
-    addStation(&metro, "Jayadeva Hospital -junction", "Pink"); // Intersection w yellow line
-    addStation(&metro, "JP Nagar 4th Phase", "Pink");
-    addStation(&metro, "IIM Bangalore", "Pink");
-    addStation(&metro, "Hullmavu", "Pink");
-    addStation(&metro, "Kalena Agrahara", "Pink");
+void heapSiftUp(PriorityQueue *queue, int index, int arity)
+{
+    while (index > 0)
+    {
+        int parent = (index - 1) / arity;
+        if (!queueLess(queue, index, parent))
+            break;
+        queueSwap(queue, index, parent);
+        index = parent;
+    }
+}
 
-    // yellow line
-    addStation(&metro, "Rashtreeya Vidyalaya Road -junction", "Yellow"); // Intersection w green line
-    addStation(&metro, "Ragigudda", "Yellow");
-    addStation(&metro, "Jayadeva Hospital -junction", "Yellow"); // Intersection w pink line
-    addStation(&metro, "BTM Layout", "Yellow");
-    addStation(&metro, "Central Silk Board-junction", "Yellow"); // Intersection w blue line
-    addStation(&metro, "Bommanahalli", "Yellow");
-    addStation(&metro, "Hongasandra", "Yellow");
-    addStation(&metro, "Kudlu Gate", "Yellow");
-    addStation(&metro, "Singasandra", "Yellow");
-    addStation(&metro, "Hosa Road", "Yellow");
-    addStation(&metro, "Beratena Agrahara", "Yellow");
-    addStation(&metro, "Electronic City", "Yellow");
-    addStation(&metro, "Konnapana Agrahara", "Yellow");
-    addStation(&metro, "Huskur Road", "Yellow");
-    addStation(&metro, "Hebbagodi", "Yellow");
-    addStation(&metro, "Bommasandra", "Yellow");
+void heapSiftDown(PriorityQueue *queue, int index, int arity)
+{
+    for (;;)
+    {
+        int first = index * arity + 1;
+        if (first >= queue->size)
+            break;
 
-    // blue line
-    addStation(&metro, "Kempegowda International Airport", "Blue");
-    addStation(&metro, "Airport City", "Blue");
-    addStation(&metro, "Doddajala", "Blue");
-    addStation(&metro, "Bettahalasuru", "Blue");
-    addStation(&metro, "Bagalur Cross", "Blue");
-    addStation(&metro, "Yelahanka", "Blue");
-    addStation(&metro, "Jakkur Cross", "Blue");
-    addStation(&metro, "Kodigerehalli", "Blue");
-    addStation(&metro, "Hebbal", "Blue");
-    addStation(&metro, "Kempapura", "Blue");
-    addStation(&metro, "Veerannapalya", "Blue");
-    addStation(&metro, "Nagawara -junction", "Blue"); // intersection w pink line
-    addStation(&metro, "HBR Layout", "Blue");
-    addStation(&metro, "Kalyan Nagar", "Blue");
-    addStation(&metro, "HRBR Layout", "Blue");
-    addStation(&metro, "Horamavu", "Blue");
-    addStation(&metro, "Kasturinagar", "Blue");
-    addStation(&metro, "KR Pura-junction", "Blue"); // intersection w purple line
-    addStation(&metro, "Mahadevapura", "Blue");
-    addStation(&metro, "DRDO Sports Complex", "Blue");
-    addStation(&metro, "Doddanekundi", "Blue");
-    addStation(&metro, "ISRO (Karthik Nagar)", "Blue");
-    addStation(&metro, "Marathahalli", "Blue");
-    addStation(&metro, "Kadubeesanahalli", "Blue");
-    addStation(&metro, "Devarabeesanahalli", "Blue");
-    addStation(&metro, "Bellandur", "Blue");
-    addStation(&metro, "Iblur", "Blue");
-    addStation(&metro, "Agara Lake", "Blue");
-    addStation(&metro, "HSR Layout", "Blue");
-    addStation(&metro, "Central Silk Board-junction", "Blue"); // intersection w yellow line
+        int best = first;
+        int last = first + arity < queue->size ? first + arity : queue->size;
+        for (int child = first + 1; child < last; child++)
+        {
+            if (queueLess(queue, child, best))
+                best = child;
+        }
+        if (!queueLess(queue, best, index))
+            break;
+        queueSwap(queue, index, best);
+        index = best;
+    }
+}
 
-    // purple line connections
-    addConnection(&metro, "Challaghatta", "Kengeri", 3, 3.2);
-    addConnection(&metro, "Kengeri", "Kengeri Bus Terminal", 2, 2.6);
-    addConnection(&metro, "Kengeri Bus Terminal", "Pattanagere", 2, 2.8);
-    addConnection(&metro, "Pattanagere", "Jnanabharathi", 1, 3.1);
-    addConnection(&metro, "Jnanabharathi", "Rajarajeshwari nagar", 3, 3.3);
-    addConnection(&metro, "Rajarajeshwari nagar", "Nayandahalli", 3, 2.7);
-    addConnection(&metro, "Nayandahalli", "Mysuru Road", 1, 2.9);
-    addConnection(&metro, "Mysuru Road", "Deepanjali Nagar", 4, 2.5);
-    addConnection(&metro, "Deepanjali Nagar", "Attiguppe", 1, 2.8);
-    addConnection(&metro, "Attiguppe", "Vijaynagar", 3, 3.0);
-    addConnection(&metro, "Vijaynagar", "Hosahalli", 4, 3.2);
-    addConnection(&metro, "Hosahalli", "Magadi Road", 2, 3.1);
-    addConnection(&metro, "Magadi Road", "KSR City Railway Stn", 6, 2.6);
-    addConnection(&metro, "KSR City Railway Stn", "Kempegowda Stn. Majestic -junction", 1, 3.3);
-    addConnection(&metro, "Kempegowda Stn. Majestic -junction", "Central college", 3, 3.4);
-    addConnection(&metro, "Central college", "Vidhana soudha", 1, 2.9);
-    addConnection(&metro, "Vidhana soudha", "Cubbon park", 2, 2.7);
-    addConnection(&metro, "Cubbon park", "Mahatma Gandhi Road -junction", 1, 3.0);
-    addConnection(&metro, "Mahatma Gandhi Road -junction", "Triniti", 4, 2.8);
-    addConnection(&metro, "Triniti", "Halasuru", 3, 3.2);
-    addConnection(&metro, "Halasuru", "Indiranagar", 4, 3.1);
-    addConnection(&metro, "Indiranagar", "Swami Vivekananda Road", 2, 3.4);
-    addConnection(&metro, "Swami Vivekananda Road", "Bayappanahalli", 3, 3.3);
-    addConnection(&metro, "Bayappanahalli", "Benniganahalli", 3, 3.2);
-    addConnection(&metro, "Benniganahalli", "KR Pura-junction", 4, 3.0);
-    addConnection(&metro, "KR Pura-junction", "Singayyaapalya", 4, 3.1);
-    addConnection(&metro, "Singayyaapalya", "Garudacharpalya", 3, 2.9);
-    addConnection(&metro, "Garudacharpalya", "Hoodi", 2, 3.3);
-    addConnection(&metro, "Hoodi", "Seetharam Palya", 4, 3.0);
-    addConnection(&metro, "Seetharam Palya", "Kundalahalli", 1, 2.7);
-    addConnection(&metro, "Kundalahalli", "NallurHalli", 3, 3.2);
-    addConnection(&metro, "NallurHalli", "Sri Sathya Sai Hospital", 1, 2.8);
-    addConnection(&metro, "Sri Sathya Sai Hospital", "Pattandur Agrahara", 2, 2.6);
-    addConnection(&metro, "Pattandur Agrahara", "Kadugodi Tree Park", 3, 2.9);
-    addConnection(&metro, "Kadugodi Tree Park", "Channasandra (Hopefarm)", 4, 3.0);
-    addConnection(&metro, "Channasandra (Hopefarm)", "Whitefield Kadugodi", 2, 2.7);
+void bucketUnlink(PriorityQueue *queue, int node)
+{
+    int bucket = queue->keys[node] % queue->numBuckets;
+    if (queue->bucketPrev[node] != -1)
+        queue->bucketNext[queue->bucketPrev[node]] = queue->bucketNext[node];
+    else
+        queue->bucketHead[bucket] = queue->bucketNext[node];
+    if (queue->bucketNext[node] != -1)
+        queue->bucketPrev[queue->bucketNext[node]] = queue->bucketPrev[node];
+    queue->position[node] = -1;
+    queue->size--;
+}
 
-    // green line connections
-    addConnection(&metro, "Madavara", "Chikkabidarakallu", 1, 3.4);
-    addConnection(&metro, "Chikkabidarakallu", "Manjunathanagar", 2, 2.9);
-    addConnection(&metro, "Manjunathanagar", "Nagasandra", 3, 3.1);
-    addConnection(&metro, "Nagasandra", "Dasarahalli", 2, 2.8);
-    addConnection(&metro, "Dasarahalli", "Jalahalli", 1, 2.7);
-    addConnection(&metro, "Jalahalli", "Peenya Industry", 3, 3.0);
-    addConnection(&metro, "Peenya Industry", "Peenya", 4, 2.9);
-    addConnection(&metro, "Peenya", "Goraguntepalya", 3, 3.2);
-    addConnection(&metro, "Goraguntepalya", "Yeshawanthpur", 3, 3.1);
-    addConnection(&metro, "Yeshawanthpur", "Sandal Soap Factory", 4, 3.3);
-    addConnection(&metro, "Sandal Soap Factory", "Mahalakshmi", 4, 3.0);
-    addConnection(&metro, "Mahalakshmi", "Rajaji Nagar", 3, 3.2);
-    addConnection(&metro, "Rajaji Nagar", "Kuvempu Road", 2, 2.9);
-    addConnection(&metro, "Kuvempu Road", "Srirampura", 1, 3.1);
-    addConnection(&metro, "Srirampura", "Sampige Road", 3, 3.0);
-    addConnection(&metro, "Sampige Road", "Kempegowda Stn. Majestic", 4, 2.8); // Intersection w Purple Line
-    addConnection(&metro, "Kempegowda Stn. Majestic", "Chickpete", 2, 2.7);
-    addConnection(&metro, "Chickpete", "Krishna Rajendra Market", 1, 2.9);
-    addConnection(&metro, "Krishna Rajendra Market", "National College", 3, 2.6);
-    addConnection(&metro, "National College", "Lalbagh", 3, 3.0);
-    addConnection(&metro, "Lalbagh", "South End Circle", 2, 2.8);
-    addConnection(&metro, "South End Circle", "Jayanagar", 3, 3.2);
-    addConnection(&metro, "Jayanagar", "Rashtreeya Vidyalaya Road -junction", 4, 3.1); // Intersection w Yellow Line
-    addConnection(&metro, "Rashtreeya Vidyalaya Road -junction", "Banashankari", 4, 3.3);
-    addConnection(&metro, "Banashankari", "Jayaprakash Nagar", 3, 2.9);
-    addConnection(&metro, "Jayaprakash Nagar", "Yelachenahalli", 2, 3.1);
-    addConnection(&metro, "Yelachenahalli", "Konanakunte Cross", 1, 2.8);
-    addConnection(&metro, "Konanakunte Cross", "Doddakallasandra", 3, 3.0);
-    addConnection(&metro, "Doddakallasandra", "Vajarahalli", 3, 2.9);
-    addConnection(&metro, "Vajarahalli", "Thalaghattapura", 2, 3.2);
-    addConnection(&metro, "Thalaghattapura", "Silk Institute", 3, 3.1);
+// Empties the queue in time proportional to what is left in it
+void queueClear(PriorityQueue *queue)
+{
+    if (queue->kind == QUEUE_QUAD_HEAP)
+    {
+        for (int i = 0; i < queue->size; i++)
+            queue->position[queue->nodes[i]] = -1;
+    }
+    else if (queue->kind == QUEUE_BUCKET)
+    {
+        for (int b = 0; b < queue->numBuckets && queue->size > 0; b++)
+        {
+            while (queue->bucketHead[b] != -1)
+                bucketUnlink(queue, queue->bucketHead[b]);
+        }
+        queue->current = 0;
+    }
+    queue->size = 0;
+}
 
-    // pink line connections
-    addConnection(&metro, "Nagawara -junction", "Kadagundanahalli", 1, 3.5);
-    addConnection(&metro, "Kadagundanahalli", "Venkateshpura", 2, 3.0);
-    addConnection(&metro, "Venkateshpura", "Tannery Road", 3, 3.2);
-    addConnection(&metro, "Tannery Road", "Pottery Town", 2, 2.9);
-    addConnection(&metro, "Pottery Town", "Cantonment", 1, 3.1);
-    addConnection(&metro, "Cantonment", "Shivajinagar", 3, 3.0);
-    addConnection(&metro, "Shivajinagar", "Mahatma Gandhi Road -junction", 1, 2.7); // Intersection w Purple Line
-    addConnection(&metro, "Mahatma Gandhi Road -junction", "Rashtriya Military School", 2, 2.6);
-    addConnection(&metro, "Rashtriya Military School", "Langford Town", 8, 2.9);
-    addConnection(&metro, "Langford Town", "Lakhasandra", 3, 3.3);
-    addConnection(&metro, "Lakhasandra", "Dairy Circle", 2, 3.1);
-    addConnection(&metro, "Dairy Circle", "Tavarekere", 4, 2.8);
-    addConnection(&metro, "Tavarekere", "Jayadeva Hospital -junction", 3, 3.0); // Intersection w Yellow Line
-    addConnection(&metro, "Jayadeva Hospital -junction", "JP Nagar 4th Phase", 4, 3.2);
-    addConnection(&metro, "JP Nagar 4th Phase", "IIM Bangalore", 3, 2.9);
-    addConnection(&metro, "IIM Bangalore", "Hullmavu", 2, 3.1);
-    addConnection(&metro, "Hullmavu", "Kalena Agrahara", 1, 2.8);
+// Inserts node with the given key, or lowers its key if it is already queued
+void queuePush(PriorityQueue *queue, int node, int key)
+{
+    queue->operations++;
+    if (queue->kind == QUEUE_BINARY_HEAP)
+    {
+        int index = queue->size++;
+        queue->keys[index] = key;
+        queue->nodes[index] = node;
+        heapSiftUp(queue, index, 2);
+    }
+    else if (queue->kind == QUEUE_QUAD_HEAP)
+    {
+        int index = queue->position[node];
+        if (index == -1)
+        {
+            index = queue->size++;
+            queue->nodes[index] = node;
+            queue->position[node] = index;
+        }
+        queue->keys[index] = key;
+        heapSiftUp(queue, index, 4);
+    }
+    else
+    {
+        // keys[] and the bucket links are indexed by station id here
+        if (queue->position[node] != -1)
+            bucketUnlink(queue, node);
+        // Every queued key lies in [last popped key, last popped key + maxWeight]
+        if (queue->size == 0 || key < queue->current)
+            queue->current = key;
 
-    // yellow line connections
-    addConnection(&metro, "Rashtreeya Vidyalaya Road -junction", "Ragigudda", 3, 2.9);
-    addConnection(&metro, "Ragigudda", "Jayadeva Hospital -junction", 2, 3.1); // Intersection w Yellow Line
-    addConnection(&metro, "Jayadeva Hospital -junction", "BTM Layout", 1, 2.8);
-    addConnection(&metro, "BTM Layout", "Central Silk Board-junction", 3, 2.7); // Intersection w Blue Line
-    addConnection(&metro, "Central Silk Board-junction", "Bommanahalli", 4, 2.9);
-    addConnection(&metro, "Bommanahalli", "Hongasandra", 3, 3.0);
-    addConnection(&metro, "Hongasandra", "Kudlu Gate", 2, 2.8);
-    addConnection(&metro, "Kudlu Gate", "Singasandra", 1, 3.1);
-    addConnection(&metro, "Singasandra", "Hosa Road", 3, 2.9);
-    addConnection(&metro, "Hosa Road", "Beratena Agrahara", 2, 3.0);
-    addConnection(&metro, "Beratena Agrahara", "Electronic City", 2, 3.2);
-    addConnection(&metro, "Electronic City", "Konnapana Agrahara", 3, 2.7);
-    addConnection(&metro, "Konnapana Agrahara", "Huskur Road", 2, 3.1);
-    addConnection(&metro, "Huskur Road", "Hebbagodi", 1, 2.8);
-    addConnection(&metro, "Hebbagodi", "Bommasandra", 3, 3.0);
+        int bucket = key % queue->numBuckets;
+        queue->keys[node] = key;
+        queue->position[node] = bucket;
+        queue->bucketPrev[node] = -1;
+        queue->bucketNext[node] = queue->bucketHead[bucket];
+        if (queue->bucketHead[bucket] != -1)
+            queue->bucketPrev[queue->bucketHead[bucket]] = node;
+        queue->bucketHead[bucket] = node;
+        queue->size++;
+    }
+}
 
-    // blue line connections
-    addConnection(&metro, "Kempegowda International Airport", "Airport City", 3, 2.8);
-    addConnection(&metro, "Airport City", "Doddajala", 2, 3.0);
-    addConnection(&metro, "Doddajala", "Bettahalasuru", 1, 2.9);
-    addConnection(&metro, "Bettahalasuru", "Bagalur Cross", 3, 3.1);
-    addConnection(&metro, "Bagalur Cross", "Yelahanka", 2, 2.8);
-    addConnection(&metro, "Yelahanka", "Jakkur Cross", 1, 3.0);
-    addConnection(&metro, "Jakkur Cross", "Kodigerehalli", 3, 2.9);
-    addConnection(&metro, "Kodigerehalli", "Hebbal", 2, 3.1);
-    addConnection(&metro, "Hebbal", "Kempapura", 1, 2.8);
-    addConnection(&metro, "Kempapura", "Veerannapalya", 3, 3.0);
-    addConnection(&metro, "Veerannapalya", "Nagawara -junction", 2, 2.9); // Intersection w Pink Line
-    addConnection(&metro, "Nagawara -junction", "HBR Layout", 1, 3.1);
-    addConnection(&metro, "HBR Layout", "Kalyan Nagar", 3, 2.8);
-    addConnection(&metro, "Kalyan Nagar", "HRBR Layout", 2, 3.0);
-    addConnection(&metro, "HRBR Layout", "Horamavu", 1, 2.9);
-    addConnection(&metro, "Horamavu", "Kasturinagar", 3, 3.1);
-    addConnection(&metro, "Kasturinagar", "KR Pura-junction", 2, 2.8); // Intersection w Purple Line
-    addConnection(&metro, "KR Pura-junction", "Mahadevapura", 1, 3.0);
-    addConnection(&metro, "Mahadevapura", "DRDO Sports Complex", 3, 2.9);
-    addConnection(&metro, "DRDO Sports Complex", "Doddanekundi", 2, 3.1);
-    addConnection(&metro, "Doddanekundi", "ISRO (Karthik Nagar)", 1, 2.8);
-    addConnection(&metro, "ISRO (Karthik Nagar)", "Marathahalli", 3, 3.0);
-    addConnection(&metro, "Marathahalli", "Kadubeesanahalli", 2, 2.9);
-    addConnection(&metro, "Kadubeesanahalli", "Devarabeesanahalli", 1, 3.1);
-    addConnection(&metro, "Devarabeesanahalli", "Bellandur", 3, 2.8);
-    addConnection(&metro, "Bellandur", "Iblur", 2, 3.0);
-    addConnection(&metro, "Iblur", "Agara Lake", 1, 2.9);
-    addConnection(&metro, "Agara Lake", "HSR Layout", 3, 3.1);
-    addConnection(&metro, "HSR Layout", "Central Silk Board-junction", 2, 2.8);
-
-    int startStation, endStation;
-    FILE *file = fopen("input.txt", "r");
+// Removes the minimum (key, id) entry; returns 0 when the queue is empty
+int queuePop(PriorityQueue *queue, int *node, int *key)
+{
+    if (queue->size == 0)
+        return 0;
 
-    if (file == NULL)
+    queue->operations++;
+    if (queue->kind == QUEUE_BUCKET)
     {
-        perror("Error opening file");
+        int bucket = queue->current % queue->numBuckets;
+        while (queue->bucketHead[bucket] == -1)
+        {
+            queue->current++;
+            bucket = queue->current % queue->numBuckets;
+        }
+
+        int best = queue->bucketHead[bucket];
+        for (int i = queue->bucketNext[best]; i != -1; i = queue->bucketNext[i])
+        {
+            if (i < best)
+                best = i;
+        }
+        *node = best;
+        *key = queue->keys[best];
+        bucketUnlink(queue, best);
         return 1;
     }
 
-    int from, to;
-
-    while (fscanf(file, "%d %d", &from, &to) == 2)
+    int arity = (queue->kind == QUEUE_QUAD_HEAP) ? 4 : 2;
+    *node = queue->nodes[0];
+    *key = queue->keys[0];
+    queue->size--;
+    if (queue->kind == QUEUE_QUAD_HEAP)
+        queue->position[*node] = -1;
+    if (queue->size > 0)
     {
-        startStation = from;
-        endStation = to;
+        queue->keys[0] = queue->keys[queue->size];
+        queue->nodes[0] = queue->nodes[queue->size];
+        if (queue->kind == QUEUE_QUAD_HEAP)
+            queue->position[queue->nodes[0]] = 0;
+        heapSiftDown(queue, 0, arity);
     }
-    fclose(file);
+    return 1;
+}
 
-    int distances[MAX_STATIONS];
-    int previous[MAX_STATIONS];
+// A (minutes, rupees) label of the bi-criteria search; parent is the label it extends
+typedef struct
+{
+    int time;
+    int price;
+    int station;
+    int parent;
+} ParetoLabel;
 
-    for (int i = 0; i < metro.numStations; i++)
-    {
-        distances[i] = INT_MAX;
-        previous[i] = -1;
-    }
-    dijkstra(&metro, startStation, distances, previous, 0);
-    char *timePriorityRoute = printRoute(&metro, previous, startStation, endStation, 0);
+// Scratch for paretoSearch. bestPrice[s] is the cheapest settled label at s,
+// and frontier lists the target's labels in settle order.
+typedef struct
+{
+    ParetoLabel *labels;
+    int numLabels;
+    int labelCapacity;
+    int *heap;
+    int heapSize;
+    int heapCapacity;
+    int *bestPrice;
+    int *touched;
+    int numTouched;
+    int *frontier;
+    int numFrontier;
+    int frontierCapacity;
+    long operations;
+} ParetoWorkspace;
+
+// Per-thread scratch for the bidirectional engines (chQuery, altQuery): one
+// queue, distance and parent array per direction, the ALT potential of each
+// station reached, and the resulting station-by-station path
+typedef struct
+{
+    int numStations;
+    PriorityQueue queues[2];
+    int *distances[2];
+    int *parent[2];
+    int *parentArc[2];
+    int *touched[2];
+    int numTouched[2];
+    int *potential;
+    int *path;
+    int pathLength;
+    int pathCapacity;
+} BidirectionalWorkspace;
 
-    for (int i = 0; i < metro.numStations; i++)
+void initializeBidirectionalWorkspace(BidirectionalWorkspace *workspace, const MetroSystem *metro)
+{
+    int n = metro->numStations;
+    memset(workspace, 0, sizeof(*workspace));
+    workspace->numStations = n;
+    for (int d = 0; d < 2; d++)
     {
-        distances[i] = INT_MAX;
-        previous[i] = -1;
+        queueInit(&workspace->queues[d], QUEUE_QUAD_HEAP, metro);
+        workspace->distances[d] = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        workspace->parent[d] = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        workspace->parentArc[d] = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        workspace->touched[d] = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        for (int i = 0; i < n; i++)
+        {
+            workspace->distances[d][i] = INT_MAX;
+        }
     }
-
-    dijkstra(&metro, startStation, distances, previous, 1);
-    char *pricePriorityRoute = printRoute(&metro, previous, startStation, endStation, 1);
-
-    FILE *file2 = fopen("output.txt", "w");
-    if (file2 == NULL)
+    workspace->potential = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    for (int i = 0; i < n; i++)
     {
-        fprintf(stderr, "Error opening file.\n");
-        return EXIT_FAILURE;
+        workspace->potential[i] = INT_MIN;
     }
+}
 
-    fprintf(file2, "%s", timePriorityRoute);
-    fprintf(file2, "\n%s", pricePriorityRoute);
-    fclose(file2);
-    free(timePriorityRoute);
-    free(pricePriorityRoute);
+// Undoes the previous query through the touched lists
+void resetBidirectionalWorkspace(BidirectionalWorkspace *workspace)
+{
+    for (int d = 0; d < 2; d++)
+    {
+        for (int t = 0; t < workspace->numTouched[d]; t++)
+        {
+            workspace->distances[d][workspace->touched[d][t]] = INT_MAX;
+            workspace->potential[workspace->touched[d][t]] = INT_MIN;
+        }
+        workspace->numTouched[d] = 0;
+        queueClear(&workspace->queues[d]);
+    }
+}
+
+void freeBidirectionalWorkspace(BidirectionalWorkspace *workspace)
+{
+    for (int d = 0; d < 2; d++)
+    {
+        queueFree(&workspace->queues[d]);
+        free(workspace->distances[d]);
+        free(workspace->parent[d]);
+        free(workspace->parentArc[d]);
+        free(workspace->touched[d]);
+    }
+    free(workspace->potential);
+    free(workspace->path);
+    memset(workspace, 0, sizeof(*workspace));
+}
+
+// One vehicle hop of the timetable, times in seconds after midnight
+typedef struct
+{
+    int from;
+    int to;
+    int departure;
+    int arrival;
+    int trip;
+} TimetableConnection;
+
+// Every trip of a service day as connections sorted by departure, which is
+// the order the Connection Scan Algorithm reads them in. Each trip records
+// its line name in lines. transferTime is the time needed to change trains.
+typedef struct
+{
+    TimetableConnection *connections;
+    int numConnections;
+    int connectionCapacity;
+    uint32_t *tripLines;
+    int numTrips;
+    int tripCapacity;
+    StringPool lines;
+    int transferTime;
+} Timetable;
+
+// A profile entry: leaving at departure reaches the target at arrival. Each
+// station's entries form a list through next, newest (earliest departure) first.
+typedef struct
+{
+    int departure;
+    int arrival;
+    int next;
+} ProfileEntry;
+
+// Per-thread scratch for timetable queries. arrival/inConnection/tripBoarded
+// serve earliest-arrival scans, profileHead/tripArrival/entries profile scans;
+// both are undone through the touched lists.
+typedef struct
+{
+    int numStations;
+    int numTrips;
+    int *arrival;
+    int *inConnection;
+    int *tripBoarded;
+    int *profileHead;
+    int *tripArrival;
+    ProfileEntry *entries;
+    int numEntries;
+    int entryCapacity;
+    int *touched;
+    int numTouched;
+    int *touchedTrips;
+    int numTouchedTrips;
+} CsaWorkspace;
+
+void initializeCsaWorkspace(CsaWorkspace *workspace, int numStations, int numTrips)
+{
+    memset(workspace, 0, sizeof(*workspace));
+    workspace->numStations = numStations;
+    workspace->numTrips = numTrips;
+    size_t stations = (size_t)(numStations > 0 ? numStations : 1);
+    size_t trips = (size_t)(numTrips > 0 ? numTrips : 1);
+    workspace->arrival = checkedRealloc(NULL, stations * sizeof(int));
+    workspace->inConnection = checkedRealloc(NULL, stations * sizeof(int));
+    workspace->profileHead = checkedRealloc(NULL, stations * sizeof(int));
+    workspace->touched = checkedRealloc(NULL, stations * sizeof(int));
+    workspace->tripBoarded = checkedRealloc(NULL, trips * sizeof(int));
+    workspace->tripArrival = checkedRealloc(NULL, trips * sizeof(int));
+    workspace->touchedTrips = checkedRealloc(NULL, trips * sizeof(int));
+    for (int i = 0; i < numStations; i++)
+    {
+        workspace->arrival[i] = INT_MAX;
+        workspace->profileHead[i] = -1;
+    }
+    for (int i = 0; i < numTrips; i++)
+    {
+        workspace->tripBoarded[i] = -1;
+        workspace->tripArrival[i] = INT_MAX;
+    }
+}
+
+void freeCsaWorkspace(CsaWorkspace *workspace)
+{
+    free(workspace->arrival);
+    free(workspace->inConnection);
+    free(workspace->profileHead);
+    free(workspace->touched);
+    free(workspace->tripBoarded);
+    free(workspace->tripArrival);
+    free(workspace->touchedTrips);
+    free(workspace->entries);
+    memset(workspace, 0, sizeof(*workspace));
+}
+
+#define MAX_ALTERNATIVES 8
+
+// Scratch for alternative routes: a full tree from each end when neither the
+// route table nor the tree cache has it, the candidate via stations as
+// (cost << 32 | station), the route being checked, and every route chosen so
+// far with the next station along it, for the overlap test. marks[] and
+// onRoute[] are stamped like SearchWorkspace.settled.
+typedef struct
+{
+    int numStations;
+    int *distances[2];
+    int *previous[2];
+    int *render;
+    uint64_t *candidates;
+    int *path;
+    unsigned *marks;
+    unsigned markStamp;
+    unsigned *onRoute;
+    unsigned routeStamp;
+    int *routes[MAX_ALTERNATIVES + 1];
+    int *successor[MAX_ALTERNATIVES + 1];
+    int routeLengths[MAX_ALTERNATIVES + 1];
+} AlternativeWorkspace;
+
+void initializeAlternativeWorkspace(AlternativeWorkspace *workspace, int numStations)
+{
+    size_t n = (size_t)(numStations > 0 ? numStations : 1);
+    memset(workspace, 0, sizeof(*workspace));
+    workspace->numStations = numStations;
+    for (int end = 0; end < 2; end++)
+    {
+        workspace->distances[end] = checkedRealloc(NULL, n * sizeof(int));
+        workspace->previous[end] = checkedRealloc(NULL, n * sizeof(int));
+    }
+    workspace->render = checkedRealloc(NULL, n * sizeof(int));
+    workspace->candidates = checkedRealloc(NULL, n * sizeof(uint64_t));
+    workspace->path = checkedRealloc(NULL, n * sizeof(int));
+    workspace->marks = calloc(n, sizeof(unsigned));
+    workspace->onRoute = calloc(n, sizeof(unsigned));
+    if (workspace->marks == NULL || workspace->onRoute == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int r = 0; r <= MAX_ALTERNATIVES; r++)
+    {
+        workspace->routes[r] = checkedRealloc(NULL, n * sizeof(int));
+        workspace->successor[r] = checkedRealloc(NULL, n * sizeof(int));
+        for (int i = 0; i < numStations; i++)
+        {
+            workspace->successor[r][i] = -1;
+        }
+    }
+    for (int i = 0; i < numStations; i++)
+    {
+        workspace->render[i] = -1;
+    }
+}
+
+void freeAlternativeWorkspace(AlternativeWorkspace *workspace)
+{
+    for (int end = 0; end < 2; end++)
+    {
+        free(workspace->distances[end]);
+        free(workspace->previous[end]);
+    }
+    free(workspace->render);
+    free(workspace->candidates);
+    free(workspace->path);
+    free(workspace->marks);
+    free(workspace->onRoute);
+    for (int r = 0; r <= MAX_ALTERNATIVES; r++)
+    {
+        free(workspace->routes[r]);
+        free(workspace->successor[r]);
+    }
+    memset(workspace, 0, sizeof(*workspace));
+}
+
+// Per-thread scratch of the dense engine, padded like the matrix rows:
+// open[] is a station's tentative distance until it is settled, INT_MAX after
+typedef struct
+{
+    int stride;
+    int *distances;
+    int *open;
+    int *previous;
+} DenseWorkspace;
+
+// 32-byte aligned allocation for the dense engine's vector loads; size must
+// be a multiple of 32
+void *checkedAlignedAlloc(size_t size)
+{
+    void *result = aligned_alloc(32, size);
+    if (result == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+void initializeDenseWorkspace(DenseWorkspace *workspace, int stride)
+{
+    workspace->stride = stride;
+    workspace->distances = checkedAlignedAlloc((size_t)stride * sizeof(int));
+    workspace->open = checkedAlignedAlloc((size_t)stride * sizeof(int));
+    workspace->previous = checkedAlignedAlloc((size_t)stride * sizeof(int));
+}
+
+void freeDenseWorkspace(DenseWorkspace *workspace)
+{
+    free(workspace->distances);
+    free(workspace->open);
+    free(workspace->previous);
+    memset(workspace, 0, sizeof(*workspace));
+}
+
+// Reusable per-search scratch state; settled[] is stamped per query so it never needs clearing.
+// touched[] lists the stations whose distance was written by the last search so
+// resetSearchArrays can restore distances/previous without an O(V) sweep.
+// settledNodes/relaxedArcs count the work of every search run on this
+// workspace, whichever engine ran it; its queues count their own operations.
+typedef struct
+{
+    PriorityQueue queue;
+    unsigned *settled;
+    unsigned stamp;
+    int numStations;
+    int *touched;
+    int numTouched;
+    ParetoWorkspace pareto;
+    BidirectionalWorkspace bidirectional;
+    CsaWorkspace timetable;
+    DenseWorkspace dense;
+    AlternativeWorkspace alternatives;
+    struct LineWorkspace *lines;
+    long settledNodes;
+    long relaxedArcs;
+} SearchWorkspace;
+
+// Scratch for searches over the line graph, created by the first one; its
+// arrays are indexed by line-graph node
+typedef struct LineWorkspace
+{
+    SearchWorkspace search;
+    int *distances;
+    int *previous;
+} LineWorkspace;
+
+QueueKind defaultQueueKind = QUEUE_QUAD_HEAP;
+
+typedef enum
+{
+    ENGINE_DIJKSTRA,
+    ENGINE_PARETO,
+    ENGINE_CH,
+    ENGINE_ALT,
+    ENGINE_DENSE
+} QueryEngine;
+
+QueryEngine defaultEngine = ENGINE_DIJKSTRA;
+
+const char *engineName(QueryEngine engine)
+{
+    switch (engine)
+    {
+    case ENGINE_DIJKSTRA:
+        return "dijkstra";
+    case ENGINE_PARETO:
+        return "pareto";
+    case ENGINE_CH:
+        return "ch";
+    case ENGINE_ALT:
+        return "alt";
+    case ENGINE_DENSE:
+        return "dense";
+    }
+    return "unknown";
+}
+
+int parseEngine(const char *name, QueryEngine *engine)
+{
+    for (int e = ENGINE_DIJKSTRA; e <= ENGINE_DENSE; e++)
+    {
+        if (strcmp(name, engineName((QueryEngine)e)) == 0)
+        {
+            *engine = (QueryEngine)e;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void initializeSearchWorkspace(SearchWorkspace *workspace, const MetroSystem *metro, QueueKind kind)
+{
+    queueInit(&workspace->queue, kind, metro);
+    workspace->numStations = metro->numStations;
+    workspace->settled = calloc((size_t)(metro->numStations > 0 ? metro->numStations : 1), sizeof(unsigned));
+    if (workspace->settled == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    workspace->stamp = 0;
+    workspace->touched = checkedRealloc(NULL, (size_t)(metro->numStations > 0 ? metro->numStations : 1) * sizeof(int));
+    workspace->numTouched = 0;
+
+    memset(&workspace->bidirectional, 0, sizeof(workspace->bidirectional));
+    memset(&workspace->timetable, 0, sizeof(workspace->timetable));
+    memset(&workspace->dense, 0, sizeof(workspace->dense));
+    memset(&workspace->alternatives, 0, sizeof(workspace->alternatives));
+    workspace->lines = NULL;
+    workspace->settledNodes = 0;
+    workspace->relaxedArcs = 0;
+
+    ParetoWorkspace *pareto = &workspace->pareto;
+    memset(pareto, 0, sizeof(*pareto));
+    pareto->bestPrice = checkedRealloc(NULL, (size_t)(metro->numStations > 0 ? metro->numStations : 1) * sizeof(int));
+    pareto->touched = checkedRealloc(NULL, (size_t)(metro->numStations > 0 ? metro->numStations : 1) * sizeof(int));
+    for (int i = 0; i < metro->numStations; i++)
+    {
+        pareto->bestPrice[i] = INT_MAX;
+    }
+}
+
+void freeSearchWorkspace(SearchWorkspace *workspace)
+{
+    queueFree(&workspace->queue);
+    free(workspace->settled);
+    free(workspace->touched);
+    free(workspace->pareto.labels);
+    free(workspace->pareto.heap);
+    free(workspace->pareto.bestPrice);
+    free(workspace->pareto.touched);
+    free(workspace->pareto.frontier);
+    if (workspace->bidirectional.numStations > 0)
+    {
+        freeBidirectionalWorkspace(&workspace->bidirectional);
+    }
+    if (workspace->timetable.numStations > 0)
+    {
+        freeCsaWorkspace(&workspace->timetable);
+    }
+    if (workspace->dense.stride > 0)
+    {
+        freeDenseWorkspace(&workspace->dense);
+    }
+    if (workspace->alternatives.numStations > 0)
+    {
+        freeAlternativeWorkspace(&workspace->alternatives);
+    }
+    if (workspace->lines != NULL)
+    {
+        freeSearchWorkspace(&workspace->lines->search);
+        free(workspace->lines->distances);
+        free(workspace->lines->previous);
+        free(workspace->lines);
+        workspace->lines = NULL;
+    }
+    workspace->settled = NULL;
+    workspace->touched = NULL;
+    memset(&workspace->pareto, 0, sizeof(workspace->pareto));
+}
+
+unsigned nextSearchStamp(SearchWorkspace *workspace)
+{
+    if (++workspace->stamp == 0)
+    {
+        memset(workspace->settled, 0, (size_t)workspace->numStations * sizeof(unsigned));
+        workspace->stamp = 1;
+    }
+    return workspace->stamp;
+}
+
+long long monotonicNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Total queue pushes and pops of every engine that ran on the workspace
+long workspaceQueueOperations(const SearchWorkspace *workspace)
+{
+    long operations = workspace->queue.operations + workspace->pareto.operations;
+    if (workspace->bidirectional.numStations > 0)
+    {
+        operations += workspace->bidirectional.queues[0].operations + workspace->bidirectional.queues[1].operations;
+    }
+    if (workspace->lines != NULL)
+    {
+        operations += workspace->lines->search.queue.operations;
+    }
+    return operations;
+}
+
+// Bits of the priority mask a query asks for
+#define QUERY_TIME 1
+#define QUERY_PRICE 2
+// Only answered from the line graph (--lines)
+#define QUERY_TRANSFERS 4
+
+// Time is split into build (loading the network and its preprocessing),
+// search, render and repair (applying disruptions). A query's search time is
+// whatever it spent outside rendering, so the phases never overlap.
+typedef enum
+{
+    PHASE_BUILD,
+    PHASE_SEARCH,
+    PHASE_RENDER,
+    PHASE_REPAIR,
+    NUM_PHASES
+} MetricsPhase;
+
+typedef enum
+{
+    COUNTER_QUERIES,
+    COUNTER_SETTLED_NODES,
+    COUNTER_RELAXED_ARCS,
+    COUNTER_QUEUE_OPERATIONS,
+    COUNTER_DISRUPTIONS,
+    NUM_COUNTERS
+} MetricsCounter;
+
+#if ROUTER_METRICS
+
+// Query latencies are kept per requested priority: time, price or both, and
+// with a line graph transfers or all three
+#define LATENCY_PRIORITIES 5
+#define LATENCY_BUCKETS 16
+
+const int latencyBoundsMicroseconds[LATENCY_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 50000, 100000};
+
+// One thread's counters and cycle totals. Only the owning thread writes them,
+// with relaxed loads and stores, so updates stay plain adds and the exporter
+// can read them at any time; latency[][] holds per-bucket counts.
+typedef struct ThreadMetrics
+{
+    int thread;
+    _Atomic uint64_t counters[NUM_COUNTERS];
+    _Atomic uint64_t phaseCycles[NUM_PHASES];
+    _Atomic uint64_t phaseCalls[NUM_PHASES];
+    _Atomic uint64_t latency[LATENCY_PRIORITIES][LATENCY_BUCKETS];
+    _Atomic uint64_t latencyCycles[LATENCY_PRIORITIES];
+    struct ThreadMetrics *next;
+} ThreadMetrics;
+
+// Collection is off unless --metrics is given; then every thread that runs a
+// phase registers its ThreadMetrics here and an exporter thread rewrites path
+// every interval seconds
+typedef struct
+{
+    int enabled;
+    pthread_mutex_t lock;
+    ThreadMetrics *threads;
+    int numThreads;
+    double cyclesPerSecond;
+    uint64_t latencyBounds[LATENCY_BUCKETS - 1];
+    long long startNanoseconds;
+    const char *path;
+    int json;
+    int interval;
+    int exporting;
+    int stopping;
+    pthread_cond_t wake;
+    pthread_t exporter;
+} Metrics;
+
+Metrics metrics = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+_Thread_local ThreadMetrics *currentThreadMetrics = NULL;
+
+const char *const phaseNames[NUM_PHASES] = {"build", "search", "render", "repair"};
+const char *const counterNames[NUM_COUNTERS] = {"queries", "settled_nodes", "relaxed_arcs", "queue_operations", "disruptions"};
+const char *const latencyPriorityNames[LATENCY_PRIORITIES] = {"time", "price", "both", "transfers", "all"};
+
+uint64_t readCycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t cycles;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cycles));
+    return cycles;
+#else
+    return (uint64_t)monotonicNanoseconds();
+#endif
+}
+
+ThreadMetrics *threadMetrics(void)
+{
+    if (currentThreadMetrics == NULL)
+    {
+        ThreadMetrics *thread = calloc(1, sizeof(ThreadMetrics));
+        if (thread == NULL)
+        {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_lock(&metrics.lock);
+        thread->thread = metrics.numThreads++;
+        ThreadMetrics **tail = &metrics.threads;
+        while (*tail != NULL)
+        {
+            tail = &(*tail)->next;
+        }
+        *tail = thread;
+        pthread_mutex_unlock(&metrics.lock);
+        currentThreadMetrics = thread;
+    }
+    return currentThreadMetrics;
+}
+
+void addMetric(_Atomic uint64_t *slot, uint64_t amount)
+{
+    atomic_store_explicit(slot, atomic_load_explicit(slot, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+uint64_t readMetric(_Atomic uint64_t *slot)
+{
+    return atomic_load_explicit(slot, memory_order_relaxed);
+}
+
+void countMetric(MetricsCounter counter, uint64_t amount)
+{
+    if (metrics.enabled)
+    {
+        addMetric(&threadMetrics()->counters[counter], amount);
+    }
+}
+
+uint64_t metricsPhaseStart(void)
+{
+    return metrics.enabled ? readCycles() : 0;
+}
+
+void metricsPhaseEnd(MetricsPhase phase, uint64_t start)
+{
+    if (metrics.enabled)
+    {
+        ThreadMetrics *thread = threadMetrics();
+        addMetric(&thread->phaseCycles[phase], readCycles() - start);
+        addMetric(&thread->phaseCalls[phase], 1);
+    }
+}
+
+// Snapshot taken when a query starts; endQueryMetrics charges the difference
+typedef struct
+{
+    uint64_t start;
+    uint64_t renderCycles;
+    long settledNodes;
+    long relaxedArcs;
+    long queueOperations;
+} QueryMetrics;
+
+void beginQueryMetrics(QueryMetrics *query, const SearchWorkspace *workspace)
+{
+    if (!metrics.enabled)
+    {
+        return;
+    }
+    query->renderCycles = readMetric(&threadMetrics()->phaseCycles[PHASE_RENDER]);
+    query->settledNodes = workspace->settledNodes;
+    query->relaxedArcs = workspace->relaxedArcs;
+    query->queueOperations = workspaceQueueOperations(workspace);
+    query->start = readCycles();
+}
+
+void endQueryMetrics(const QueryMetrics *query, const SearchWorkspace *workspace, int priorities)
+{
+    if (!metrics.enabled)
+    {
+        return;
+    }
+    uint64_t elapsed = readCycles() - query->start;
+    ThreadMetrics *thread = threadMetrics();
+    uint64_t rendering = readMetric(&thread->phaseCycles[PHASE_RENDER]) - query->renderCycles;
+    addMetric(&thread->phaseCycles[PHASE_SEARCH], elapsed > rendering ? elapsed - rendering : 0);
+    addMetric(&thread->phaseCalls[PHASE_SEARCH], 1);
+    addMetric(&thread->counters[COUNTER_QUERIES], 1);
+    addMetric(&thread->counters[COUNTER_SETTLED_NODES], (uint64_t)(workspace->settledNodes - query->settledNodes));
+    addMetric(&thread->counters[COUNTER_RELAXED_ARCS], (uint64_t)(workspace->relaxedArcs - query->relaxedArcs));
+    addMetric(&thread->counters[COUNTER_QUEUE_OPERATIONS], (uint64_t)(workspaceQueueOperations(workspace) - query->queueOperations));
+
+    int priority;
+    switch (priorities)
+    {
+    case QUERY_TIME:
+        priority = 0;
+        break;
+    case QUERY_PRICE:
+        priority = 1;
+        break;
+    case QUERY_TIME | QUERY_PRICE:
+        priority = 2;
+        break;
+    case QUERY_TRANSFERS:
+        priority = 3;
+        break;
+    default:
+        priority = 4;
+        break;
+    }
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && elapsed > metrics.latencyBounds[bucket])
+    {
+        bucket++;
+    }
+    addMetric(&thread->latency[priority][bucket], 1);
+    addMetric(&thread->latencyCycles[priority], elapsed);
+}
+
+void writeMetrics(FILE *out, int json)
+{
+    double seconds = 1.0 / metrics.cyclesPerSecond;
+    double uptime = (monotonicNanoseconds() - metrics.startNanoseconds) / 1e9;
+    uint64_t latency[LATENCY_PRIORITIES][LATENCY_BUCKETS] = {{0}};
+    uint64_t latencyCycles[LATENCY_PRIORITIES] = {0};
+
+    pthread_mutex_lock(&metrics.lock);
+    if (json)
+    {
+        fprintf(out, "{\n  \"uptime_seconds\": %.3f,\n  \"threads\": [", uptime);
+    }
+    else
+    {
+        fprintf(out, "# HELP router_uptime_seconds Seconds since metrics collection started.\n# TYPE router_uptime_seconds gauge\n");
+        fprintf(out, "router_uptime_seconds %.3f\n", uptime);
+    }
+    for (int c = 0; c < NUM_COUNTERS && !json; c++)
+    {
+        fprintf(out, "# TYPE router_%s_total counter\n", counterNames[c]);
+        for (ThreadMetrics *thread = metrics.threads; thread != NULL; thread = thread->next)
+        {
+            fprintf(out, "router_%s_total{thread=\"%d\"} %llu\n", counterNames[c], thread->thread, (unsigned long long)readMetric(&thread->counters[c]));
+        }
+    }
+    if (!json)
+    {
+        fprintf(out, "# HELP router_phase_seconds_total Time spent per phase, from the cycle counter.\n# TYPE router_phase_seconds_total counter\n");
+        for (ThreadMetrics *thread = metrics.threads; thread != NULL; thread = thread->next)
+        {
+            for (int p = 0; p < NUM_PHASES; p++)
+            {
+                fprintf(out, "router_phase_seconds_total{thread=\"%d\",phase=\"%s\"} %.6f\n", thread->thread, phaseNames[p],
+                        readMetric(&thread->phaseCycles[p]) * seconds);
+            }
+        }
+        fprintf(out, "# TYPE router_phase_calls_total counter\n");
+    }
+    for (ThreadMetrics *thread = metrics.threads; thread != NULL; thread = thread->next)
+    {
+        if (json)
+        {
+            fprintf(out, "%s\n    {\"thread\": %d", thread == metrics.threads ? "" : ",", thread->thread);
+            for (int c = 0; c < NUM_COUNTERS; c++)
+            {
+                fprintf(out, ", \"%s\": %llu", counterNames[c], (unsigned long long)readMetric(&thread->counters[c]));
+            }
+            fprintf(out, ", \"phases\": {");
+        }
+        for (int p = 0; p < NUM_PHASES; p++)
+        {
+            if (json)
+            {
+                fprintf(out, "%s\"%s\": {\"seconds\": %.6f, \"calls\": %llu}", p == 0 ? "" : ", ", phaseNames[p],
+                        readMetric(&thread->phaseCycles[p]) * seconds, (unsigned long long)readMetric(&thread->phaseCalls[p]));
+            }
+            else
+            {
+                fprintf(out, "router_phase_calls_total{thread=\"%d\",phase=\"%s\"} %llu\n", thread->thread, phaseNames[p],
+                        (unsigned long long)readMetric(&thread->phaseCalls[p]));
+            }
+        }
+        if (json)
+        {
+            fprintf(out, "}}");
+        }
+        for (int priority = 0; priority < LATENCY_PRIORITIES; priority++)
+        {
+            for (int b = 0; b < LATENCY_BUCKETS; b++)
+            {
+                latency[priority][b] += readMetric(&thread->latency[priority][b]);
+            }
+            latencyCycles[priority] += readMetric(&thread->latencyCycles[priority]);
+        }
+    }
+    pthread_mutex_unlock(&metrics.lock);
+
+    if (json)
+    {
+        fprintf(out, "\n  ],\n  \"latency\": {");
+    }
+    else
+    {
+        fprintf(out, "# HELP router_query_latency_seconds Query latency by requested priority.\n# TYPE router_query_latency_seconds histogram\n");
+    }
+    for (int priority = 0; priority < LATENCY_PRIORITIES; priority++)
+    {
+        const char *name = latencyPriorityNames[priority];
+        if (json)
+        {
+            fprintf(out, "%s\n    \"%s\": {\"buckets\": [", priority == 0 ? "" : ",", name);
+        }
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKETS; b++)
+        {
+            cumulative += latency[priority][b];
+            if (json && b < LATENCY_BUCKETS - 1)
+            {
+                fprintf(out, "%s{\"le\": %g, \"count\": %llu}", b == 0 ? "" : ", ", latencyBoundsMicroseconds[b] / 1e6, (unsigned long long)cumulative);
+            }
+            else if (!json && b < LATENCY_BUCKETS - 1)
+            {
+                fprintf(out, "router_query_latency_seconds_bucket{priority=\"%s\",le=\"%g\"} %llu\n", name, latencyBoundsMicroseconds[b] / 1e6,
+                        (unsigned long long)cumulative);
+            }
+            else if (!json)
+            {
+                fprintf(out, "router_query_latency_seconds_bucket{priority=\"%s\",le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+            }
+        }
+        if (json)
+        {
+            fprintf(out, "], \"count\": %llu, \"sum_seconds\": %.6f}", (unsigned long long)cumulative, latencyCycles[priority] * seconds);
+        }
+        else
+        {
+            fprintf(out, "router_query_latency_seconds_sum{priority=\"%s\"} %.6f\n", name, latencyCycles[priority] * seconds);
+            fprintf(out, "router_query_latency_seconds_count{priority=\"%s\"} %llu\n", name, (unsigned long long)cumulative);
+        }
+    }
+    if (json)
+    {
+        fprintf(out, "\n  }\n}\n");
+    }
+}
+
+// Writes a snapshot next to the metrics file and renames it over, so a
+// scraper never reads a partial file
+int dumpMetrics(void)
+{
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", metrics.path);
+    FILE *out = fopen(temporary, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Error: cannot write metrics file \"%s\".\n", temporary);
+        return 0;
+    }
+    writeMetrics(out, metrics.json);
+    if (fclose(out) != 0 || rename(temporary, metrics.path) != 0)
+    {
+        fprintf(stderr, "Error: cannot write metrics file \"%s\".\n", metrics.path);
+        return 0;
+    }
+    return 1;
+}
+
+void *metricsExporterMain(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&metrics.lock);
+    while (!metrics.stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += metrics.interval;
+        while (!metrics.stopping && pthread_cond_timedwait(&metrics.wake, &metrics.lock, &deadline) == 0)
+        {
+        }
+        if (!metrics.stopping)
+        {
+            pthread_mutex_unlock(&metrics.lock);
+            dumpMetrics();
+            pthread_mutex_lock(&metrics.lock);
+        }
+    }
+    pthread_mutex_unlock(&metrics.lock);
+    return NULL;
+}
+
+// Turns collection on and calibrates the cycle counter against the
+// monotonic clock; the format follows the extension (.json or Prometheus text)
+int enableMetrics(const char *path, int interval)
+{
+    size_t length = strlen(path);
+    metrics.path = path;
+    metrics.json = length >= 5 && strcmp(path + length - 5, ".json") == 0;
+    metrics.interval = interval;
+
+    long long begin = monotonicNanoseconds();
+    uint64_t cycles = readCycles();
+    long long elapsed;
+    while ((elapsed = monotonicNanoseconds() - begin) < 10000000LL)
+    {
+    }
+    metrics.cyclesPerSecond = (double)(readCycles() - cycles) * 1e9 / elapsed;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++)
+    {
+        metrics.latencyBounds[b] = (uint64_t)(latencyBoundsMicroseconds[b] * metrics.cyclesPerSecond / 1e6);
+    }
+    metrics.startNanoseconds = begin;
+    metrics.enabled = 1;
+    return 1;
+}
+
+void startMetricsExporter(void)
+{
+    if (metrics.enabled && !metrics.exporting)
+    {
+        metrics.exporting = pthread_create(&metrics.exporter, NULL, metricsExporterMain, NULL) == 0;
+    }
+}
+
+// Stops the exporter, writes the final snapshot and frees every thread's metrics
+int stopMetrics(void)
+{
+    if (!metrics.enabled)
+    {
+        return 1;
+    }
+    if (metrics.exporting)
+    {
+        pthread_mutex_lock(&metrics.lock);
+        metrics.stopping = 1;
+        pthread_cond_signal(&metrics.wake);
+        pthread_mutex_unlock(&metrics.lock);
+        pthread_join(metrics.exporter, NULL);
+        metrics.exporting = 0;
+    }
+    int written = dumpMetrics();
+    metrics.enabled = 0;
+    while (metrics.threads != NULL)
+    {
+        ThreadMetrics *next = metrics.threads->next;
+        free(metrics.threads);
+        metrics.threads = next;
+    }
+    return written;
+}
+
+#else
+
+// Built with ROUTER_METRICS=0: every hook is empty and --metrics is refused
+typedef struct
+{
+    char unused;
+} QueryMetrics;
+
+void countMetric(MetricsCounter counter, uint64_t amount)
+{
+    (void)counter;
+    (void)amount;
+}
+
+uint64_t metricsPhaseStart(void)
+{
+    return 0;
+}
+
+void metricsPhaseEnd(MetricsPhase phase, uint64_t start)
+{
+    (void)phase;
+    (void)start;
+}
+
+void beginQueryMetrics(QueryMetrics *query, const SearchWorkspace *workspace)
+{
+    (void)query;
+    (void)workspace;
+}
+
+void endQueryMetrics(const QueryMetrics *query, const SearchWorkspace *workspace, int priorities)
+{
+    (void)query;
+    (void)workspace;
+    (void)priorities;
+}
+
+int enableMetrics(const char *path, int interval)
+{
+    (void)path;
+    (void)interval;
+    fprintf(stderr, "Error: built without metrics (ROUTER_METRICS=0).\n");
+    return 0;
+}
+
+void startMetricsExporter(void)
+{
+}
+
+int stopMetrics(void)
+{
+    return 1;
+}
+
+#endif
+
+// Shortest paths under weights from every station in [sourceFirst,
+// sourceLast), all at distance 0. The caller initialises distances to INT_MAX
+// and previous to -1. The search stops as soon as a station in [targetFirst,
+// targetLast) is settled and returns it, so only that station's distance and
+// previous chain are final; with an empty target range it settles everything
+// and returns -1. Stations farther than budget are never reached: the search
+// is pruned there.
+int dijkstraSearchRanges(const MetroSystem *metro, SearchWorkspace *workspace, const int *weights, int sourceFirst, int sourceLast, int targetFirst,
+                         int targetLast, int budget, int *distances, int *previous)
+{
+    PriorityQueue *queue = &workspace->queue;
+    unsigned stamp = nextSearchStamp(workspace);
+    unsigned *settled = workspace->settled;
+
+    queueClear(queue);
+    workspace->numTouched = 0;
+    for (int start = sourceFirst; start < sourceLast; start++)
+    {
+        if (distances[start] == INT_MAX)
+        {
+            workspace->touched[workspace->numTouched++] = start;
+        }
+        distances[start] = 0;
+        queuePush(queue, start, 0);
+    }
+
+    int node, key;
+    while (queuePop(queue, &node, &key))
+    {
+        if (settled[node] == stamp)
+        {
+            continue;
+        }
+        settled[node] = stamp;
+        workspace->settledNodes++;
+
+        if (node >= targetFirst && node < targetLast)
+        {
+            return node;
+        }
+
+        workspace->relaxedArcs += metro->offsets[node + 1] - metro->offsets[node];
+        for (int a = metro->offsets[node]; a < metro->offsets[node + 1]; a++)
+        {
+            if (weights[a] == ARC_CLOSED)
+            {
+                continue;
+            }
+            int i = metro->neighbors[a];
+            int distance = key + weights[a];
+
+            if (settled[i] != stamp && distance < distances[i] && distance <= budget)
+            {
+                if (distances[i] == INT_MAX)
+                {
+                    workspace->touched[workspace->numTouched++] = i;
+                }
+                distances[i] = distance;
+                previous[i] = node;
+                queuePush(queue, i, distance);
+            }
+        }
+    }
+    return -1;
+}
+
+// Shortest paths from start under the given priority (0 = time, 1 = price).
+// When target is a valid station the search stops as soon as it is settled;
+// pass -1 to settle everything. See dijkstraSearchRanges.
+void dijkstraSearchWithin(const MetroSystem *metro, SearchWorkspace *workspace, int start, int target, int budget, int *distances, int *previous,
+                          int priority)
+{
+    dijkstraSearchRanges(metro, workspace, arcWeights(metro, priority), start, start + 1, target, target == -1 ? -1 : target + 1, budget, distances,
+                         previous);
+}
+
+void dijkstraSearch(const MetroSystem *metro, SearchWorkspace *workspace, int start, int target, int *distances, int *previous, int priority)
+{
+    dijkstraSearchWithin(metro, workspace, start, target, INT_MAX, distances, previous, priority);
+}
+
+// Restores distances/previous to INT_MAX/-1 after a search that started from fully reset arrays
+void resetSearchArrays(SearchWorkspace *workspace, int *distances, int *previous)
+{
+    for (int t = 0; t < workspace->numTouched; t++)
+    {
+        distances[workspace->touched[t]] = INT_MAX;
+        previous[workspace->touched[t]] = -1;
+    }
+    workspace->numTouched = 0;
+}
+
+int paretoLess(const ParetoWorkspace *pareto, int a, int b)
+{
+    const ParetoLabel *x = &pareto->labels[a];
+    const ParetoLabel *y = &pareto->labels[b];
+    if (x->time != y->time)
+        return x->time < y->time;
+    if (x->price != y->price)
+        return x->price < y->price;
+    return a < b;
+}
+
+void paretoPush(ParetoWorkspace *pareto, int time, int price, int station, int parent)
+{
+    if (pareto->numLabels == pareto->labelCapacity)
+    {
+        pareto->labelCapacity = pareto->labelCapacity ? pareto->labelCapacity * 2 : 1024;
+        pareto->labels = checkedRealloc(pareto->labels, (size_t)pareto->labelCapacity * sizeof(ParetoLabel));
+    }
+    if (pareto->heapSize == pareto->heapCapacity)
+    {
+        pareto->heapCapacity = pareto->heapCapacity ? pareto->heapCapacity * 2 : 1024;
+        pareto->heap = checkedRealloc(pareto->heap, (size_t)pareto->heapCapacity * sizeof(int));
+    }
+
+    pareto->operations++;
+    int label = pareto->numLabels++;
+    pareto->labels[label].time = time;
+    pareto->labels[label].price = price;
+    pareto->labels[label].station = station;
+    pareto->labels[label].parent = parent;
+
+    int index = pareto->heapSize++;
+    while (index > 0 && paretoLess(pareto, label, pareto->heap[(index - 1) / 2]))
+    {
+        pareto->heap[index] = pareto->heap[(index - 1) / 2];
+        index = (index - 1) / 2;
+    }
+    pareto->heap[index] = label;
+}
+
+int paretoPop(ParetoWorkspace *pareto)
+{
+    int top = pareto->heap[0];
+    int last = pareto->heap[--pareto->heapSize];
+    pareto->operations++;
+    int index = 0;
+
+    for (;;)
+    {
+        int child = index * 2 + 1;
+        if (child >= pareto->heapSize)
+            break;
+        if (child + 1 < pareto->heapSize && paretoLess(pareto, pareto->heap[child + 1], pareto->heap[child]))
+            child++;
+        if (!paretoLess(pareto, pareto->heap[child], last))
+            break;
+        pareto->heap[index] = pareto->heap[child];
+        index = child;
+    }
+    if (pareto->heapSize > 0)
+        pareto->heap[index] = last;
+    return top;
+}
+
+// Computes every Pareto-optimal (minutes, rupees) journey from start to target
+// in one label-setting traversal. Labels leave the queue in (time, price)
+// order, so a label is dominated exactly when some label already settled at
+// its station is no more expensive; it is also dropped when the target
+// already has a label that dominates it. Returns the frontier size; the
+// labels are in workspace->pareto.frontier by increasing time and decreasing
+// price, so the first is the time-priority answer and the last the
+// price-priority one.
+int paretoSearch(const MetroSystem *metro, SearchWorkspace *workspace, int start, int target)
+{
+    ParetoWorkspace *pareto = &workspace->pareto;
+    int *bestPrice = pareto->bestPrice;
+
+    for (int t = 0; t < pareto->numTouched; t++)
+    {
+        bestPrice[pareto->touched[t]] = INT_MAX;
+    }
+    pareto->numTouched = 0;
+    pareto->numLabels = 0;
+    pareto->heapSize = 0;
+    pareto->numFrontier = 0;
+
+    paretoPush(pareto, 0, 0, start, -1);
+
+    while (pareto->heapSize > 0)
+    {
+        int label = paretoPop(pareto);
+        ParetoLabel current = pareto->labels[label];
+        if (current.price >= bestPrice[current.station])
+        {
+            continue;
+        }
+
+        if (bestPrice[current.station] == INT_MAX)
+        {
+            pareto->touched[pareto->numTouched++] = current.station;
+        }
+        bestPrice[current.station] = current.price;
+        workspace->settledNodes++;
+
+        if (current.station == target)
+        {
+            if (pareto->numFrontier == pareto->frontierCapacity)
+            {
+                pareto->frontierCapacity = pareto->frontierCapacity ? pareto->frontierCapacity * 2 : 16;
+                pareto->frontier = checkedRealloc(pareto->frontier, (size_t)pareto->frontierCapacity * sizeof(int));
+            }
+            pareto->frontier[pareto->numFrontier++] = label;
+            continue;
+        }
+
+        workspace->relaxedArcs += metro->offsets[current.station + 1] - metro->offsets[current.station];
+        for (int a = metro->offsets[current.station]; a < metro->offsets[current.station + 1]; a++)
+        {
+            if (metro->prices[a] == ARC_CLOSED)
+            {
+                continue;
+            }
+            int next = metro->neighbors[a];
+            int price = current.price + metro->prices[a];
+
+            if (price < bestPrice[next] && price < bestPrice[target])
+            {
+                paretoPush(pareto, current.time + metro->times[a], price, next, label);
+            }
+        }
+    }
+    return pareto->numFrontier;
+}
+
+// Writes the path of a frontier label into previous[] (which must be reset);
+// clearParetoPath undoes it
+void setParetoPath(const SearchWorkspace *workspace, int label, int *previous)
+{
+    const ParetoLabel *labels = workspace->pareto.labels;
+    for (; labels[label].parent != -1; label = labels[label].parent)
+    {
+        previous[labels[label].station] = labels[labels[label].parent].station;
+    }
+}
+
+void clearParetoPath(const SearchWorkspace *workspace, int label, int *previous)
+{
+    const ParetoLabel *labels = workspace->pareto.labels;
+    for (; label != -1; label = labels[label].parent)
+    {
+        previous[labels[label].station] = -1;
+    }
+}
+
+void dijkstra(MetroSystem *metro, int start, int *distances, int *previous, int priority)
+{
+    SearchWorkspace workspace;
+    initializeSearchWorkspace(&workspace, metro, defaultQueueKind);
+    dijkstraSearch(metro, &workspace, start, -1, distances, previous, priority);
+    freeSearchWorkspace(&workspace);
+}
+
+typedef enum
+{
+    ROUTE_TEXT,
+    ROUTE_JSON,
+    ROUTE_BINARY
+} RouteFormat;
+
+RouteFormat defaultRouteFormat = ROUTE_TEXT;
+
+const char *routeFormatName(RouteFormat format)
+{
+    switch (format)
+    {
+    case ROUTE_TEXT:
+        return "text";
+    case ROUTE_JSON:
+        return "json";
+    case ROUTE_BINARY:
+        return "binary";
+    }
+    return "unknown";
+}
+
+int parseRouteFormat(const char *name, RouteFormat *format)
+{
+    for (int f = ROUTE_TEXT; f <= ROUTE_BINARY; f++)
+    {
+        if (strcmp(name, routeFormatName((RouteFormat)f)) == 0)
+        {
+            *format = (RouteFormat)f;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Record priorities: 0 time and 1 price as everywhere else, 2 for journeys
+// read from the timetable and 3 for fewest-transfers routes
+#define ROUTE_PRIORITY_TIMETABLE 2
+#define ROUTE_PRIORITY_TRANSFERS 3
+
+typedef enum
+{
+    ROUTE_OK,
+    ROUTE_UNREACHABLE,
+    ROUTE_INVALID,
+    ROUTE_MALFORMED,
+    // Ends a server response in the binary format, where records carry no text
+    ROUTE_END
+} RouteStatus;
+
+// Binary route record as laid out on this host: the header is followed by
+// numStations uint32 station ids in travel order. Totals are -1 when the
+// answer does not know them; departure and arrival (seconds after midnight)
+// are only set for timetable journeys, transfers only for line-graph routes.
+typedef struct
+{
+    uint8_t status;
+    uint8_t priority;
+    uint16_t transfers;
+    int32_t from;
+    int32_t to;
+    int32_t totalTime;
+    int32_t totalPrice;
+    int32_t departure;
+    int32_t arrival;
+    uint32_t numStations;
+} RouteRecord;
+
+// Caller-owned output arena for rendered answers. Renderers append to data in
+// one pass and the buffer only grows, so once it is warm a query renders
+// without touching the heap; callers reset size between uses. stations is
+// scratch for walking a path before it is written front to back.
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    int *stations;
+    int stationCapacity;
+} RouteBuffer;
+
+void initializeRouteBuffer(RouteBuffer *out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
+void freeRouteBuffer(RouteBuffer *out)
+{
+    free(out->data);
+    free(out->stations);
+    initializeRouteBuffer(out);
+}
+
+// Returns the write position after making room for extra more bytes
+char *reserveRoute(RouteBuffer *out, size_t extra)
+{
+    if (out->size + extra > out->capacity)
+    {
+        size_t capacity = out->capacity ? out->capacity : 256;
+        while (capacity < out->size + extra)
+        {
+            capacity *= 2;
+        }
+        out->data = checkedRealloc(out->data, capacity);
+        out->capacity = capacity;
+    }
+    return out->data + out->size;
+}
+
+int *reserveRouteStations(RouteBuffer *out, int count)
+{
+    if (count > out->stationCapacity)
+    {
+        int capacity = out->stationCapacity ? out->stationCapacity : 64;
+        while (capacity < count)
+        {
+            capacity *= 2;
+        }
+        out->stations = checkedRealloc(out->stations, (size_t)capacity * sizeof(int));
+        out->stationCapacity = capacity;
+    }
+    return out->stations;
+}
+
+void appendBytes(RouteBuffer *out, const void *data, size_t size)
+{
+    memcpy(reserveRoute(out, size), data, size);
+    out->size += size;
+}
+
+void appendString(RouteBuffer *out, const char *text)
+{
+    appendBytes(out, text, strlen(text));
+}
+
+void appendInt(RouteBuffer *out, long value)
+{
+    char digits[24];
+    int length = 0;
+    unsigned long magnitude = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+    do
+    {
+        digits[sizeof(digits) - 1 - length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+    {
+        digits[sizeof(digits) - 1 - length++] = '-';
+    }
+    appendBytes(out, digits + sizeof(digits) - length, (size_t)length);
+}
+
+// printf straight into the arena, for the less travelled answers
+void appendFormat(RouteBuffer *out, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t room = out->capacity - out->size;
+    int length = vsnprintf(room ? out->data + out->size : NULL, room, format, args);
+    va_end(args);
+    if ((size_t)length >= room)
+    {
+        va_start(args, format);
+        vsnprintf(reserveRoute(out, (size_t)length + 1), (size_t)length + 1, format, args);
+        va_end(args);
+    }
+    out->size += (size_t)length;
+}
+
+void appendJsonString(RouteBuffer *out, const char *text)
+{
+    appendBytes(out, "\"", 1);
+    for (const char *run = text;; text++)
+    {
+        unsigned char c = (unsigned char)*text;
+        if (c != '\0' && c != '"' && c != '\\' && c >= 0x20)
+        {
+            continue;
+        }
+        appendBytes(out, run, (size_t)(text - run));
+        if (c == '\0')
+        {
+            break;
+        }
+        if (c == '"' || c == '\\')
+        {
+            char escaped[2] = {'\\', (char)c};
+            appendBytes(out, escaped, 2);
+        }
+        else
+        {
+            appendFormat(out, "\\u%04x", c);
+        }
+        run = text + 1;
+    }
+    appendBytes(out, "\"", 1);
+}
+
+void appendRouteRecord(RouteBuffer *out, RouteStatus status, int priority, int from, int to, int totalTime, int totalPrice,
+                       int departure, int arrival, int numStations)
+{
+    RouteRecord record = {(uint8_t)status, (uint8_t)priority, 0, from, to, totalTime, totalPrice, departure, arrival, (uint32_t)numStations};
+    appendBytes(out, &record, sizeof(record));
+}
+
+// Separates the time and price answers of one query in the text format
+void separateRoutes(RouteBuffer *out)
+{
+    if (defaultRouteFormat == ROUTE_TEXT)
+    {
+        appendBytes(out, "\n", 1);
+    }
+}
+
+// Opens a JSON answer object up to its status
+void appendJsonHeader(RouteBuffer *out, RouteStatus status, int priority, int from, int to)
+{
+    static const char *const priorityNames[] = {"time", "price", "timetable", "transfers"};
+    static const char *const statusNames[] = {"ok", "unreachable", "invalid", "malformed"};
+    appendString(out, "{\"from\":");
+    appendInt(out, from);
+    appendString(out, ",\"to\":");
+    appendInt(out, to);
+    appendString(out, ",\"priority\":\"");
+    appendString(out, priorityNames[priority]);
+    appendString(out, "\",\"status\":\"");
+    appendString(out, statusNames[status]);
+    appendString(out, "\"");
+}
+
+// An answer without a route: no path, bad station ids or an unparseable request
+void renderRouteStatus(RouteBuffer *out, RouteStatus status, int from, int to, int priority)
+{
+    static const char *const messages[] = {"", "No route available.\n", "Invalid station id.\n", "Error: expected FROM TO [time|price|transfers|both]\n"};
+    switch (defaultRouteFormat)
+    {
+    case ROUTE_TEXT:
+        appendString(out, messages[status]);
+        break;
+    case ROUTE_JSON:
+        appendJsonHeader(out, status, priority, from, to);
+        appendString(out, "}\n");
+        break;
+    case ROUTE_BINARY:
+        appendRouteRecord(out, status, priority, from, to, -1, -1, -1, -1, 0);
+        break;
+    }
+}
+
+// Renders the route previous[] describes from start to end. One walk back
+// from end collects the stations and both totals; the answer is then written
+// front to back in defaultRouteFormat.
+void renderRoute(RouteBuffer *out, const MetroSystem *metro, const int *previous, int start, int end, int priority)
+{
+    uint64_t phaseStart = metricsPhaseStart();
+    if (previous[end] == -1)
+    {
+        renderRouteStatus(out, ROUTE_UNREACHABLE, start, end, priority);
+        metricsPhaseEnd(PHASE_RENDER, phaseStart);
+        return;
+    }
+
+    int count = 0;
+    int totalTime = 0;
+    int totalPrice = 0;
+    for (int current = end; current != -1; current = previous[current])
+    {
+        int *stations = reserveRouteStations(out, count + 1);
+        stations[count++] = current;
+        if (previous[current] != -1)
+        {
+            int arc = findArc(metro, current, previous[current]);
+            totalTime += metro->times[arc];
+            totalPrice += metro->prices[arc];
+        }
+    }
+    const int *stations = out->stations;
+
+    switch (defaultRouteFormat)
+    {
+    case ROUTE_TEXT:
+        appendString(out, "Route: ");
+        appendString(out, stationName(metro, start));
+        for (int i = count - 2; i >= 0; i--)
+        {
+            if (strstr(stationName(metro, stations[i]), "-junction") != NULL)
+            {
+                appendString(out, " -> ");
+                appendString(out, stationName(metro, stations[i]));
+            }
+        }
+        appendString(out, " -> ");
+        appendString(out, stationName(metro, end));
+        appendString(out, priority == 0 ? "\nTotal Time: " : "\nTotal Price: ");
+        appendInt(out, priority == 0 ? totalTime : totalPrice);
+        appendString(out, priority == 0 ? " minutes\n" : " rupees\n");
+        break;
+    case ROUTE_JSON:
+        appendJsonHeader(out, ROUTE_OK, priority, start, end);
+        appendString(out, ",\"total_time\":");
+        appendInt(out, totalTime);
+        appendString(out, ",\"total_price\":");
+        appendInt(out, totalPrice);
+        appendString(out, ",\"stations\":[");
+        for (int i = count - 1; i >= 0; i--)
+        {
+            appendString(out, i == count - 1 ? "{\"id\":" : ",{\"id\":");
+            appendInt(out, stations[i]);
+            appendString(out, ",\"name\":");
+            appendJsonString(out, stationName(metro, stations[i]));
+            appendString(out, "}");
+        }
+        appendString(out, "]}\n");
+        break;
+    case ROUTE_BINARY:
+    {
+        appendRouteRecord(out, ROUTE_OK, priority, start, end, totalTime, totalPrice, -1, -1, count);
+        char *ids = reserveRoute(out, (size_t)count * sizeof(uint32_t));
+        for (int i = 0; i < count; i++)
+        {
+            uint32_t id = (uint32_t)stations[count - 1 - i];
+            memcpy(ids + (size_t)i * sizeof(id), &id, sizeof(id));
+        }
+        out->size += (size_t)count * sizeof(uint32_t);
+        break;
+    }
+    }
+    metricsPhaseEnd(PHASE_RENDER, phaseStart);
+}
+
+// FNV-1a, used to fingerprint networks and on-disk snapshots
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define HASH_SEED 14695981039346656037ULL
+
+// Identifies the finalized network: station names, colours and every arc weight
+uint64_t networkChecksum(const MetroSystem *metro)
+{
+    uint64_t hash = hashBytes(HASH_SEED, &metro->numStations, sizeof(int));
+    for (int i = 0; i < metro->numStations; i++)
+    {
+        hash = hashBytes(hash, stationName(metro, i), strlen(stationName(metro, i)) + 1);
+        hash = hashBytes(hash, stationColor(metro, i), strlen(stationColor(metro, i)) + 1);
+    }
+    hash = hashBytes(hash, metro->offsets, (size_t)(metro->numStations + 1) * sizeof(int));
+    hash = hashBytes(hash, metro->neighbors, (size_t)metro->numArcs * sizeof(int));
+    hash = hashBytes(hash, metro->times, (size_t)metro->numArcs * sizeof(int));
+    hash = hashBytes(hash, metro->prices, (size_t)metro->numArcs * sizeof(int));
+    return hash;
+}
+
+#define ROUTE_TABLE_MAGIC "BLRTABLE"
+#define ROUTE_TABLE_VERSION 1
+
+// Set by --verify: loading a snapshot also checksums its whole payload, an
+// O(size) pass; otherwise only the header and the network are checked
+int verifySnapshots = 0;
+
+// On-disk layout: this header followed by, for priority 0 then 1, an n*n
+// distance matrix and an n*n predecessor matrix (int32, row = origin).
+// Row s of a predecessor matrix is the previous[] array of a full search from s.
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numStations;
+    uint64_t networkChecksum;
+    uint64_t payloadChecksum;
+} RouteTableHeader;
+
+typedef struct
+{
+    void *mapping;
+    size_t mappingSize;
+    int numStations;
+    // Read-only mapping until a disruption makes it writable for repairs
+    int *distances[2];
+    int *previous[2];
+} RouteTable;
+
+typedef struct
+{
+    MetroSystem *metro;
+    int *tables[4];
+    atomic_int nextSource;
+} PrecomputeJob;
+
+void *precomputeWorkerMain(void *arg)
+{
+    PrecomputeJob *job = arg;
+    int n = job->metro->numStations;
+    SearchWorkspace workspace;
+    initializeSearchWorkspace(&workspace, job->metro, defaultQueueKind);
+
+    for (;;)
+    {
+        int source = atomic_fetch_add(&job->nextSource, 1);
+        if (source >= n)
+        {
+            break;
+        }
+        for (int priority = 0; priority < 2; priority++)
+        {
+            int *distances = job->tables[priority * 2] + (size_t)source * n;
+            int *previous = job->tables[priority * 2 + 1] + (size_t)source * n;
+            for (int i = 0; i < n; i++)
+            {
+                distances[i] = INT_MAX;
+                previous[i] = -1;
+            }
+            dijkstraSearch(job->metro, &workspace, source, -1, distances, previous, priority);
+        }
+    }
+
+    freeSearchWorkspace(&workspace);
+    return NULL;
+}
+
+// Runs a full search from every station for both priorities, in parallel over
+// sources, and writes the resulting tables next to path before renaming them
+// over it, so a failed run never leaves a truncated table behind
+int precomputeRouteTable(MetroSystem *metro, const char *path, int numThreads)
+{
+    size_t cells = (size_t)metro->numStations * metro->numStations;
+    PrecomputeJob job;
+    job.metro = metro;
+    atomic_init(&job.nextSource, 0);
+    for (int t = 0; t < 4; t++)
+    {
+        job.tables[t] = checkedRealloc(NULL, (cells > 0 ? cells : 1) * sizeof(int));
+    }
+
+    pthread_t *threads = checkedRealloc(NULL, (size_t)numThreads * sizeof(pthread_t));
+    for (int t = 0; t < numThreads; t++)
+    {
+        pthread_create(&threads[t], NULL, precomputeWorkerMain, &job);
+    }
+    for (int t = 0; t < numThreads; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+
+    RouteTableHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ROUTE_TABLE_MAGIC, sizeof(header.magic));
+    header.version = ROUTE_TABLE_VERSION;
+    header.numStations = (uint32_t)metro->numStations;
+    header.networkChecksum = networkChecksum(metro);
+    header.payloadChecksum = HASH_SEED;
+    for (int t = 0; t < 4; t++)
+    {
+        header.payloadChecksum = hashBytes(header.payloadChecksum, job.tables[t], cells * sizeof(int));
+    }
+
+    int status = 0;
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        perror("Error opening file");
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (int t = 0; t < 4 && ok; t++)
+        {
+            ok = fwrite(job.tables[t], sizeof(int), cells, file) == cells;
+        }
+        if (fclose(file) != 0 || !ok || rename(temporary, path) != 0)
+        {
+            fprintf(stderr, "Error writing route table %s.\n", path);
+            unlink(temporary);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    for (int t = 0; t < 4; t++)
+    {
+        free(job.tables[t]);
+    }
+    return status;
+}
+
+// Maps a snapshot written by precomputeRouteTable. Returns 0 and leaves the
+// table unmapped if the file is unreadable, truncated, from another format
+// version or was built for a different network than metro, and with
+// verifySnapshots also if its payload is corrupt.
+int loadRouteTable(RouteTable *table, const MetroSystem *metro, const char *path)
+{
+    memset(table, 0, sizeof(*table));
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Error opening route table");
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(RouteTableHeader))
+    {
+        fprintf(stderr, "Error: route table %s is truncated.\n", path);
+        close(fd);
+        return 0;
+    }
+
+    void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Error mapping route table");
+        return 0;
+    }
+
+    const RouteTableHeader *header = mapping;
+    size_t cells = (size_t)metro->numStations * metro->numStations;
+    const char *problem = NULL;
+
+    if (memcmp(header->magic, ROUTE_TABLE_MAGIC, sizeof(header->magic)) != 0)
+        problem = "is not a route table";
+    else if (header->version != ROUTE_TABLE_VERSION)
+        problem = "has an unsupported version";
+    else if (header->numStations != (uint32_t)metro->numStations || header->networkChecksum != networkChecksum(metro))
+        problem = "was built for a different network";
+    else if ((size_t)info.st_size != sizeof(RouteTableHeader) + 4 * cells * sizeof(int))
+        problem = "is truncated";
+    else if (verifySnapshots && hashBytes(HASH_SEED, header + 1, 4 * cells * sizeof(int)) != header->payloadChecksum)
+        problem = "is corrupt";
+
+    if (problem != NULL)
+    {
+        fprintf(stderr, "Error: route table %s %s; rerun --precompute.\n", path, problem);
+        munmap(mapping, (size_t)info.st_size);
+        return 0;
+    }
+
+    int *data = (int *)(header + 1);
+    table->mapping = mapping;
+    table->mappingSize = (size_t)info.st_size;
+    table->numStations = metro->numStations;
+    for (int priority = 0; priority < 2; priority++)
+    {
+        table->distances[priority] = data + (size_t)(priority * 2) * cells;
+        table->previous[priority] = data + (size_t)(priority * 2 + 1) * cells;
+    }
+    return 1;
+}
+
+void unloadRouteTable(RouteTable *table)
+{
+    if (table->mapping != NULL)
+    {
+        munmap(table->mapping, table->mappingSize);
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+// An arc of a contraction hierarchy. Shortcuts record the station they bypass
+// in middle; original connections have middle == -1.
+typedef struct
+{
+    int to;
+    int weight;
+    int middle;
+} ChArc;
+
+// Upward graph of a contraction hierarchy for one priority: station v keeps
+// the arcs to neighbours contracted after it, arcs[offsets[v]] .. arcs[offsets[v + 1] - 1].
+// The network is undirected, so forward and backward searches both use it.
+typedef struct
+{
+    int numStations;
+    int priority;
+    int *rank;
+    int *offsets;
+    ChArc *arcs;
+    int numShortcuts;
+} ContractionHierarchy;
+
+typedef struct
+{
+    ChArc *arcs;
+    int count;
+    int capacity;
+} ChAdjacency;
+
+#define CH_WITNESS_SETTLE_LIMIT 64
+
+// Working state of the contraction: the remaining graph plus a scratch
+// search for witness paths
+typedef struct
+{
+    int numStations;
+    ChAdjacency *adjacency;
+    char *contracted;
+    int *contractedNeighbors;
+    PriorityQueue witnessQueue;
+    int *witnessDistances;
+    int *witnessTouched;
+    int numWitnessTouched;
+} ChBuilder;
+
+// Adds the undirected arc a-b, or lowers its weight if a shorter one is found
+void chAddOrImprove(ChBuilder *builder, int a, int b, int weight, int middle)
+{
+    for (int side = 0; side < 2; side++)
+    {
+        int from = side ? b : a;
+        int to = side ? a : b;
+        ChAdjacency *list = &builder->adjacency[from];
+        int found = 0;
+
+        for (int i = 0; i < list->count; i++)
+        {
+            if (list->arcs[i].to == to)
+            {
+                if (weight < list->arcs[i].weight)
+                {
+                    list->arcs[i].weight = weight;
+                    list->arcs[i].middle = middle;
+                }
+                found = 1;
+                break;
+            }
+        }
+        if (!found)
+        {
+            if (list->count == list->capacity)
+            {
+                list->capacity = list->capacity ? list->capacity * 2 : 4;
+                list->arcs = checkedRealloc(list->arcs, (size_t)list->capacity * sizeof(ChArc));
+            }
+            list->arcs[list->count].to = to;
+            list->arcs[list->count].weight = weight;
+            list->arcs[list->count].middle = middle;
+            list->count++;
+        }
+    }
+}
+
+// Drops arcs to contracted stations so only the remaining graph is scanned
+void chCompact(ChBuilder *builder, int station)
+{
+    ChAdjacency *list = &builder->adjacency[station];
+    int write = 0;
+    for (int i = 0; i < list->count; i++)
+    {
+        if (!builder->contracted[list->arcs[i].to])
+        {
+            list->arcs[write++] = list->arcs[i];
+        }
+    }
+    list->count = write;
+}
+
+// Bounded Dijkstra from source in the remaining graph without via; fills
+// witnessDistances for everything it reaches within limit
+void chWitnessSearch(ChBuilder *builder, int source, int via, int limit)
+{
+    PriorityQueue *queue = &builder->witnessQueue;
+    int *distances = builder->witnessDistances;
+
+    for (int t = 0; t < builder->numWitnessTouched; t++)
+    {
+        distances[builder->witnessTouched[t]] = INT_MAX;
+    }
+    builder->numWitnessTouched = 0;
+    queueClear(queue);
+
+    distances[source] = 0;
+    builder->witnessTouched[builder->numWitnessTouched++] = source;
+    queuePush(queue, source, 0);
+
+    int settledCount = 0, node, key;
+    while (settledCount++ < CH_WITNESS_SETTLE_LIMIT && queuePop(queue, &node, &key))
+    {
+        if (key > limit)
+        {
+            break;
+        }
+        chCompact(builder, node);
+        const ChAdjacency *list = &builder->adjacency[node];
+        for (int i = 0; i < list->count; i++)
+        {
+            int next = list->arcs[i].to;
+            int distance = key + list->arcs[i].weight;
+            if (next == via || builder->contracted[next] || distance >= distances[next])
+            {
+                continue;
+            }
+            if (distances[next] == INT_MAX)
+            {
+                builder->witnessTouched[builder->numWitnessTouched++] = next;
+            }
+            distances[next] = distance;
+            queuePush(queue, next, distance);
+        }
+    }
+}
+
+// Counts (or, when apply is set, adds) the shortcuts needed to contract station
+int chContract(ChBuilder *builder, int station, int apply)
+{
+    chCompact(builder, station);
+    ChAdjacency *list = &builder->adjacency[station];
+    int shortcuts = 0;
+
+    for (int i = 0; i < list->count; i++)
+    {
+        int u = list->arcs[i].to;
+        // -1 until a pair is seen: paths of weight 0 still need a witness or a shortcut
+        int maxVia = -1;
+        for (int j = i + 1; j < list->count; j++)
+        {
+            int via = list->arcs[i].weight + list->arcs[j].weight;
+            if (via > maxVia)
+                maxVia = via;
+        }
+        if (maxVia == -1)
+        {
+            continue;
+        }
+
+        chWitnessSearch(builder, u, station, maxVia);
+        for (int j = i + 1; j < list->count; j++)
+        {
+            int w = list->arcs[j].to;
+            int via = list->arcs[i].weight + list->arcs[j].weight;
+            if (builder->witnessDistances[w] <= via)
+            {
+                continue;
+            }
+            shortcuts++;
+            if (apply)
+            {
+                chAddOrImprove(builder, u, w, via, station);
+            }
+        }
+    }
+    return shortcuts;
+}
+
+int chPriority(ChBuilder *builder, int station)
+{
+    int shortcuts = chContract(builder, station, 0);
+    return 2 * (shortcuts - builder->adjacency[station].count) + builder->contractedNeighbors[station];
+}
+
+// Orders stations by lazily updated edge difference and contracts them in
+// that order, recording each station's remaining arcs as its upward arcs
+void buildContractionHierarchy(ContractionHierarchy *ch, const MetroSystem *metro, int priority)
+{
+    int n = metro->numStations;
+    const int *weights = arcWeights(metro, priority);
+    ChBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.numStations = n;
+    builder.adjacency = calloc((size_t)(n > 0 ? n : 1), sizeof(ChAdjacency));
+    builder.contracted = calloc((size_t)(n > 0 ? n : 1), 1);
+    builder.contractedNeighbors = calloc((size_t)(n > 0 ? n : 1), sizeof(int));
+    builder.witnessDistances = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    builder.witnessTouched = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    if (builder.adjacency == NULL || builder.contracted == NULL || builder.contractedNeighbors == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    queueInit(&builder.witnessQueue, QUEUE_QUAD_HEAP, metro);
+    for (int i = 0; i < n; i++)
+    {
+        builder.witnessDistances[i] = INT_MAX;
+    }
+
+    for (int u = 0; u < n; u++)
+    {
+        for (int a = metro->offsets[u]; a < metro->offsets[u + 1]; a++)
+        {
+            if (metro->neighbors[a] != u && weights[a] != ARC_CLOSED)
+            {
+                chAddOrImprove(&builder, u, metro->neighbors[a], weights[a], -1);
+            }
+        }
+    }
+
+    memset(ch, 0, sizeof(*ch));
+    ch->numStations = n;
+    ch->priority = priority;
+    ch->rank = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    ch->offsets = checkedRealloc(NULL, (size_t)(n + 1) * sizeof(int));
+
+    PriorityQueue order;
+    queueInit(&order, QUEUE_QUAD_HEAP, metro);
+    for (int v = 0; v < n; v++)
+    {
+        queuePush(&order, v, chPriority(&builder, v));
+    }
+
+    // Upward arcs are collected per station, then packed in station order
+    ChAdjacency *upward = calloc((size_t)(n > 0 ? n : 1), sizeof(ChAdjacency));
+    int numArcs = 0;
+    int nextRank = 0;
+    int station, key;
+
+    while (queuePop(&order, &station, &key))
+    {
+        int current = chPriority(&builder, station);
+        if (order.size > 0 && current > order.keys[0])
+        {
+            queuePush(&order, station, current);
+            continue;
+        }
+
+        ch->numShortcuts += chContract(&builder, station, 1);
+        chCompact(&builder, station);
+
+        ChAdjacency *list = &builder.adjacency[station];
+        upward[station].arcs = copyOf(list->arcs, (size_t)list->count * sizeof(ChArc));
+        upward[station].count = list->count;
+        numArcs += list->count;
+        for (int i = 0; i < list->count; i++)
+        {
+            builder.contractedNeighbors[list->arcs[i].to]++;
+        }
+
+        builder.contracted[station] = 1;
+        ch->rank[station] = nextRank++;
+    }
+
+    ch->arcs = checkedRealloc(NULL, (size_t)(numArcs > 0 ? numArcs : 1) * sizeof(ChArc));
+    ch->offsets[0] = 0;
+    for (int v = 0; v < n; v++)
+    {
+        memcpy(ch->arcs + ch->offsets[v], upward[v].arcs, (size_t)upward[v].count * sizeof(ChArc));
+        ch->offsets[v + 1] = ch->offsets[v] + upward[v].count;
+        free(upward[v].arcs);
+        free(builder.adjacency[v].arcs);
+    }
+
+    free(upward);
+    queueFree(&order);
+    queueFree(&builder.witnessQueue);
+    free(builder.adjacency);
+    free(builder.contracted);
+    free(builder.contractedNeighbors);
+    free(builder.witnessDistances);
+    free(builder.witnessTouched);
+}
+
+void freeContractionHierarchy(ContractionHierarchy *ch)
+{
+    free(ch->rank);
+    free(ch->offsets);
+    free(ch->arcs);
+    memset(ch, 0, sizeof(*ch));
+}
+
+// Returns the upward arc of low that leads to high
+const ChArc *findChArc(const ContractionHierarchy *ch, int low, int high)
+{
+    for (int a = ch->offsets[low]; a < ch->offsets[low + 1]; a++)
+    {
+        if (ch->arcs[a].to == high)
+        {
+            return &ch->arcs[a];
+        }
+    }
+    return NULL;
+}
+
+void appendPath(BidirectionalWorkspace *workspace, int station)
+{
+    if (workspace->pathLength == workspace->pathCapacity)
+    {
+        workspace->pathCapacity = workspace->pathCapacity ? workspace->pathCapacity * 2 : 64;
+        workspace->path = checkedRealloc(workspace->path, (size_t)workspace->pathCapacity * sizeof(int));
+    }
+    workspace->path[workspace->pathLength++] = station;
+}
+
+// Appends the stations after a up to and including b, expanding shortcuts.
+// The arcs a-middle and middle-b are upward arcs of middle, which was
+// contracted before both.
+void chUnpack(const ContractionHierarchy *ch, BidirectionalWorkspace *workspace, int a, int b, int middle)
+{
+    if (middle == -1)
+    {
+        appendPath(workspace, b);
+        return;
+    }
+    chUnpack(ch, workspace, a, middle, findChArc(ch, middle, a)->middle);
+    chUnpack(ch, workspace, middle, b, findChArc(ch, middle, b)->middle);
+}
+
+// Bidirectional upward search from start and target. Returns the distance
+// (INT_MAX when unreachable) and leaves the station-by-station path, with
+// shortcuts unpacked, in workspace->path.
+int chQuery(const ContractionHierarchy *ch, SearchWorkspace *search, int start, int target)
+{
+    BidirectionalWorkspace *workspace = &search->bidirectional;
+    int ends[2] = {start, target};
+    int best = INT_MAX, meeting = -1;
+
+    resetBidirectionalWorkspace(workspace);
+    for (int d = 0; d < 2; d++)
+    {
+        workspace->distances[d][ends[d]] = 0;
+        workspace->parent[d][ends[d]] = -1;
+        workspace->touched[d][workspace->numTouched[d]++] = ends[d];
+        queuePush(&workspace->queues[d], ends[d], 0);
+    }
+
+    for (;;)
+    {
+        // Advance the direction with the smaller head; a direction is done
+        // once its head can no longer improve on best
+        int d = -1;
+        for (int side = 0; side < 2; side++)
+        {
+            PriorityQueue *queue = &workspace->queues[side];
+            if (queue->size > 0 && queue->keys[0] < best && (d == -1 || queue->keys[0] < workspace->queues[d].keys[0]))
+            {
+                d = side;
+            }
+        }
+        if (d == -1)
+        {
+            break;
+        }
+
+        int node, key;
+        queuePop(&workspace->queues[d], &node, &key);
+        int *distances = workspace->distances[d];
+        const int *other = workspace->distances[1 - d];
+        search->settledNodes++;
+        search->relaxedArcs += ch->offsets[node + 1] - ch->offsets[node];
+
+        if (other[node] != INT_MAX && key + other[node] < best)
+        {
+            best = key + other[node];
+            meeting = node;
+        }
+
+        for (int a = ch->offsets[node]; a < ch->offsets[node + 1]; a++)
+        {
+            int next = ch->arcs[a].to;
+            int distance = key + ch->arcs[a].weight;
+            if (distance >= distances[next])
+            {
+                continue;
+            }
+            if (distances[next] == INT_MAX)
+            {
+                workspace->touched[d][workspace->numTouched[d]++] = next;
+            }
+            distances[next] = distance;
+            workspace->parent[d][next] = node;
+            workspace->parentArc[d][next] = a;
+            queuePush(&workspace->queues[d], next, distance);
+
+            if (other[next] != INT_MAX && distance + other[next] < best)
+            {
+                best = distance + other[next];
+                meeting = next;
+            }
+        }
+    }
+
+    workspace->pathLength = 0;
+    if (meeting == -1)
+    {
+        return INT_MAX;
+    }
+
+    // The forward half is unpacked from the meeting station back to start and then reversed
+    appendPath(workspace, meeting);
+    for (int node = meeting; node != start; node = workspace->parent[0][node])
+    {
+        chUnpack(ch, workspace, node, workspace->parent[0][node], ch->arcs[workspace->parentArc[0][node]].middle);
+    }
+    for (int i = 0, j = workspace->pathLength - 1; i < j; i++, j--)
+    {
+        int station = workspace->path[i];
+        workspace->path[i] = workspace->path[j];
+        workspace->path[j] = station;
+    }
+    for (int node = meeting; node != target; node = workspace->parent[1][node])
+    {
+        chUnpack(ch, workspace, node, workspace->parent[1][node], ch->arcs[workspace->parentArc[1][node]].middle);
+    }
+    return best;
+}
+
+// Landmarks for ALT (A*, landmarks, triangle inequality). distances[priority]
+// is station-major: distances[p][v * numLandmarks + l] is the cost between
+// landmark l and station v, INT_MAX when they are not connected. Connections
+// are stored in both directions, so one table serves as both the distance to
+// and from each landmark.
+typedef struct
+{
+    int numLandmarks;
+    int numStations;
+    int *landmarks;
+    int *distances[2];
+} LandmarkSet;
+
+#define ALT_LANDMARKS 8
+
+// Line terminals make good landmarks: most shortest paths run towards or away from one
+static const char *const altTerminals[] = {
+    "Whitefield Kadugodi",
+    "Silk Institute",
+    "Kempegowda International Airport",
+    "Bommasandra",
+};
+
+// Picks the named terminals that exist in this network, then fills up to
+// count with farthest selection on travel time: each new landmark is the
+// station farthest from all chosen ones, preferring stations none of them
+// reach so every component gets a landmark. Distances for both priorities
+// are then computed with one full dijkstraSearch per landmark.
+void buildLandmarks(LandmarkSet *set, const MetroSystem *metro, int count)
+{
+    int n = metro->numStations;
+    memset(set, 0, sizeof(*set));
+    set->numStations = n;
+    if (count > n)
+    {
+        count = n;
+    }
+    set->landmarks = checkedRealloc(NULL, (size_t)(count > 0 ? count : 1) * sizeof(int));
+
+    SearchWorkspace workspace;
+    initializeSearchWorkspace(&workspace, metro, defaultQueueKind);
+    int *distances = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    int *previous = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    int *nearest = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        distances[i] = INT_MAX;
+        previous[i] = -1;
+        nearest[i] = INT_MAX;
+    }
+
+    int named = 0;
+    for (int l = 0; l < count; l++)
+    {
+        int landmark = -1;
+        while (landmark == -1 && named < (int)(sizeof(altTerminals) / sizeof(altTerminals[0])))
+        {
+            landmark = findStation(metro, altTerminals[named++]);
+            for (int k = 0; k < set->numLandmarks && landmark != -1; k++)
+            {
+                landmark = set->landmarks[k] == landmark ? -1 : landmark;
+            }
+        }
+        if (landmark == -1)
+        {
+            for (int v = 0; v < n; v++)
+            {
+                if (nearest[v] > 0 && (landmark == -1 || nearest[v] > nearest[landmark]))
+                {
+                    landmark = v;
+                }
+            }
+        }
+        if (landmark == -1)
+        {
+            break;
+        }
+
+        set->landmarks[set->numLandmarks++] = landmark;
+        dijkstraSearch(metro, &workspace, landmark, -1, distances, previous, 0);
+        for (int v = 0; v < n; v++)
+        {
+            nearest[v] = distances[v] < nearest[v] ? distances[v] : nearest[v];
+        }
+        resetSearchArrays(&workspace, distances, previous);
+    }
+
+    int k = set->numLandmarks;
+    for (int priority = 0; priority < 2; priority++)
+    {
+        set->distances[priority] = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * (size_t)(k > 0 ? k : 1) * sizeof(int));
+        for (int l = 0; l < k; l++)
+        {
+            dijkstraSearch(metro, &workspace, set->landmarks[l], -1, distances, previous, priority);
+            for (int v = 0; v < n; v++)
+            {
+                set->distances[priority][(size_t)v * k + l] = distances[v];
+            }
+            resetSearchArrays(&workspace, distances, previous);
+        }
+    }
+
+    freeSearchWorkspace(&workspace);
+    free(distances);
+    free(previous);
+    free(nearest);
+}
+
+void freeLandmarks(LandmarkSet *set)
+{
+    free(set->landmarks);
+    free(set->distances[0]);
+    free(set->distances[1]);
+    memset(set, 0, sizeof(*set));
+}
+
+// Triangle-inequality lower bound on the cost between a and b
+int landmarkBound(const LandmarkSet *set, int priority, int a, int b)
+{
+    int k = set->numLandmarks;
+    const int *fromA = set->distances[priority] + (size_t)a * k;
+    const int *fromB = set->distances[priority] + (size_t)b * k;
+    int bound = 0;
+    for (int l = 0; l < k; l++)
+    {
+        if (fromA[l] != INT_MAX && fromB[l] != INT_MAX)
+        {
+            int difference = fromA[l] > fromB[l] ? fromA[l] - fromB[l] : fromB[l] - fromA[l];
+            bound = difference > bound ? difference : bound;
+        }
+    }
+    return bound;
+}
+
+// Bidirectional A* with the average of the two landmark potentials, kept
+// doubled to stay in integers: P(v) = bound(v, target) - bound(start, v), the
+// forward key is 2 * distance + P(v) and the backward key 2 * distance - P(v).
+// Both reduced costs are non-negative, so each station is settled once per
+// direction, and no path is shorter than best once the two heads sum to
+// 2 * best. Returns the cost (INT_MAX when unreachable) and leaves the path in
+// the bidirectional workspace, like chQuery.
+int altQuery(const MetroSystem *metro, const LandmarkSet *landmarks, SearchWorkspace *search, int start, int target, int priority)
+{
+    BidirectionalWorkspace *workspace = &search->bidirectional;
+    const int *weights = arcWeights(metro, priority);
+    int ends[2] = {start, target};
+    int best = INT_MAX, meeting = -1;
+
+    resetBidirectionalWorkspace(workspace);
+    for (int d = 0; d < 2; d++)
+    {
+        int end = ends[d];
+        if (workspace->potential[end] == INT_MIN)
+        {
+            workspace->potential[end] = landmarkBound(landmarks, priority, end, target) - landmarkBound(landmarks, priority, start, end);
+        }
+        workspace->distances[d][end] = 0;
+        workspace->parent[d][end] = -1;
+        workspace->touched[d][workspace->numTouched[d]++] = end;
+        queuePush(&workspace->queues[d], end, d == 0 ? workspace->potential[end] : -workspace->potential[end]);
+    }
+
+    for (;;)
+    {
+        PriorityQueue *forward = &workspace->queues[0], *backward = &workspace->queues[1];
+        if (forward->size == 0 || backward->size == 0)
+        {
+            break;
+        }
+        if (best != INT_MAX && (long long)forward->keys[0] + backward->keys[0] >= 2LL * best)
+        {
+            break;
+        }
+        int d = forward->keys[0] <= backward->keys[0] ? 0 : 1;
+
+        int node, key;
+        queuePop(&workspace->queues[d], &node, &key);
+        int *distances = workspace->distances[d];
+        const int *other = workspace->distances[1 - d];
+        int distance = distances[node];
+        search->settledNodes++;
+        search->relaxedArcs += metro->offsets[node + 1] - metro->offsets[node];
+
+        for (int a = metro->offsets[node]; a < metro->offsets[node + 1]; a++)
+        {
+            if (weights[a] == ARC_CLOSED)
+            {
+                continue;
+            }
+            int next = metro->neighbors[a];
+            int candidate = distance + weights[a];
+            if (candidate >= distances[next])
+            {
+                continue;
+            }
+            if (distances[next] == INT_MAX)
+            {
+                workspace->touched[d][workspace->numTouched[d]++] = next;
+            }
+            if (workspace->potential[next] == INT_MIN)
+            {
+                workspace->potential[next] = landmarkBound(landmarks, priority, next, target) - landmarkBound(landmarks, priority, start, next);
+            }
+            distances[next] = candidate;
+            workspace->parent[d][next] = node;
+            queuePush(&workspace->queues[d], next, 2 * candidate + (d == 0 ? workspace->potential[next] : -workspace->potential[next]));
+
+            if (other[next] != INT_MAX && candidate + other[next] < best)
+            {
+                best = candidate + other[next];
+                meeting = next;
+            }
+        }
+    }
+
+    workspace->pathLength = 0;
+    if (start == target)
+    {
+        appendPath(workspace, start);
+        return 0;
+    }
+    if (meeting == -1)
+    {
+        return INT_MAX;
+    }
+
+    for (int node = meeting; node != -1; node = workspace->parent[0][node])
+    {
+        appendPath(workspace, node);
+    }
+    for (int i = 0, j = workspace->pathLength - 1; i < j; i++, j--)
+    {
+        int station = workspace->path[i];
+        workspace->path[i] = workspace->path[j];
+        workspace->path[j] = station;
+    }
+    for (int node = workspace->parent[1][meeting]; node != -1; node = workspace->parent[1][node])
+    {
+        appendPath(workspace, node);
+    }
+    return best;
+}
+
+// Dense engine for small networks: the time and price weights as two
+// contiguous stride x stride matrices, and a Dijkstra whose every round is
+// one argmin over the open distances and one relaxation of a whole matrix
+// row. Both loops run on AVX2, SSE4.1 or plain C, picked at startup from
+// what the CPU supports.
+#define DENSE_MAX_STATIONS 2048
+// Matrix entry of a missing or closed connection, and the distance of a
+// station not reached yet; weights are capped so no path reaches it
+#define DENSE_INFINITY 0x3fffffff
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DENSE_X86 1
+#else
+#define DENSE_X86 0
+#endif
+
+typedef enum
+{
+    DENSE_SCALAR,
+    DENSE_SSE4,
+    DENSE_AVX2
+} DenseKernel;
+
+typedef struct
+{
+    int numStations;
+    // Row length, padded to whole 32-byte vectors; padding is never reached
+    int stride;
+    int *weights[2];
+    int maxWeight;
+    DenseKernel kernel;
+    int (*argmin)(const int *open, int stride);
+    void (*relax)(const int *row, int distance, int node, int *distances, int *open, int *previous, int stride);
+} DenseNetwork;
+
+DenseKernel defaultDenseKernel = DENSE_AVX2;
+
+const char *denseKernelName(DenseKernel kernel)
+{
+    switch (kernel)
+    {
+    case DENSE_SCALAR:
+        return "scalar";
+    case DENSE_SSE4:
+        return "sse4";
+    case DENSE_AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+int parseDenseKernel(const char *name, DenseKernel *kernel)
+{
+    for (int k = DENSE_SCALAR; k <= DENSE_AVX2; k++)
+    {
+        if (strcmp(name, denseKernelName((DenseKernel)k)) == 0)
+        {
+            *kernel = (DenseKernel)k;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int denseKernelSupported(DenseKernel kernel)
+{
+#if DENSE_X86
+    __builtin_cpu_init();
+    if (kernel == DENSE_AVX2)
+        return __builtin_cpu_supports("avx2");
+    if (kernel == DENSE_SSE4)
+        return __builtin_cpu_supports("sse4.1");
+#endif
+    return kernel == DENSE_SCALAR;
+}
+
+// Index of the smallest open entry, the lowest index among equals, so
+// stations settle in the same order as with the sparse queues
+int denseArgminScalar(const int *open, int stride)
+{
+    int best = 0;
+    for (int i = 1; i < stride; i++)
+    {
+        if (open[i] < open[best])
+            best = i;
+    }
+    return best;
+}
+
+// Settled stations never improve: their distance is at most the one being
+// relaxed, and weights are non-negative
+void denseRelaxScalar(const int *row, int distance, int node, int *distances, int *open, int *previous, int stride)
+{
+    for (int i = 0; i < stride; i++)
+    {
+        int candidate = distance + row[i];
+        if (candidate < distances[i])
+        {
+            distances[i] = candidate;
+            open[i] = candidate;
+            previous[i] = node;
+        }
+    }
+}
+
+// Lane-wise minima with their first index, then the lowest index among the
+// lanes holding the overall minimum
+int denseReduceArgmin(const int *values, const int *indices, int lanes)
+{
+    int best = 0;
+    for (int l = 1; l < lanes; l++)
+    {
+        if (values[l] < values[best] || (values[l] == values[best] && indices[l] < indices[best]))
+            best = l;
+    }
+    return indices[best];
+}
+
+#if DENSE_X86
+__attribute__((target("sse4.1"))) int denseArgminSse4(const int *open, int stride)
+{
+    __m128i bestValues = _mm_set1_epi32(INT_MAX), bestIndices = _mm_setr_epi32(0, 1, 2, 3);
+    __m128i indices = bestIndices, step = _mm_set1_epi32(4);
+    for (int i = 0; i < stride; i += 4)
+    {
+        __m128i values = _mm_load_si128((const __m128i *)(open + i));
+        __m128i less = _mm_cmplt_epi32(values, bestValues);
+        bestValues = _mm_blendv_epi8(bestValues, values, less);
+        bestIndices = _mm_blendv_epi8(bestIndices, indices, less);
+        indices = _mm_add_epi32(indices, step);
+    }
+    int values[4], lanes[4];
+    _mm_storeu_si128((__m128i *)values, bestValues);
+    _mm_storeu_si128((__m128i *)lanes, bestIndices);
+    return denseReduceArgmin(values, lanes, 4);
+}
+
+__attribute__((target("sse4.1"))) void denseRelaxSse4(const int *row, int distance, int node, int *distances, int *open, int *previous, int stride)
+{
+    __m128i base = _mm_set1_epi32(distance), parent = _mm_set1_epi32(node);
+    for (int i = 0; i < stride; i += 4)
+    {
+        __m128i candidates = _mm_add_epi32(base, _mm_load_si128((const __m128i *)(row + i)));
+        __m128i current = _mm_load_si128((const __m128i *)(distances + i));
+        __m128i better = _mm_cmplt_epi32(candidates, current);
+        if (_mm_testz_si128(better, better))
+            continue;
+        _mm_store_si128((__m128i *)(distances + i), _mm_blendv_epi8(current, candidates, better));
+        _mm_store_si128((__m128i *)(open + i), _mm_blendv_epi8(_mm_load_si128((const __m128i *)(open + i)), candidates, better));
+        _mm_store_si128((__m128i *)(previous + i), _mm_blendv_epi8(_mm_load_si128((const __m128i *)(previous + i)), parent, better));
+    }
+}
+
+__attribute__((target("avx2"))) int denseArgminAvx2(const int *open, int stride)
+{
+    __m256i bestValues = _mm256_set1_epi32(INT_MAX), bestIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i indices = bestIndices, step = _mm256_set1_epi32(8);
+    for (int i = 0; i < stride; i += 8)
+    {
+        __m256i values = _mm256_load_si256((const __m256i *)(open + i));
+        __m256i less = _mm256_cmpgt_epi32(bestValues, values);
+        bestValues = _mm256_blendv_epi8(bestValues, values, less);
+        bestIndices = _mm256_blendv_epi8(bestIndices, indices, less);
+        indices = _mm256_add_epi32(indices, step);
+    }
+    int values[8], lanes[8];
+    _mm256_storeu_si256((__m256i *)values, bestValues);
+    _mm256_storeu_si256((__m256i *)lanes, bestIndices);
+    return denseReduceArgmin(values, lanes, 8);
+}
+
+__attribute__((target("avx2"))) void denseRelaxAvx2(const int *row, int distance, int node, int *distances, int *open, int *previous, int stride)
+{
+    __m256i base = _mm256_set1_epi32(distance), parent = _mm256_set1_epi32(node);
+    for (int i = 0; i < stride; i += 8)
+    {
+        __m256i candidates = _mm256_add_epi32(base, _mm256_load_si256((const __m256i *)(row + i)));
+        __m256i current = _mm256_load_si256((const __m256i *)(distances + i));
+        __m256i better = _mm256_cmpgt_epi32(current, candidates);
+        if (_mm256_testz_si256(better, better))
+            continue;
+        _mm256_store_si256((__m256i *)(distances + i), _mm256_blendv_epi8(current, candidates, better));
+        _mm256_store_si256((__m256i *)(open + i), _mm256_blendv_epi8(_mm256_load_si256((const __m256i *)(open + i)), candidates, better));
+        _mm256_store_si256((__m256i *)(previous + i), _mm256_blendv_epi8(_mm256_load_si256((const __m256i *)(previous + i)), parent, better));
+    }
+}
+#endif
+
+// Switches to kernel, or to the best supported one below it
+void setDenseKernel(DenseNetwork *dense, DenseKernel kernel)
+{
+    while (!denseKernelSupported(kernel))
+    {
+        kernel = (DenseKernel)(kernel - 1);
+    }
+    dense->kernel = kernel;
+    dense->argmin = denseArgminScalar;
+    dense->relax = denseRelaxScalar;
+#if DENSE_X86
+    if (kernel == DENSE_SSE4)
+    {
+        dense->argmin = denseArgminSse4;
+        dense->relax = denseRelaxSse4;
+    }
+    else if (kernel == DENSE_AVX2)
+    {
+        dense->argmin = denseArgminAvx2;
+        dense->relax = denseRelaxAvx2;
+    }
+#endif
+}
+
+// Stores a connection's weight in both directions; ARC_CLOSED removes it
+void setDenseWeight(DenseNetwork *dense, int priority, int u, int v, int weight)
+{
+    int entry = weight == ARC_CLOSED ? DENSE_INFINITY : weight;
+    dense->weights[priority][(size_t)u * dense->stride + v] = entry;
+    dense->weights[priority][(size_t)v * dense->stride + u] = entry;
+}
+
+void freeDenseNetwork(DenseNetwork *dense)
+{
+    free(dense->weights[0]);
+    free(dense->weights[1]);
+    memset(dense, 0, sizeof(*dense));
+}
+
+// Returns 0, with a message, when the network is too large for the matrices
+// or has a weight that could push a path to DENSE_INFINITY
+int buildDenseNetwork(DenseNetwork *dense, const MetroSystem *metro)
+{
+    int n = metro->numStations;
+    memset(dense, 0, sizeof(*dense));
+    if (n > DENSE_MAX_STATIONS)
+    {
+        fprintf(stderr, "Error: the dense engine takes at most %d stations, the network has %d.\n", DENSE_MAX_STATIONS, n);
+        return 0;
+    }
+    dense->numStations = n;
+    dense->stride = (n + 7) / 8 * 8;
+    dense->maxWeight = (DENSE_INFINITY - 1) / (n > 1 ? n - 1 : 1);
+    if (dense->stride == 0)
+    {
+        dense->stride = 8;
+    }
+
+    size_t cells = (size_t)(n > 0 ? n : 1) * dense->stride;
+    for (int priority = 0; priority < 2; priority++)
+    {
+        int *weights = checkedAlignedAlloc(cells * sizeof(int));
+        for (size_t c = 0; c < cells; c++)
+        {
+            weights[c] = DENSE_INFINITY;
+        }
+        const int *arcs = arcWeights(metro, priority);
+        for (int node = 0; node < n; node++)
+        {
+            for (int a = metro->offsets[node]; a < metro->offsets[node + 1]; a++)
+            {
+                int *cell = &weights[(size_t)node * dense->stride + metro->neighbors[a]];
+                if (arcs[a] != ARC_CLOSED && arcs[a] > dense->maxWeight)
+                {
+                    fprintf(stderr, "Error: weight %d is too large for the dense engine.\n", arcs[a]);
+                    free(weights);
+                    freeDenseNetwork(dense);
+                    return 0;
+                }
+                if (arcs[a] != ARC_CLOSED && arcs[a] < *cell)
+                {
+                    *cell = arcs[a];
+                }
+            }
+        }
+        dense->weights[priority] = weights;
+    }
+    setDenseKernel(dense, defaultDenseKernel);
+    return 1;
+}
+
+// Shortest paths from start under priority, left in workspace->dense:
+// previous[] as for dijkstraSearch, distances[] DENSE_INFINITY where unreached.
+// Stops once target is settled; pass -1 to settle everything.
+void denseSearch(const DenseNetwork *dense, SearchWorkspace *workspace, int start, int target, int priority)
+{
+    DenseWorkspace *scratch = &workspace->dense;
+    if (scratch->stride == 0)
+    {
+        initializeDenseWorkspace(scratch, dense->stride);
+    }
+    int stride = dense->stride;
+    for (int i = 0; i < stride; i++)
+    {
+        scratch->distances[i] = DENSE_INFINITY;
+        scratch->open[i] = INT_MAX;
+        scratch->previous[i] = -1;
+    }
+    scratch->distances[start] = 0;
+    scratch->open[start] = 0;
+
+    const int *weights = dense->weights[priority];
+    for (;;)
+    {
+        int node = dense->argmin(scratch->open, stride);
+        int distance = scratch->open[node];
+        if (distance >= DENSE_INFINITY)
+        {
+            break;
+        }
+        scratch->open[node] = INT_MAX;
+        workspace->settledNodes++;
+        if (node == target)
+        {
+            break;
+        }
+        dense->relax(weights + (size_t)node * stride, distance, node, scratch->distances, scratch->open, scratch->previous, stride);
+        workspace->relaxedArcs += dense->numStations;
+    }
+}
+
+void initializeTimetable(Timetable *timetable)
+{
+    memset(timetable, 0, sizeof(*timetable));
+    timetable->transferTime = 120;
+}
+
+void freeTimetable(Timetable *timetable)
+{
+    free(timetable->connections);
+    free(timetable->tripLines);
+    freeStringPool(&timetable->lines);
+    memset(timetable, 0, sizeof(*timetable));
+}
+
+// Starts a new trip of the named line and returns its id
+int addTimetableTrip(Timetable *timetable, const char *line)
+{
+    if (timetable->numTrips == timetable->tripCapacity)
+    {
+        timetable->tripCapacity = timetable->tripCapacity ? timetable->tripCapacity * 2 : 64;
+        timetable->tripLines = checkedRealloc(timetable->tripLines, (size_t)timetable->tripCapacity * sizeof(uint32_t));
+    }
+    timetable->tripLines[timetable->numTrips] = internString(&timetable->lines, line)->string;
+    return timetable->numTrips++;
+}
+
+void addTimetableConnection(Timetable *timetable, int trip, int from, int to, int departure, int arrival)
+{
+    if (timetable->numConnections == timetable->connectionCapacity)
+    {
+        timetable->connectionCapacity = timetable->connectionCapacity ? timetable->connectionCapacity * 2 : 1024;
+        timetable->connections = checkedRealloc(timetable->connections, (size_t)timetable->connectionCapacity * sizeof(TimetableConnection));
+    }
+    TimetableConnection *connection = &timetable->connections[timetable->numConnections++];
+    connection->from = from;
+    connection->to = to;
+    connection->departure = departure;
+    connection->arrival = arrival;
+    connection->trip = trip;
+}
+
+int compareConnections(const void *a, const void *b)
+{
+    const TimetableConnection *x = a, *y = b;
+    if (x->departure != y->departure)
+        return x->departure < y->departure ? -1 : 1;
+    if (x->arrival != y->arrival)
+        return x->arrival < y->arrival ? -1 : 1;
+    return (x->trip > y->trip) - (x->trip < y->trip);
+}
+
+// Sorts the connections by departure; ties go by arrival so that a trip's
+// zero-length dwell is scanned before the hop that follows it
+void finalizeTimetable(Timetable *timetable)
+{
+    if (timetable->numConnections > 0)
+    {
+        qsort(timetable->connections, (size_t)timetable->numConnections, sizeof(TimetableConnection), compareConnections);
+    }
+}
+
+const char *tripLine(const Timetable *timetable, int trip)
+{
+    return timetable->lines.data + timetable->tripLines[trip];
+}
+
+// Index of the first connection departing at or after time
+int firstConnectionAfter(const Timetable *timetable, int time)
+{
+    int low = 0, high = timetable->numConnections;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (timetable->connections[middle].departure < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+void resetCsaWorkspace(CsaWorkspace *workspace)
+{
+    for (int t = 0; t < workspace->numTouched; t++)
+    {
+        workspace->arrival[workspace->touched[t]] = INT_MAX;
+        workspace->profileHead[workspace->touched[t]] = -1;
+    }
+    for (int t = 0; t < workspace->numTouchedTrips; t++)
+    {
+        workspace->tripBoarded[workspace->touchedTrips[t]] = -1;
+        workspace->tripArrival[workspace->touchedTrips[t]] = INT_MAX;
+    }
+    workspace->numTouched = 0;
+    workspace->numTouchedTrips = 0;
+    workspace->numEntries = 0;
+}
+
+// Earliest arrival at target when leaving start at departure or later. One
+// pass over the connections from the first that leaves in time; it ends once
+// departures reach the best arrival at target. A connection can be taken if
+// its trip is already boarded or its station was reached transferTime before
+// it leaves. Returns the arrival time or INT_MAX; the journey is read back
+// through inConnection and tripBoarded.
+int csaEarliestArrival(const Timetable *timetable, SearchWorkspace *search, int start, int target, int departure)
+{
+    CsaWorkspace *workspace = &search->timetable;
+    int *arrival = workspace->arrival;
+    resetCsaWorkspace(workspace);
+    arrival[start] = departure;
+    workspace->inConnection[start] = -1;
+    workspace->touched[workspace->numTouched++] = start;
+
+    for (int c = firstConnectionAfter(timetable, departure); c < timetable->numConnections; c++)
+    {
+        const TimetableConnection *connection = &timetable->connections[c];
+        if (connection->departure >= arrival[target])
+        {
+            break;
+        }
+        search->relaxedArcs++;
+
+        if (workspace->tripBoarded[connection->trip] == -1)
+        {
+            int ready = arrival[connection->from];
+            if (ready == INT_MAX || (connection->from == start ? ready : ready + timetable->transferTime) > connection->departure)
+            {
+                continue;
+            }
+            workspace->tripBoarded[connection->trip] = c;
+            workspace->touchedTrips[workspace->numTouchedTrips++] = connection->trip;
+        }
+
+        if (connection->arrival < arrival[connection->to])
+        {
+            if (arrival[connection->to] == INT_MAX)
+            {
+                workspace->touched[workspace->numTouched++] = connection->to;
+            }
+            arrival[connection->to] = connection->arrival;
+            workspace->inConnection[connection->to] = c;
+            search->settledNodes++;
+        }
+    }
+    return arrival[target];
+}
+
+// Earliest arrival at target from station when ready to leave at time, read
+// off the station's profile (INT_MAX if no journey is known)
+int evaluateProfile(const CsaWorkspace *workspace, int station, int time)
+{
+    for (int e = workspace->profileHead[station]; e != -1; e = workspace->entries[e].next)
+    {
+        if (workspace->entries[e].departure >= time)
+        {
+            return workspace->entries[e].arrival;
+        }
+    }
+    return INT_MAX;
+}
+
+// Profile query: every Pareto-optimal (departure, arrival) pair from start to
+// target for departures in [earliest, latest]. One backward pass over the
+// connections leaving at earliest or later builds, for every station, the
+// best arrival at target for each departure. Returns the number of journeys;
+// they are listed by ascending departure from profileHead[start].
+int csaProfile(const Timetable *timetable, SearchWorkspace *search, int start, int target, int earliest, int latest)
+{
+    CsaWorkspace *workspace = &search->timetable;
+    resetCsaWorkspace(workspace);
+    int count = 0;
+
+    for (int c = timetable->numConnections - 1; c >= 0 && timetable->connections[c].departure >= earliest; c--)
+    {
+        const TimetableConnection *connection = &timetable->connections[c];
+        search->relaxedArcs++;
+
+        int best = connection->to == target ? connection->arrival : INT_MAX;
+        int onTrip = workspace->tripArrival[connection->trip];
+        int transfer = evaluateProfile(workspace, connection->to, connection->arrival + timetable->transferTime);
+        best = onTrip < best ? onTrip : best;
+        best = transfer < best ? transfer : best;
+        if (best == INT_MAX)
+        {
+            continue;
+        }
+
+        if (workspace->tripArrival[connection->trip] == INT_MAX)
+        {
+            workspace->touchedTrips[workspace->numTouchedTrips++] = connection->trip;
+        }
+        workspace->tripArrival[connection->trip] = best;
+
+        int from = connection->from;
+        if (from == target || (from == start && connection->departure > latest))
+        {
+            continue;
+        }
+        int head = workspace->profileHead[from];
+        if (head != -1 && best >= workspace->entries[head].arrival)
+        {
+            continue;
+        }
+        if (head != -1 && workspace->entries[head].departure == connection->departure)
+        {
+            workspace->entries[head].arrival = best;
+            continue;
+        }
+
+        if (workspace->numEntries == workspace->entryCapacity)
+        {
+            workspace->entryCapacity = workspace->entryCapacity ? workspace->entryCapacity * 2 : 1024;
+            workspace->entries = checkedRealloc(workspace->entries, (size_t)workspace->entryCapacity * sizeof(ProfileEntry));
+        }
+        if (head == -1)
+        {
+            workspace->touched[workspace->numTouched++] = from;
+        }
+        ProfileEntry *entry = &workspace->entries[workspace->numEntries];
+        entry->departure = connection->departure;
+        entry->arrival = best;
+        entry->next = head;
+        workspace->profileHead[from] = workspace->numEntries++;
+        search->settledNodes++;
+        count += from == start;
+    }
+    return count;
+}
+
+// Formats seconds after midnight as HH:MM; hours run past 23 for trips after midnight
+const char *formatClock(char *buffer, int seconds)
+{
+    sprintf(buffer, "%02d:%02d", seconds / 3600, seconds / 60 % 60);
+    return buffer;
+}
+
+// Returns seconds after midnight for HH:MM or HH:MM:SS, or -1
+int parseClock(const char *text)
+{
+    int hours, minutes, seconds = 0;
+    if (sscanf(text, "%d:%d:%d", &hours, &minutes, &seconds) < 2 || hours < 0 || minutes < 0 || minutes > 59)
+    {
+        return -1;
+    }
+    return hours * 3600 + minutes * 60 + seconds;
+}
+
+// A transfer outweighs any ride shorter than this many minutes, so the
+// transfers priority minimises transfers first and time second
+#define LINE_TRANSFER_WEIGHT 65536
+
+// Line-expanded view of a network for interchange-aware routing. Every
+// (station, line) pair is a node, and the nodes of station s are
+// stationOffsets[s] .. stationOffsets[s + 1] - 1; a station that is only
+// another line's copy of an interchange has none, and stationFirst maps every
+// station id to the one its name resolves to. graph is the node CSR: a ride
+// arc follows each connection on its line and transfer arcs join the nodes of
+// a station pairwise at transferTime/transferPrice. transferWeights is the
+// third weight array, for the transfers priority. Lines are integer ids into
+// lineNames, the offsets of their colours in the network's string pool.
+typedef struct
+{
+    MetroSystem graph;
+    int *transferWeights;
+    int numStations;
+    int *stationFirst;
+    int *stationOffsets;
+    int *nodeStations;
+    uint16_t *nodeLines;
+    uint32_t *lineNames;
+    int numLines;
+    int transferTime;
+    int transferPrice;
+} LineGraph;
+
+// (station, line) pairs collected while a line graph is built, chained per
+// station newest first
+typedef struct
+{
+    int *head;
+    int *count;
+    int *next;
+    int *line;
+    int numPairs;
+    int capacity;
+} LinePairs;
+
+// Returns the pair of station and line, adding it when add is set, or -1
+int findLinePair(LinePairs *pairs, int station, int line, int add)
+{
+    for (int p = pairs->head[station]; p != -1; p = pairs->next[p])
+    {
+        if (pairs->line[p] == line)
+        {
+            return p;
+        }
+    }
+    if (!add)
+    {
+        return -1;
+    }
+    if (pairs->numPairs == pairs->capacity)
+    {
+        pairs->capacity = pairs->capacity ? pairs->capacity * 2 : 256;
+        pairs->next = checkedRealloc(pairs->next, (size_t)pairs->capacity * sizeof(int));
+        pairs->line = checkedRealloc(pairs->line, (size_t)pairs->capacity * sizeof(int));
+    }
+    int p = pairs->numPairs++;
+    pairs->line[p] = line;
+    pairs->next[p] = pairs->head[station];
+    pairs->head[station] = p;
+    pairs->count[station]++;
+    return p;
+}
+
+void freeLineGraph(LineGraph *lines)
+{
+    freeMetroSystem(&lines->graph);
+    free(lines->transferWeights);
+    free(lines->stationFirst);
+    free(lines->stationOffsets);
+    free(lines->nodeStations);
+    free(lines->nodeLines);
+    free(lines->lineNames);
+    memset(lines, 0, sizeof(*lines));
+}
+
+// Builds the line graph of metro with the given transfer penalties. A
+// connection rides every line its two stations share; when they share none
+// it belongs to the line of the station on fewer lines (the later one on a
+// tie), which then also serves the other station. That is how an interchange
+// added for one line only, or reused by a later line, gets a node per line.
+// Returns 0 when the network has more lines than node line ids can hold.
+int buildLineGraph(LineGraph *lines, const MetroSystem *metro, int transferTime, int transferPrice)
+{
+    int n = metro->numStations;
+    memset(lines, 0, sizeof(*lines));
+    lines->numStations = n;
+    lines->transferTime = transferTime;
+    lines->transferPrice = transferPrice;
+    lines->stationFirst = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+
+    LinePairs pairs;
+    memset(&pairs, 0, sizeof(pairs));
+    pairs.head = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    pairs.count = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    int *stationLines = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+    for (int s = 0; s < n; s++)
+    {
+        pairs.head[s] = -1;
+        pairs.count[s] = 0;
+    }
+
+    // Colours are interned, so a line is identified by its colour's offset;
+    // stations come line by line, so the previous station's line is tried first
+    int lineCapacity = 0;
+    int line = -1;
+    for (int s = 0; s < n; s++)
+    {
+        uint32_t color = metro->stations[s].color;
+        if (line == -1 || lines->lineNames[line] != color)
+        {
+            line = 0;
+            while (line < lines->numLines && lines->lineNames[line] != color)
+            {
+                line++;
+            }
+            if (line == lines->numLines)
+            {
+                if (lines->numLines > UINT16_MAX)
+                {
+                    fprintf(stderr, "Error: the line graph supports at most %d lines.\n", UINT16_MAX + 1);
+                    free(pairs.head);
+                    free(pairs.count);
+                    free(pairs.next);
+                    free(pairs.line);
+                    free(stationLines);
+                    freeLineGraph(lines);
+                    return 0;
+                }
+                if (lines->numLines == lineCapacity)
+                {
+                    lineCapacity = lineCapacity ? lineCapacity * 2 : 16;
+                    lines->lineNames = checkedRealloc(lines->lineNames, (size_t)lineCapacity * sizeof(uint32_t));
+                }
+                lines->lineNames[lines->numLines++] = color;
+            }
+        }
+        stationLines[s] = line;
+        lines->stationFirst[s] = findStation(metro, stationName(metro, s));
+        findLinePair(&pairs, lines->stationFirst[s], line, 1);
+    }
+
+    // Ride arcs are added between pair ids and renumbered once the nodes are known
+    MetroSystem *graph = &lines->graph;
+    for (int u = 0; u < n; u++)
+    {
+        for (int a = metro->offsets[u]; a < metro->offsets[u + 1]; a++)
+        {
+            int v = metro->neighbors[a];
+            int from = lines->stationFirst[u], to = lines->stationFirst[v];
+            if (u > v || from == to)
+            {
+                continue;
+            }
+            int shared = 0;
+            for (int p = pairs.head[from]; p != -1; p = pairs.next[p])
+            {
+                int q = findLinePair(&pairs, to, pairs.line[p], 0);
+                if (q != -1)
+                {
+                    addEdge(graph, p, q, metro->times[a], metro->prices[a]);
+                    shared++;
+                }
+            }
+            if (shared == 0)
+            {
+                int fewer = pairs.count[from] != pairs.count[to] ? pairs.count[from] < pairs.count[to] : from > to;
+                int own = stationLines[fewer ? from : to];
+                int p = findLinePair(&pairs, from, own, 1);
+                int q = findLinePair(&pairs, to, own, 1);
+                addEdge(graph, p, q, metro->times[a], metro->prices[a]);
+            }
+        }
+    }
+
+    int numNodes = pairs.numPairs;
+    int *pairNodes = checkedRealloc(NULL, (size_t)(numNodes > 0 ? numNodes : 1) * sizeof(int));
+    lines->stationOffsets = checkedRealloc(NULL, (size_t)(n + 1) * sizeof(int));
+    lines->nodeStations = checkedRealloc(NULL, (size_t)(numNodes > 0 ? numNodes : 1) * sizeof(int));
+    lines->nodeLines = checkedRealloc(NULL, (size_t)(numNodes > 0 ? numNodes : 1) * sizeof(uint16_t));
+    lines->stationOffsets[0] = 0;
+    for (int s = 0; s < n; s++)
+    {
+        lines->stationOffsets[s + 1] = lines->stationOffsets[s] + pairs.count[s];
+        // Filled from the back, so a station's lines keep the order they were found in
+        int node = lines->stationOffsets[s + 1];
+        for (int p = pairs.head[s]; p != -1; p = pairs.next[p])
+        {
+            node--;
+            pairNodes[p] = node;
+            lines->nodeStations[node] = s;
+            lines->nodeLines[node] = (uint16_t)pairs.line[p];
+        }
+    }
+
+    graph->numStations = numNodes;
+    for (int e = 0; e < graph->numEdges; e++)
+    {
+        graph->edges[e].from = pairNodes[graph->edges[e].from];
+        graph->edges[e].to = pairNodes[graph->edges[e].to];
+    }
+    for (int s = 0; s < n; s++)
+    {
+        for (int x = lines->stationOffsets[s]; x < lines->stationOffsets[s + 1]; x++)
+        {
+            for (int y = x + 1; y < lines->stationOffsets[s + 1]; y++)
+            {
+                addEdge(graph, x, y, transferTime, transferPrice);
+            }
+        }
+    }
+    finalizeMetroSystem(graph);
+
+    lines->transferWeights = checkedRealloc(NULL, (size_t)(graph->numArcs > 0 ? graph->numArcs : 1) * sizeof(int));
+    for (int x = 0; x < numNodes; x++)
+    {
+        for (int a = graph->offsets[x]; a < graph->offsets[x + 1]; a++)
+        {
+            int transfer = lines->nodeStations[graph->neighbors[a]] == lines->nodeStations[x];
+            lines->transferWeights[a] = transfer && graph->times[a] != ARC_CLOSED ? LINE_TRANSFER_WEIGHT + graph->times[a] : graph->times[a];
+        }
+    }
+
+    free(pairs.head);
+    free(pairs.count);
+    free(pairs.next);
+    free(pairs.line);
+    free(stationLines);
+    free(pairNodes);
+    return 1;
+}
+
+const int *lineWeights(const LineGraph *lines, int priority)
+{
+    return priority == 2 ? lines->transferWeights : arcWeights(&lines->graph, priority);
+}
+
+const char *lineName(const MetroSystem *metro, const LineGraph *lines, int node)
+{
+    return metro->names.data + lines->lineNames[lines->nodeLines[node]];
+}
+
+// Gives the ride arcs of the connection between stations u and v new
+// weights, ARC_CLOSED included, after the network's own arcs changed
+void setLineConnectionWeights(LineGraph *lines, int u, int v, int time, int price)
+{
+    MetroSystem *graph = &lines->graph;
+    int from = lines->stationFirst[u], to = lines->stationFirst[v];
+    for (int x = lines->stationOffsets[from]; x < lines->stationOffsets[from + 1]; x++)
+    {
+        for (int a = graph->offsets[x]; a < graph->offsets[x + 1]; a++)
+        {
+            int y = graph->neighbors[a];
+            if (lines->nodeStations[y] != to)
+            {
+                continue;
+            }
+            int b = findArc(graph, y, x);
+            graph->times[a] = graph->times[b] = time;
+            graph->prices[a] = graph->prices[b] = price;
+            lines->transferWeights[a] = lines->transferWeights[b] = time;
+        }
+    }
+}
+
+// Returns the workspace's line-graph scratch, creating it on first use
+LineWorkspace *lineWorkspace(const LineGraph *lines, SearchWorkspace *workspace)
+{
+    if (workspace->lines == NULL)
+    {
+        int n = lines->graph.numStations;
+        LineWorkspace *scratch = checkedRealloc(NULL, sizeof(LineWorkspace));
+        // Transfer weights lie far outside the bucket queue's range
+        initializeSearchWorkspace(&scratch->search, &lines->graph, defaultQueueKind == QUEUE_BUCKET ? QUEUE_QUAD_HEAP : defaultQueueKind);
+        scratch->distances = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        scratch->previous = checkedRealloc(NULL, (size_t)(n > 0 ? n : 1) * sizeof(int));
+        for (int i = 0; i < n; i++)
+        {
+            scratch->distances[i] = INT_MAX;
+            scratch->previous[i] = -1;
+        }
+        workspace->lines = scratch;
+    }
+    return workspace->lines;
+}
+
+// Best route between stations from and to over the line graph under priority
+// (0 time, 1 price, 2 transfers): dijkstraSearchRanges seeded with every line
+// at the origin, so boarding is free, and stopped when the first node of the
+// destination settles. Returns that node, or -1 when there is no route;
+// distances/previous are the line workspace's, which the caller resets with
+// resetSearchArrays. The work is counted on workspace.
+int lineSearch(const LineGraph *lines, SearchWorkspace *workspace, int from, int to, int priority)
+{
+    LineWorkspace *scratch = lineWorkspace(lines, workspace);
+    SearchWorkspace *search = &scratch->search;
+    long settledNodes = search->settledNodes, relaxedArcs = search->relaxedArcs;
+
+    from = lines->stationFirst[from];
+    to = lines->stationFirst[to];
+    int end = dijkstraSearchRanges(&lines->graph, search, lineWeights(lines, priority), lines->stationOffsets[from], lines->stationOffsets[from + 1],
+                                   lines->stationOffsets[to], lines->stationOffsets[to + 1], INT_MAX, scratch->distances, scratch->previous);
+    workspace->settledNodes += search->settledNodes - settledNodes;
+    workspace->relaxedArcs += search->relaxedArcs - relaxedArcs;
+    return end;
+}
+
+// Record priority of a line-graph answer
+int lineRecordPriority(int priority)
+{
+    return priority == 2 ? ROUTE_PRIORITY_TRANSFERS : priority;
+}
+
+// Renders the route lineSearch found to end between stations from and to.
+// Every station appears once, with the line the route leaves it on; the text
+// format names the origin and each station where the route changes line,
+// found from the node lines rather than from station names.
+void renderLineRoute(RouteBuffer *out, const MetroSystem *metro, const LineGraph *lines, const int *previous, int from, int to, int end,
+                     int priority)
+{
+    uint64_t phaseStart = metricsPhaseStart();
+    if (end == -1 || previous[end] == -1)
+    {
+        renderRouteStatus(out, ROUTE_UNREACHABLE, from, to, lineRecordPriority(priority));
+        metricsPhaseEnd(PHASE_RENDER, phaseStart);
+        return;
+    }
+
+    const MetroSystem *graph = &lines->graph;
+    const int *nodeStations = lines->nodeStations;
+    int count = 0;
+    int totals[3] = {0, 0, 0};
+    for (int current = end; current != -1; current = previous[current])
+    {
+        int *nodes = reserveRouteStations(out, count + 1);
+        nodes[count++] = current;
+        if (previous[current] != -1)
+        {
+            int arc = findArc(graph, current, previous[current]);
+            totals[0] += graph->times[arc];
+            totals[1] += graph->prices[arc];
+            totals[2] += nodeStations[current] == nodeStations[previous[current]];
+        }
+    }
+    // nodes[i] is the last node of its station when the next one is elsewhere
+    const int *nodes = out->stations;
+    int numStations = count - totals[2];
+
+    switch (defaultRouteFormat)
+    {
+    case ROUTE_TEXT:
+    {
+        static const char *const labels[] = {"\nTotal Time: ", "\nTotal Price: ", "\nTotal Transfers: "};
+        static const char *const units[] = {" minutes\n", " rupees\n", "\n"};
+        appendString(out, "Route: ");
+        appendString(out, stationName(metro, from));
+        for (int i = count - 1; i > 0; i--)
+        {
+            if (i < count - 1 && nodeStations[nodes[i]] != nodeStations[nodes[i + 1]])
+            {
+                continue;
+            }
+            if (i < count - 1)
+            {
+                appendString(out, " -> ");
+                appendString(out, stationName(metro, nodeStations[nodes[i]]));
+            }
+            if (*lineName(metro, lines, nodes[i]) != '\0')
+            {
+                appendString(out, " (");
+                appendString(out, lineName(metro, lines, nodes[i]));
+                appendString(out, ")");
+            }
+        }
+        appendString(out, " -> ");
+        appendString(out, stationName(metro, to));
+        appendString(out, labels[priority]);
+        appendInt(out, totals[priority]);
+        appendString(out, units[priority]);
+        break;
+    }
+    case ROUTE_JSON:
+    {
+        appendJsonHeader(out, ROUTE_OK, lineRecordPriority(priority), from, to);
+        appendString(out, ",\"total_time\":");
+        appendInt(out, totals[0]);
+        appendString(out, ",\"total_price\":");
+        appendInt(out, totals[1]);
+        appendString(out, ",\"transfers\":");
+        appendInt(out, totals[2]);
+        appendString(out, ",\"stations\":[");
+        int written = 0;
+        for (int i = count - 1; i >= 0; i--)
+        {
+            if (i > 0 && nodeStations[nodes[i - 1]] == nodeStations[nodes[i]])
+            {
+                continue;
+            }
+            appendString(out, written++ == 0 ? "{\"id\":" : ",{\"id\":");
+            appendInt(out, nodeStations[nodes[i]]);
+            appendString(out, ",\"name\":");
+            appendJsonString(out, stationName(metro, nodeStations[nodes[i]]));
+            appendString(out, ",\"line\":");
+            appendJsonString(out, lineName(metro, lines, nodes[i]));
+            appendString(out, "}");
+        }
+        appendString(out, "]}\n");
+        break;
+    }
+    case ROUTE_BINARY:
+    {
+        RouteRecord record = {ROUTE_OK, (uint8_t)lineRecordPriority(priority), (uint16_t)totals[2], from, to, totals[0], totals[1], -1, -1,
+                              (uint32_t)numStations};
+        appendBytes(out, &record, sizeof(record));
+        char *ids = reserveRoute(out, (size_t)numStations * sizeof(uint32_t));
+        int written = 0;
+        for (int i = count - 1; i >= 0; i--)
+        {
+            if (i > 0 && nodeStations[nodes[i - 1]] == nodeStations[nodes[i]])
+            {
+                continue;
+            }
+            uint32_t id = (uint32_t)nodeStations[nodes[i]];
+            memcpy(ids + (size_t)written++ * sizeof(id), &id, sizeof(id));
+        }
+        out->size += (size_t)numStations * sizeof(uint32_t);
+        break;
+    }
+    }
+    metricsPhaseEnd(PHASE_RENDER, phaseStart);
+}
+
+// One cached shortest-path tree: the previous[] array of a full search from
+// an origin, which answers every destination by a chain walk, and the
+// distances that let a disruption repair it in place. Trees are linked newest
+// to oldest for LRU eviction; a tree with references is being read outside
+// the lock and is never evicted.
+typedef struct
+{
+    int *previous;
+    int *distances;
+    int key;
+    int references;
+    int newer;
+    int older;
+} CachedTree;
+
+// Bounded LRU cache of trees keyed by (origin, priority), shared by all
+// query threads under one lock
+typedef struct
+{
+    pthread_mutex_t lock;
+    int numStations;
+    int capacity;
+    int numTrees;
+    CachedTree *trees;
+    int *slots;
+    int newest;
+    int oldest;
+    long hits;
+    long misses;
+    long evictions;
+} TreeCache;
+
+void initializeTreeCache(TreeCache *cache, int numStations, int capacity)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->numStations = numStations;
+    cache->capacity = capacity;
+    cache->trees = calloc((size_t)capacity, sizeof(CachedTree));
+    // slots maps origin * 2 + priority to a tree index, -1 when not cached
+    cache->slots = checkedRealloc(NULL, (size_t)(numStations > 0 ? numStations : 1) * 2 * sizeof(int));
+    for (int key = 0; key < numStations * 2; key++)
+    {
+        cache->slots[key] = -1;
+    }
+    cache->newest = cache->oldest = -1;
+}
+
+void freeTreeCache(TreeCache *cache)
+{
+    for (int t = 0; t < cache->capacity; t++)
+    {
+        free(cache->trees[t].previous);
+        free(cache->trees[t].distances);
+    }
+    free(cache->trees);
+    free(cache->slots);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+void unlinkCachedTree(TreeCache *cache, int index)
+{
+    CachedTree *tree = &cache->trees[index];
+    if (tree->newer != -1)
+        cache->trees[tree->newer].older = tree->older;
+    else
+        cache->newest = tree->older;
+    if (tree->older != -1)
+        cache->trees[tree->older].newer = tree->newer;
+    else
+        cache->oldest = tree->newer;
+}
+
+void linkNewestCachedTree(TreeCache *cache, int index)
+{
+    CachedTree *tree = &cache->trees[index];
+    tree->newer = -1;
+    tree->older = cache->newest;
+    if (cache->newest != -1)
+        cache->trees[cache->newest].newer = index;
+    else
+        cache->oldest = index;
+    cache->newest = index;
+}
+
+// Returns the index of the tree for (origin, priority), pinned until
+// releaseCachedTree, or -1 on a miss
+int acquireCachedTree(TreeCache *cache, int origin, int priority)
+{
+    pthread_mutex_lock(&cache->lock);
+    int index = cache->slots[origin * 2 + priority];
+    if (index == -1)
+    {
+        cache->misses++;
+    }
+    else
+    {
+        cache->hits++;
+        cache->trees[index].references++;
+        unlinkCachedTree(cache, index);
+        linkNewestCachedTree(cache, index);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return index;
+}
+
+void releaseCachedTree(TreeCache *cache, int index)
+{
+    pthread_mutex_lock(&cache->lock);
+    cache->trees[index].references--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Copies a full tree into the cache, evicting the least recently used tree
+// nobody is reading. Does nothing if the tree is already cached (another
+// thread got there first) or every tree is pinned.
+void storeCachedTree(TreeCache *cache, int origin, int priority, const int *distances, const int *previous)
+{
+    int key = origin * 2 + priority;
+    pthread_mutex_lock(&cache->lock);
+    if (cache->slots[key] != -1)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    int index = -1;
+    if (cache->numTrees < cache->capacity)
+    {
+        index = cache->numTrees++;
+        if (cache->trees[index].previous == NULL)
+        {
+            cache->trees[index].previous = checkedRealloc(NULL, (size_t)cache->numStations * sizeof(int));
+            cache->trees[index].distances = checkedRealloc(NULL, (size_t)cache->numStations * sizeof(int));
+        }
+    }
+    else
+    {
+        for (index = cache->oldest; index != -1 && cache->trees[index].references > 0; index = cache->trees[index].newer)
+        {
+        }
+        if (index == -1)
+        {
+            pthread_mutex_unlock(&cache->lock);
+            return;
+        }
+        unlinkCachedTree(cache, index);
+        cache->slots[cache->trees[index].key] = -1;
+        cache->evictions++;
+    }
+
+    CachedTree *tree = &cache->trees[index];
+    memcpy(tree->previous, previous, (size_t)cache->numStations * sizeof(int));
+    memcpy(tree->distances, distances, (size_t)cache->numStations * sizeof(int));
+    tree->key = key;
+    tree->references = 0;
+    cache->slots[key] = index;
+    linkNewestCachedTree(cache, index);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Drops every tree and zeroes the statistics, keeping the allocations. Only
+// valid while no query is running.
+void resetTreeCache(TreeCache *cache)
+{
+    for (int t = 0; t < cache->numTrees; t++)
+    {
+        cache->slots[cache->trees[t].key] = -1;
+    }
+    cache->numTrees = 0;
+    cache->newest = cache->oldest = -1;
+    cache->hits = cache->misses = cache->evictions = 0;
+}
+
+void printTreeCacheStats(TreeCache *cache, FILE *out)
+{
+    pthread_mutex_lock(&cache->lock);
+    long lookups = cache->hits + cache->misses;
+    fprintf(out, "Tree cache: %ld hits, %ld misses (%.1f%% hit rate), %ld evictions, %d of %d trees\n", cache->hits, cache->misses,
+            lookups ? 100.0 * cache->hits / lookups : 0.0, cache->evictions, cache->numTrees, cache->capacity);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+typedef enum
+{
+    DISRUPTION_CLOSE,
+    DISRUPTION_OPEN,
+    DISRUPTION_SET,
+    DISRUPTION_DELAY
+} DisruptionKind;
+
+// One event of a disruption feed: "close A B", "open A B", "set A B TIME
+// PRICE" or "delay A B MINUTES", for the connection between stations A and B
+typedef struct
+{
+    DisruptionKind kind;
+    int from;
+    int to;
+    int time;
+    int price;
+} Disruption;
+
+// The weights a closed connection reopens with
+typedef struct
+{
+    int from;
+    int to;
+    int time;
+    int price;
+} ClosedConnection;
+
+// The mutable side of a served network. Queries hold lock for reading; an
+// event holds it for writing while it changes the connection's weights and
+// repairs, in place, everything derived from them: cached trees and route
+// table rows (only the subtree below a connection that got worse, or the
+// stations a better one improves), and the landmark distances, which stay
+// valid lower bounds when weights grow and are lowered when they shrink.
+// Contraction hierarchies cannot be repaired; once stale, CH queries fall
+// back to Dijkstra.
+typedef struct
+{
+    pthread_rwlock_t lock;
+    MetroSystem *metro;
+    RouteTable *table;
+    TreeCache *trees;
+    LandmarkSet *landmarks;
+    DenseNetwork *dense;
+    LineGraph *lines;
+    int tableWritable;
+    int hierarchiesStale;
+    // No path may overflow, and with the bucket queue no weight may exceed
+    // the queues' bucket range
+    int maxWeight;
+    SearchWorkspace workspace;
+    ClosedConnection *closed;
+    int numClosed;
+    int closedCapacity;
+    long events;
+    long repairedTrees;
+    long repairedStations;
+} LiveNetwork;
+
+void initializeLiveNetwork(LiveNetwork *live, MetroSystem *metro, RouteTable *table, TreeCache *trees, LandmarkSet *landmarks)
+{
+    memset(live, 0, sizeof(*live));
+    pthread_rwlockattr_t attributes;
+    pthread_rwlockattr_init(&attributes);
+#ifdef __GLIBC__
+    // A steady stream of queries must not starve the disruption feed
+    pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&live->lock, &attributes);
+    pthread_rwlockattr_destroy(&attributes);
+    live->metro = metro;
+    live->table = table;
+    live->trees = trees;
+    live->landmarks = landmarks;
+    live->maxWeight = maxConnectionWeight(metro->numStations);
+    if (defaultQueueKind == QUEUE_BUCKET)
+    {
+        live->maxWeight = 0;
+        for (int a = 0; a < metro->numArcs; a++)
+        {
+            if (metro->times[a] != ARC_CLOSED)
+            {
+                live->maxWeight = metro->times[a] > live->maxWeight ? metro->times[a] : live->maxWeight;
+                live->maxWeight = metro->prices[a] > live->maxWeight ? metro->prices[a] : live->maxWeight;
+            }
+        }
+    }
+    // Repairs seed the queue with keys far apart, which only a heap takes
+    initializeSearchWorkspace(&live->workspace, metro, QUEUE_QUAD_HEAP);
+}
+
+void freeLiveNetwork(LiveNetwork *live)
+{
+    freeSearchWorkspace(&live->workspace);
+    free(live->closed);
+    pthread_rwlock_destroy(&live->lock);
+}
+
+// Repairs a full shortest-path tree after the connection between u and v got
+// more expensive or closed. Only the subtree below it can change: it is cut
+// off, reattached from its boundary and settled again. Returns the number of
+// stations recomputed.
+int repairTreeAfterIncrease(const MetroSystem *metro, SearchWorkspace *workspace, const int *weights, int *distances, int *previous, int u, int v)
+{
+    int root = previous[v] == u ? v : previous[u] == v ? u : -1;
+    if (root == -1)
+    {
+        return 0;
+    }
+
+    unsigned stamp = nextSearchStamp(workspace);
+    unsigned *inSubtree = workspace->settled;
+    int *subtree = workspace->touched;
+    int size = 0;
+    subtree[size++] = root;
+    inSubtree[root] = stamp;
+    for (int i = 0; i < size; i++)
+    {
+        int x = subtree[i];
+        for (int a = metro->offsets[x]; a < metro->offsets[x + 1]; a++)
+        {
+            int child = metro->neighbors[a];
+            if (previous[child] == x && inSubtree[child] != stamp)
+            {
+                inSubtree[child] = stamp;
+                subtree[size++] = child;
+            }
+        }
+    }
+    for (int i = 0; i < size; i++)
+    {
+        distances[subtree[i]] = INT_MAX;
+        previous[subtree[i]] = -1;
+    }
+
+    // Connections are symmetric, so the arc x -> p weighs what p -> x does
+    PriorityQueue *queue = &workspace->queue;
+    queueClear(queue);
+    for (int i = 0; i < size; i++)
+    {
+        int x = subtree[i];
+        for (int a = metro->offsets[x]; a < metro->offsets[x + 1]; a++)
+        {
+            int p = metro->neighbors[a];
+            if (inSubtree[p] != stamp && distances[p] != INT_MAX && weights[a] != ARC_CLOSED && distances[p] + weights[a] < distances[x])
+            {
+                distances[x] = distances[p] + weights[a];
+                previous[x] = p;
+            }
+        }
+        if (distances[x] != INT_MAX)
+        {
+            queuePush(queue, x, distances[x]);
+        }
+    }
+
+    int x, key;
+    while (queuePop(queue, &x, &key))
+    {
+        for (int a = metro->offsets[x]; a < metro->offsets[x + 1]; a++)
+        {
+            int c = metro->neighbors[a];
+            if (inSubtree[c] == stamp && weights[a] != ARC_CLOSED && key + weights[a] < distances[c])
+            {
+                distances[c] = key + weights[a];
+                previous[c] = x;
+                queuePush(queue, c, distances[c]);
+            }
+        }
+    }
+    workspace->numTouched = 0;
+    return size;
+}
+
+// Repairs shortest-path distances after the connection between u and v got
+// cheaper or reopened, by propagating from its ends only to the stations it
+// improves. distances may be strided (landmark tables); previous may be NULL.
+// Returns the number of stations improved.
+int repairTreeAfterDecrease(const MetroSystem *metro, SearchWorkspace *workspace, const int *weights, int *distances, size_t stride, int *previous,
+                            int u, int v)
+{
+    PriorityQueue *queue = &workspace->queue;
+    queueClear(queue);
+    for (int end = 0; end < 2; end++)
+    {
+        int x = end == 0 ? u : v, y = end == 0 ? v : u;
+        int arc = findArc(metro, x, y);
+        if (distances[x * stride] != INT_MAX && weights[arc] != ARC_CLOSED && distances[x * stride] + weights[arc] < distances[y * stride])
+        {
+            distances[y * stride] = distances[x * stride] + weights[arc];
+            if (previous != NULL)
+            {
+                previous[y] = x;
+            }
+            queuePush(queue, y, distances[y * stride]);
+        }
+    }
+
+    int improved = 0, x, key;
+    while (queuePop(queue, &x, &key))
+    {
+        improved++;
+        for (int a = metro->offsets[x]; a < metro->offsets[x + 1]; a++)
+        {
+            int c = metro->neighbors[a];
+            if (weights[a] != ARC_CLOSED && key + weights[a] < distances[c * stride])
+            {
+                distances[c * stride] = key + weights[a];
+                if (previous != NULL)
+                {
+                    previous[c] = x;
+                }
+                queuePush(queue, c, distances[c * stride]);
+            }
+        }
+    }
+    return improved;
+}
+
+// Repairs one tree for a change of the u-v weight from before to after
+int repairTree(LiveNetwork *live, const int *weights, int *distances, int *previous, int u, int v, int before, int after)
+{
+    int stations = after > before ? repairTreeAfterIncrease(live->metro, &live->workspace, weights, distances, previous, u, v)
+                                  : repairTreeAfterDecrease(live->metro, &live->workspace, weights, distances, 1, previous, u, v);
+    live->repairedTrees += stations > 0;
+    live->repairedStations += stations;
+    return stations;
+}
+
+// Sets every arc between u and v, both ways, to the given weights
+void setConnectionWeights(MetroSystem *metro, int u, int v, int time, int price)
+{
+    for (int end = 0; end < 2; end++)
+    {
+        int x = end == 0 ? u : v, y = end == 0 ? v : u;
+        for (int a = metro->offsets[x]; a < metro->offsets[x + 1]; a++)
+        {
+            if (metro->neighbors[a] == y)
+            {
+                metro->times[a] = time;
+                metro->prices[a] = price;
+            }
+        }
+    }
+}
+
+int findClosedConnection(const LiveNetwork *live, int u, int v)
+{
+    for (int c = 0; c < live->numClosed; c++)
+    {
+        if ((live->closed[c].from == u && live->closed[c].to == v) || (live->closed[c].from == v && live->closed[c].to == u))
+        {
+            return c;
+        }
+    }
+    return -1;
+}
+
+// Applies one event and repairs what depends on the changed weights. Returns
+// NULL, or what is wrong with the event. The caller holds the write lock.
+const char *applyDisruption(LiveNetwork *live, const Disruption *event)
+{
+    MetroSystem *metro = live->metro;
+    int u = event->from, v = event->to;
+    if (u < 0 || u >= metro->numStations || v < 0 || v >= metro->numStations)
+    {
+        return "invalid station id";
+    }
+    int arc = findArc(metro, u, v);
+    if (arc == -1)
+    {
+        return "no connection between the stations";
+    }
+
+    // The weights in force and the ones a closed connection would reopen with
+    int closed = findClosedConnection(live, u, v);
+    int before[2] = {metro->times[arc], metro->prices[arc]};
+    int open[2] = {closed != -1 ? live->closed[closed].time : before[0], closed != -1 ? live->closed[closed].price : before[1]};
+    switch (event->kind)
+    {
+    case DISRUPTION_CLOSE:
+        break;
+    case DISRUPTION_OPEN:
+        break;
+    case DISRUPTION_SET:
+        open[0] = event->time;
+        open[1] = event->price;
+        break;
+    case DISRUPTION_DELAY:
+        // Checked before the addition, which could overflow
+        if (event->time > live->maxWeight - open[0])
+        {
+            return "weight out of range";
+        }
+        open[0] += event->time;
+        break;
+    }
+    if (open[0] < 0 || open[1] < 0 || open[0] > live->maxWeight || open[1] > live->maxWeight)
+    {
+        return "weight out of range";
+    }
+    // The table's mapping is private, so repairs never reach the file. It is
+    // made writable before anything changes, so a failure leaves no trace.
+    if (live->table != NULL && !live->tableWritable)
+    {
+        if (mprotect(live->table->mapping, live->table->mappingSize, PROT_READ | PROT_WRITE) != 0)
+        {
+            return "the route table cannot be made writable";
+        }
+        live->tableWritable = 1;
+    }
+
+    int after[2] = {open[0], open[1]};
+    int closes = event->kind == DISRUPTION_CLOSE || (closed != -1 && event->kind != DISRUPTION_OPEN);
+    if (closes)
+    {
+        after[0] = after[1] = ARC_CLOSED;
+        if (closed == -1)
+        {
+            if (live->numClosed == live->closedCapacity)
+            {
+                live->closedCapacity = live->closedCapacity ? live->closedCapacity * 2 : 16;
+                live->closed = checkedRealloc(live->closed, (size_t)live->closedCapacity * sizeof(ClosedConnection));
+            }
+            closed = live->numClosed++;
+            live->closed[closed].from = u;
+            live->closed[closed].to = v;
+        }
+        live->closed[closed].time = open[0];
+        live->closed[closed].price = open[1];
+    }
+    else if (closed != -1)
+    {
+        live->closed[closed] = live->closed[--live->numClosed];
+    }
+    live->events++;
+    countMetric(COUNTER_DISRUPTIONS, 1);
+    if (after[0] == before[0] && after[1] == before[1])
+    {
+        return NULL;
+    }
+
+    uint64_t phaseStart = metricsPhaseStart();
+    ownMetroStorage(metro);
+    setConnectionWeights(metro, u, v, after[0], after[1]);
+    live->hierarchiesStale = 1;
+    if (live->lines != NULL)
+    {
+        setLineConnectionWeights(live->lines, u, v, after[0], after[1]);
+    }
+
+    for (int priority = 0; priority < 2; priority++)
+    {
+        if (after[priority] == before[priority])
+        {
+            continue;
+        }
+        const int *weights = arcWeights(metro, priority);
+
+        TreeCache *trees = live->trees;
+        for (int t = 0; trees != NULL && t < trees->numTrees; t++)
+        {
+            if (trees->trees[t].key % 2 == priority)
+            {
+                repairTree(live, weights, trees->trees[t].distances, trees->trees[t].previous, u, v, before[priority], after[priority]);
+            }
+        }
+
+        RouteTable *table = live->table;
+        if (table != NULL)
+        {
+            size_t n = (size_t)table->numStations;
+            for (size_t row = 0; row < n; row++)
+            {
+                repairTree(live, weights, table->distances[priority] + row * n, table->previous[priority] + row * n, u, v, before[priority],
+                           after[priority]);
+            }
+        }
+
+        if (live->dense != NULL)
+        {
+            setDenseWeight(live->dense, priority, u, v, after[priority]);
+        }
+
+        LandmarkSet *landmarks = live->landmarks;
+        if (landmarks != NULL && after[priority] < before[priority])
+        {
+            for (int l = 0; l < landmarks->numLandmarks; l++)
+            {
+                repairTreeAfterDecrease(metro, &live->workspace, weights, landmarks->distances[priority] + l, (size_t)landmarks->numLandmarks, NULL,
+                                        u, v);
+            }
+        }
+    }
+    metricsPhaseEnd(PHASE_REPAIR, phaseStart);
+    return NULL;
+}
+
+// Parses a disruption event line; returns 0 if it is not one
+int parseDisruption(const char *line, Disruption *event)
+{
+    char command[16];
+    int fields = sscanf(line, "%15s %d %d %d %d", command, &event->from, &event->to, &event->time, &event->price);
+    if (fields >= 3 && strcmp(command, "close") == 0)
+        event->kind = DISRUPTION_CLOSE;
+    else if (fields >= 3 && strcmp(command, "open") == 0)
+        event->kind = DISRUPTION_OPEN;
+    else if (fields >= 5 && strcmp(command, "set") == 0)
+        event->kind = DISRUPTION_SET;
+    else if (fields >= 4 && strcmp(command, "delay") == 0)
+        event->kind = DISRUPTION_DELAY;
+    else
+        return 0;
+    return 1;
+}
+
+// Applies one event under the write lock and renders the outcome: what it
+// repaired, or why it was rejected
+void answerDisruption(LiveNetwork *live, const Disruption *event, RouteBuffer *out)
+{
+    static const char *const names[] = {"close", "open", "set", "delay"};
+    pthread_rwlock_wrlock(&live->lock);
+    long trees = live->repairedTrees, stations = live->repairedStations;
+    const char *problem = applyDisruption(live, event);
+    trees = live->repairedTrees - trees;
+    stations = live->repairedStations - stations;
+    pthread_rwlock_unlock(&live->lock);
+
+    switch (defaultRouteFormat)
+    {
+    case ROUTE_TEXT:
+        if (problem != NULL)
+            appendFormat(out, "Error: %s %d %d: %s\n", names[event->kind], event->from, event->to, problem);
+        else
+            appendFormat(out, "Applied: %s %d %d (repaired %ld trees, %ld stations)\n", names[event->kind], event->from, event->to, trees, stations);
+        break;
+    case ROUTE_JSON:
+        appendFormat(out, "{\"event\":\"%s\",\"from\":%d,\"to\":%d,\"status\":\"%s\"", names[event->kind], event->from, event->to,
+                     problem != NULL ? "invalid" : "ok");
+        if (problem != NULL)
+            appendFormat(out, ",\"error\":\"%s\"}\n", problem);
+        else
+            appendFormat(out, ",\"repaired_trees\":%ld,\"repaired_stations\":%ld}\n", trees, stations);
+        break;
+    case ROUTE_BINARY:
+        appendRouteRecord(out, problem != NULL ? ROUTE_INVALID : ROUTE_OK, 0, event->from, event->to, -1, -1, -1, -1, 0);
+        break;
+    }
+}
+
+// Applies every event in path in order, before any query runs; rejected
+// events are reported and skipped
+int applyDisruptionFile(LiveNetwork *live, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror("Error opening file");
+        return 0;
+    }
+    char line[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+        Disruption event;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        const char *problem = parseDisruption(line, &event) ? applyDisruption(live, &event) : "expected close|open A B, set A B TIME PRICE or delay A B MINUTES";
+        if (problem != NULL)
+        {
+            fprintf(stderr, "Warning: %s:%d: %s\n", path, lineNumber, problem);
+        }
+    }
+    fclose(file);
+    fprintf(stderr, "Disruptions: %ld events, %d connections closed, %ld trees repaired (%ld stations)\n", live->events, live->numClosed,
+            live->repairedTrees, live->repairedStations);
+    return 1;
+}
+
+// Everything queries read that is prepared once per process
+typedef struct
+{
+    const MetroSystem *metro;
+    const RouteTable *table;
+    const ContractionHierarchy *hierarchies[2];
+    const LandmarkSet *landmarks;
+    const DenseNetwork *dense;
+    // With a timetable, time-priority answers leave at departure; a profile
+    // query covers every departure up to lastDeparture (-1 otherwise)
+    const Timetable *timetable;
+    int departure;
+    int lastDeparture;
+    // Dijkstra answers go through the tree cache when there is one
+    TreeCache *trees;
+    // Set when disruptions may change the network while queries run
+    LiveNetwork *live;
+    // With a line graph every answer comes from it
+    const LineGraph *lines;
+} Router;
+
+// The priorities answered when a query names none
+int defaultPriorities(const Router *router)
+{
+    return QUERY_TIME | QUERY_PRICE | (router->lines != NULL ? QUERY_TRANSFERS : 0);
+}
+
+// Writes a station sequence into previous[] (which must be reset) so renderRoute can walk it
+void setPathPrevious(const int *path, int length, int *previous)
+{
+    for (int i = 1; i < length; i++)
+    {
+        previous[path[i]] = path[i - 1];
+    }
+}
+
+void clearPathPrevious(const int *path, int length, int *previous)
+{
+    for (int i = 0; i < length; i++)
+    {
+        previous[path[i]] = -1;
+    }
+}
+
+void answerChQuery(const Router *router, SearchWorkspace *workspace, int *previous, int from, int to, int priorities, RouteBuffer *out)
+{
+    BidirectionalWorkspace *ch = &workspace->bidirectional;
+    if (ch->numStations == 0)
+    {
+        initializeBidirectionalWorkspace(ch, router->metro);
+    }
+
+    for (int priority = 0; priority < 2; priority++)
+    {
+        if (!(priorities & (1 << priority)))
+        {
+            continue;
+        }
+        if (priority == 1 && (priorities & QUERY_TIME))
+        {
+            separateRoutes(out);
+        }
+        chQuery(router->hierarchies[priority], workspace, from, to);
+        setPathPrevious(ch->path, ch->pathLength, previous);
+        renderRoute(out, router->metro, previous, from, to, priority);
+        clearPathPrevious(ch->path, ch->pathLength, previous);
+    }
+}
+
+void answerAltQuery(const Router *router, SearchWorkspace *workspace, int *previous, int from, int to, int priorities, RouteBuffer *out)
+{
+    BidirectionalWorkspace *alt = &workspace->bidirectional;
+    if (alt->numStations == 0)
+    {
+        initializeBidirectionalWorkspace(alt, router->metro);
+    }
+
+    for (int priority = 0; priority < 2; priority++)
+    {
+        if (!(priorities & (1 << priority)))
+        {
+            continue;
+        }
+        if (priority == 1 && (priorities & QUERY_TIME))
+        {
+            separateRoutes(out);
+        }
+        altQuery(router->metro, router->landmarks, workspace, from, to, priority);
+        setPathPrevious(alt->path, alt->pathLength, previous);
+        renderRoute(out, router->metro, previous, from, to, priority);
+        clearPathPrevious(alt->path, alt->pathLength, previous);
+    }
+}
+
+void answerDenseQuery(const Router *router, SearchWorkspace *workspace, int from, int to, int priorities, RouteBuffer *out)
+{
+    for (int priority = 0; priority < 2; priority++)
+    {
+        if (!(priorities & (1 << priority)))
+        {
+            continue;
+        }
+        if (priority == 1 && (priorities & QUERY_TIME))
+        {
+            separateRoutes(out);
+        }
+        denseSearch(router->dense, workspace, from, to, priority);
+        renderRoute(out, router->metro, workspace->dense.previous, from, to, priority);
+    }
+}
+
+// Cost of a station-by-station path from start to target, or -1 when it is
+// not a walk over real connections between them. An empty path stands for
+// "unreachable" and costs INT_MAX.
+int pathCost(const MetroSystem *metro, const int *path, int length, int start, int target, int priority)
+{
+    if (length == 0)
+    {
+        return INT_MAX;
+    }
+    if (path[0] != start || path[length - 1] != target)
+    {
+        return -1;
+    }
+    const int *weights = arcWeights(metro, priority);
+    int cost = 0;
+    for (int i = 1; i < length; i++)
+    {
+        int arc = findArc(metro, path[i - 1], path[i]);
+        if (arc == -1)
+        {
+            return -1;
+        }
+        cost += weights[arc];
+    }
+    return cost;
+}
+
+// Cross-checks every prepared point-to-point engine (chQuery, altQuery)
+// against dijkstraSearch on random pairs: costs must match and the returned
+// path must be a real walk of exactly that cost. Also reports the average
+// search effort of each engine. Returns the number of mismatches.
+int validateEngines(const Router *router, int numPairs)
+{
+    const MetroSystem *metro = router->metro;
+    int n = metro->numStations;
+    int mismatches = 0;
+    if (n == 0)
+    {
+        return 0;
+    }
+
+    enum
+    {
+        VALIDATE_DIJKSTRA,
+        VALIDATE_CH,
+        VALIDATE_ALT,
+        VALIDATE_DENSE,
+        VALIDATE_ENGINES
+    };
+    static const char *const names[VALIDATE_ENGINES] = {"dijkstra", "ch", "alt", "dense"};
+    int staleHierarchies = router->live != NULL && router->live->hierarchiesStale;
+    int enabled[VALIDATE_ENGINES] = {1, router->hierarchies[0] != NULL && !staleHierarchies, router->landmarks != NULL, router->dense != NULL};
+    long settled[VALIDATE_ENGINES] = {0}, relaxed[VALIDATE_ENGINES] = {0};
+
+    SearchWorkspace workspace;
+    initializeSearchWorkspace(&workspace, metro, defaultQueueKind);
+    initializeBidirectionalWorkspace(&workspace.bidirectional, metro);
+    int *distances = checkedRealloc(NULL, (size_t)n * sizeof(int));
+    int *previous = checkedRealloc(NULL, (size_t)n * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        distances[i] = INT_MAX;
+        previous[i] = -1;
+    }
+
+    srand(1);
+    for (int q = 0; q < numPairs; q++)
+    {
+        int start = rand() % n;
+        int target = rand() % n;
+        for (int priority = 0; priority < 2; priority++)
+        {
+            long settledBefore = workspace.settledNodes, relaxedBefore = workspace.relaxedArcs;
+            dijkstraSearch(metro, &workspace, start, target, distances, previous, priority);
+            int expected = distances[target];
+            settled[VALIDATE_DIJKSTRA] += workspace.settledNodes - settledBefore;
+            relaxed[VALIDATE_DIJKSTRA] += workspace.relaxedArcs - relaxedBefore;
+
+            for (int e = VALIDATE_CH; e < VALIDATE_ENGINES; e++)
+            {
+                if (!enabled[e])
+                {
+                    continue;
+                }
+                settledBefore = workspace.settledNodes;
+                relaxedBefore = workspace.relaxedArcs;
+                int got, cost;
+                if (e == VALIDATE_DENSE)
+                {
+                    // The dense route must be Dijkstra's exactly, ties included
+                    denseSearch(router->dense, &workspace, start, target, priority);
+                    got = workspace.dense.distances[target] == DENSE_INFINITY ? INT_MAX : workspace.dense.distances[target];
+                    cost = got;
+                    for (int station = target; station != -1 && cost == got; station = previous[station])
+                    {
+                        cost = workspace.dense.previous[station] == previous[station] ? got : -1;
+                    }
+                }
+                else
+                {
+                    got = e == VALIDATE_CH ? chQuery(router->hierarchies[priority], &workspace, start, target)
+                                           : altQuery(metro, router->landmarks, &workspace, start, target, priority);
+                    cost = pathCost(metro, workspace.bidirectional.path, workspace.bidirectional.pathLength, start, target, priority);
+                }
+                settled[e] += workspace.settledNodes - settledBefore;
+                relaxed[e] += workspace.relaxedArcs - relaxedBefore;
+
+                if (got != expected || cost != got)
+                {
+                    if (mismatches++ < 10)
+                    {
+                        fprintf(stderr, "%s mismatch %d -> %d priority %d: dijkstra %d, %s %d, path cost %d\n",
+                                names[e], start, target, priority, expected, names[e], got, cost);
+                    }
+                }
+            }
+            resetSearchArrays(&workspace, distances, previous);
+        }
+    }
+
+    printf("Validation: %d pairs x 2 priorities, %d mismatches\n", numPairs, mismatches);
+    if (enabled[VALIDATE_CH])
+    {
+        printf("  contraction hierarchy: %d shortcuts (time) / %d (price)\n",
+               router->hierarchies[0]->numShortcuts, router->hierarchies[1]->numShortcuts);
+    }
+    if (enabled[VALIDATE_DENSE])
+    {
+        printf("  dense: %s kernel\n", denseKernelName(router->dense->kernel));
+    }
+    if (enabled[VALIDATE_ALT])
+    {
+        printf("  landmarks:");
+        for (int l = 0; l < router->landmarks->numLandmarks; l++)
+        {
+            printf(" %s%s", stationName(metro, router->landmarks->landmarks[l]), l + 1 < router->landmarks->numLandmarks ? "," : "\n");
+        }
+    }
+    for (int e = 0; e < VALIDATE_ENGINES; e++)
+    {
+        if (enabled[e])
+        {
+            printf("  %-8s %10.1f settled %10.1f arcs per query\n", names[e],
+                   (double)settled[e] / (2.0 * numPairs), (double)relaxed[e] / (2.0 * numPairs));
+        }
+    }
+
+    freeSearchWorkspace(&workspace);
+    free(distances);
+    free(previous);
+    return mismatches;
+}
+
+// Both priorities from one paretoSearch. Frontier journeys between the two
+// extremes follow the price route; in text they are "Alternative Route"
+// blocks carrying both totals, the other formats already carry both.
+void answerParetoQuery(const MetroSystem *metro, SearchWorkspace *workspace, int *previous, int from, int to, int priorities, RouteBuffer *out)
+{
+    int count = paretoSearch(metro, workspace, from, to);
+    const int *frontier = workspace->pareto.frontier;
+
+    for (int priority = 0; priority < 2; priority++)
+    {
+        if (!(priorities & (1 << priority)))
+        {
+            continue;
+        }
+        if (priority == 1 && (priorities & QUERY_TIME))
+        {
+            separateRoutes(out);
+        }
+        if (count == 0)
+        {
+            renderRoute(out, metro, previous, from, to, priority);
+            continue;
+        }
+        int label = frontier[priority == 0 ? 0 : count - 1];
+        setParetoPath(workspace, label, previous);
+        renderRoute(out, metro, previous, from, to, priority);
+        clearParetoPath(workspace, label, previous);
+    }
+    if (!(priorities & QUERY_PRICE))
+    {
+        return;
+    }
+
+    for (int i = 1; i < count - 1; i++)
+    {
+        setParetoPath(workspace, frontier[i], previous);
+        if (defaultRouteFormat == ROUTE_TEXT)
+        {
+            appendString(out, "Alternative ");
+            renderRoute(out, metro, previous, from, to, 0);
+            appendString(out, "Total Price: ");
+            appendInt(out, workspace->pareto.labels[frontier[i]].price);
+            appendString(out, " rupees\n");
+        }
+        else
+        {
+            renderRoute(out, metro, previous, from, to, 1);
+        }
+        clearParetoPath(workspace, frontier[i], previous);
+    }
+}
+
+// Timetable answer for the time priority: the earliest-arrival journey leg by
+// leg, or with a lastDeparture every best departure in the window
+void answerTimetableQuery(const Router *router, SearchWorkspace *workspace, int from, int to, RouteBuffer *out)
+{
+    const MetroSystem *metro = router->metro;
+    const Timetable *timetable = router->timetable;
+    CsaWorkspace *csa = &workspace->timetable;
+    if (csa->numStations == 0)
+    {
+        initializeCsaWorkspace(csa, metro->numStations, timetable->numTrips);
+    }
+    char clock[2][16];
+
+    if (router->lastDeparture >= 0)
+    {
+        int count = from == to ? 0 : csaProfile(timetable, workspace, from, to, router->departure, router->lastDeparture);
+        if (count == 0)
+        {
+            renderRouteStatus(out, ROUTE_UNREACHABLE, from, to, ROUTE_PRIORITY_TIMETABLE);
+            return;
+        }
+        if (defaultRouteFormat == ROUTE_TEXT)
+        {
+            appendFormat(out, "Departures: %s -> %s between %s and %s\n", stationName(metro, from), stationName(metro, to),
+                         formatClock(clock[0], router->departure), formatClock(clock[1], router->lastDeparture));
+        }
+        else if (defaultRouteFormat == ROUTE_JSON)
+        {
+            appendJsonHeader(out, ROUTE_OK, ROUTE_PRIORITY_TIMETABLE, from, to);
+            appendString(out, ",\"journeys\":[");
+        }
+        for (int e = csa->profileHead[from]; e != -1; e = csa->entries[e].next)
+        {
+            const ProfileEntry *entry = &csa->entries[e];
+            int minutes = (entry->arrival - entry->departure) / 60;
+            switch (defaultRouteFormat)
+            {
+            case ROUTE_TEXT:
+                appendFormat(out, "%s -> %s (%d minutes)\n", formatClock(clock[0], entry->departure), formatClock(clock[1], entry->arrival), minutes);
+                break;
+            case ROUTE_JSON:
+                appendFormat(out, "%s{\"departure\":\"%s\",\"arrival\":\"%s\",\"total_time\":%d}", e == csa->profileHead[from] ? "" : ",",
+                             formatClock(clock[0], entry->departure), formatClock(clock[1], entry->arrival), minutes);
+                break;
+            case ROUTE_BINARY:
+            {
+                // One record per departure, from the origin straight to the destination
+                appendRouteRecord(out, ROUTE_OK, ROUTE_PRIORITY_TIMETABLE, from, to, minutes, -1, entry->departure, entry->arrival, 2);
+                uint32_t ends[2] = {(uint32_t)from, (uint32_t)to};
+                appendBytes(out, ends, sizeof(ends));
+                break;
+            }
+            }
+        }
+        if (defaultRouteFormat == ROUTE_JSON)
+        {
+            appendString(out, "]}\n");
+        }
+        return;
+    }
+
+    int arrival = from == to ? INT_MAX : csaEarliestArrival(timetable, workspace, from, to, router->departure);
+    if (arrival == INT_MAX)
+    {
+        renderRouteStatus(out, ROUTE_UNREACHABLE, from, to, ROUTE_PRIORITY_TIMETABLE);
+        return;
+    }
+
+    // Legs are collected from the target back to the start: each is the
+    // boarding connection of a trip and the connection that left it
+    int numLegs = 0;
+    for (int station = to; station != from;)
+    {
+        int last = csa->inConnection[station];
+        int first = csa->tripBoarded[timetable->connections[last].trip];
+        int *legs = reserveRouteStations(out, numLegs * 2 + 2);
+        legs[numLegs * 2] = first;
+        legs[numLegs * 2 + 1] = last;
+        numLegs++;
+        station = timetable->connections[first].from;
+    }
+    const int *legs = out->stations;
+    int minutes = (arrival - router->departure) / 60;
+
+    switch (defaultRouteFormat)
+    {
+    case ROUTE_TEXT:
+        appendString(out, "Route: ");
+        appendString(out, stationName(metro, from));
+        for (int l = numLegs - 1; l >= 0; l--)
+        {
+            appendString(out, " -> ");
+            appendString(out, stationName(metro, timetable->connections[legs[l * 2 + 1]].to));
+        }
+        appendString(out, "\n");
+        for (int l = numLegs - 1; l >= 0; l--)
+        {
+            const TimetableConnection *first = &timetable->connections[legs[l * 2]];
+            const TimetableConnection *last = &timetable->connections[legs[l * 2 + 1]];
+            appendFormat(out, "%s: %s %s -> %s %s\n", tripLine(timetable, first->trip), stationName(metro, first->from),
+                         formatClock(clock[0], first->departure), stationName(metro, last->to), formatClock(clock[1], last->arrival));
+        }
+        appendFormat(out, "Total Time: %d minutes (leave %s, arrive %s)\n", minutes,
+                     formatClock(clock[0], router->departure), formatClock(clock[1], arrival));
+        break;
+    case ROUTE_JSON:
+        appendJsonHeader(out, ROUTE_OK, ROUTE_PRIORITY_TIMETABLE, from, to);
+        appendFormat(out, ",\"departure\":\"%s\",\"arrival\":\"%s\",\"total_time\":%d,\"legs\":[",
+                     formatClock(clock[0], router->departure), formatClock(clock[1], arrival), minutes);
+        for (int l = numLegs - 1; l >= 0; l--)
+        {
+            const TimetableConnection *first = &timetable->connections[legs[l * 2]];
+            const TimetableConnection *last = &timetable->connections[legs[l * 2 + 1]];
+            appendString(out, l == numLegs - 1 ? "{\"line\":" : ",{\"line\":");
+            appendJsonString(out, tripLine(timetable, first->trip));
+            appendFormat(out, ",\"from\":%d,\"to\":%d,\"departure\":\"%s\",\"arrival\":\"%s\"}", first->from, last->to,
+                         formatClock(clock[0], first->departure), formatClock(clock[1], last->arrival));
+        }
+        appendString(out, "]}\n");
+        break;
+    case ROUTE_BINARY:
+    {
+        // The stations are the origin and every station a leg ends at
+        appendRouteRecord(out, ROUTE_OK, ROUTE_PRIORITY_TIMETABLE, from, to, minutes, -1, router->departure, arrival, numLegs + 1);
+        uint32_t id = (uint32_t)from;
+        appendBytes(out, &id, sizeof(id));
+        for (int l = numLegs - 1; l >= 0; l--)
+        {
+            id = (uint32_t)timetable->connections[legs[l * 2 + 1]].to;
+            appendBytes(out, &id, sizeof(id));
+        }
+        break;
+    }
+    }
+}
+
+// Dijkstra answer for one priority through the tree cache: a repeat origin
+// only walks its cached tree, a miss grows the full tree and caches it
+void renderCachedTreeRoute(TreeCache *cache, const MetroSystem *metro, SearchWorkspace *workspace, int *distances, int *previous,
+                           int from, int to, int priority, RouteBuffer *out)
+{
+    int tree = acquireCachedTree(cache, from, priority);
+    if (tree != -1)
+    {
+        renderRoute(out, metro, cache->trees[tree].previous, from, to, priority);
+        releaseCachedTree(cache, tree);
+        return;
+    }
+    dijkstraSearch(metro, workspace, from, -1, distances, previous, priority);
+    storeCachedTree(cache, from, priority, distances, previous);
+    renderRoute(out, metro, previous, from, to, priority);
+    resetSearchArrays(workspace, distances, previous);
+}
+
+// Alternative routes by the via-station method. With a full tree from each
+// end, every station v stands for the route origin -> v -> destination. The
+// cheapest of those that visit no station twice, cost at most
+// (1 + alternativeStretch) times the best route and share at most
+// alternativeOverlap of their cost with the routes already chosen become the
+// alternatives. Stations on a chosen route are not tried as via stations:
+// their via route is that route again.
+int alternativeCount = 0;
+double alternativeOverlap = 0.6;
+double alternativeStretch = 0.4;
+
+unsigned nextAlternativeStamp(unsigned *marks, unsigned *stamp, int numStations)
+{
+    if (++*stamp == 0)
+    {
+        memset(marks, 0, (size_t)numStations * sizeof(unsigned));
+        *stamp = 1;
+    }
+    return *stamp;
+}
+
+int compareCandidates(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Writes the route through via, origin first, to workspace->path. Returns
+// its length, or 0 when the two halves meet before via and it would loop.
+int viaRoute(AlternativeWorkspace *workspace, const int *fromPrevious, const int *toPrevious, int via)
+{
+    unsigned stamp = nextAlternativeStamp(workspace->marks, &workspace->markStamp, workspace->numStations);
+    int *path = workspace->path;
+    int length = 0;
+    for (int station = via; station != -1; station = fromPrevious[station])
+    {
+        workspace->marks[station] = stamp;
+        path[length++] = station;
+    }
+    for (int i = 0, j = length - 1; i < j; i++, j--)
+    {
+        int station = path[i];
+        path[i] = path[j];
+        path[j] = station;
+    }
+    for (int station = toPrevious[via]; station != -1; station = toPrevious[station])
+    {
+        if (workspace->marks[station] == stamp)
+        {
+            return 0;
+        }
+        workspace->marks[station] = stamp;
+        path[length++] = station;
+    }
+    return length;
+}
+
+// Cost of the connections workspace->path shares with the chosen routes, in
+// either direction; stops counting once it exceeds limit
+double sharedCost(const AlternativeWorkspace *workspace, const MetroSystem *metro, const int *weights, int length, int numRoutes, double limit)
+{
+    double shared = 0;
+    for (int i = 1; i < length && shared <= limit; i++)
+    {
+        int x = workspace->path[i - 1], y = workspace->path[i];
+        for (int r = 0; r < numRoutes; r++)
+        {
+            if (workspace->successor[r][x] == y || workspace->successor[r][y] == x)
+            {
+                shared += weights[findArc(metro, x, y)];
+                break;
+            }
+        }
+    }
+    return shared;
+}
+
+void chooseRoute(AlternativeWorkspace *workspace, int route, int length)
+{
+    memcpy(workspace->routes[route], workspace->path, (size_t)length * sizeof(int));
+    workspace->routeLengths[route] = length;
+    for (int i = 0; i < length; i++)
+    {
+        workspace->successor[route][workspace->path[i]] = i + 1 < length ? workspace->path[i + 1] : -1;
+        workspace->onRoute[workspace->path[i]] = workspace->routeStamp;
+    }
+}
+
+// Renders the best route for priority and then up to alternativeCount
+// alternatives. The trees from both ends come from the route table, the
+// tree cache or two full searches; the network is undirected, so the tree
+// from the destination holds every station's way there.
+void answerAlternatives(const Router *router, SearchWorkspace *workspace, int from, int to, int priority, RouteBuffer *out)
+{
+    const MetroSystem *metro = router->metro;
+    AlternativeWorkspace *alternatives = &workspace->alternatives;
+    if (alternatives->numStations == 0)
+    {
+        initializeAlternativeWorkspace(alternatives, metro->numStations);
+    }
+    int n = metro->numStations;
+
+    const int *distances[2], *previous[2];
+    int ends[2] = {from, to}, cached[2] = {-1, -1};
+    for (int end = 0; end < 2; end++)
+    {
+        int origin = ends[end];
+        if (router->table != NULL)
+        {
+            distances[end] = router->table->distances[priority] + (size_t)origin * n;
+            previous[end] = router->table->previous[priority] + (size_t)origin * n;
+            continue;
+        }
+        if (router->trees != NULL && (cached[end] = acquireCachedTree(router->trees, origin, priority)) != -1)
+        {
+            distances[end] = router->trees->trees[cached[end]].distances;
+            previous[end] = router->trees->trees[cached[end]].previous;
+            continue;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            alternatives->distances[end][i] = INT_MAX;
+            alternatives->previous[end][i] = -1;
+        }
+        dijkstraSearch(metro, workspace, origin, -1, alternatives->distances[end], alternatives->previous[end], priority);
+        if (router->trees != NULL)
+        {
+            storeCachedTree(router->trees, origin, priority, alternatives->distances[end], alternatives->previous[end]);
+        }
+        distances[end] = alternatives->distances[end];
+        previous[end] = alternatives->previous[end];
+    }
+
+    renderRoute(out, metro, previous[0], from, to, priority);
+    int best = distances[0][to];
+    if (best != INT_MAX && from != to)
+    {
+        const int *weights = arcWeights(metro, priority);
+        double limit = best * (1.0 + alternativeStretch);
+        int numCandidates = 0;
+        for (int station = 0; station < n; station++)
+        {
+            if (distances[0][station] != INT_MAX && distances[1][station] != INT_MAX &&
+                (double)distances[0][station] + distances[1][station] <= limit)
+            {
+                uint64_t cost = (uint64_t)distances[0][station] + (uint64_t)distances[1][station];
+                alternatives->candidates[numCandidates++] = cost << 32 | (uint32_t)station;
+            }
+        }
+        qsort(alternatives->candidates, (size_t)numCandidates, sizeof(uint64_t), compareCandidates);
+
+        // Route 0 is the best route itself: the via route through the destination
+        nextAlternativeStamp(alternatives->onRoute, &alternatives->routeStamp, n);
+        int numRoutes = 0;
+        chooseRoute(alternatives, numRoutes++, viaRoute(alternatives, previous[0], previous[1], to));
+        for (int c = 0; c < numCandidates && numRoutes <= alternativeCount; c++)
+        {
+            int via = (int)(alternatives->candidates[c] & UINT32_MAX);
+            double cost = (double)(alternatives->candidates[c] >> 32);
+            if (alternatives->onRoute[via] == alternatives->routeStamp)
+            {
+                continue;
+            }
+            int length = viaRoute(alternatives, previous[0], previous[1], via);
+            if (length == 0 || sharedCost(alternatives, metro, weights, length, numRoutes, alternativeOverlap * cost) > alternativeOverlap * cost)
+            {
+                continue;
+            }
+            chooseRoute(alternatives, numRoutes++, length);
+
+            setPathPrevious(alternatives->path, length, alternatives->render);
+            if (defaultRouteFormat == ROUTE_TEXT)
+            {
+                appendString(out, "Alternative ");
+            }
+            renderRoute(out, metro, alternatives->render, from, to, priority);
+            clearPathPrevious(alternatives->path, length, alternatives->render);
+        }
+
+        for (int r = 0; r < numRoutes; r++)
+        {
+            for (int i = 0; i < alternatives->routeLengths[r]; i++)
+            {
+                alternatives->successor[r][alternatives->routes[r][i]] = -1;
+            }
+        }
+    }
+
+    for (int end = 0; end < 2; end++)
+    {
+        if (cached[end] != -1)
+        {
+            releaseCachedTree(router->trees, cached[end]);
+        }
+    }
+}
+
+// Answers one origin/destination pair from the static network, from the
+// route table when one is loaded, for the priorities in the mask (QUERY_TIME,
+// QUERY_PRICE); time comes first. distances/previous must be fully reset on
+// entry and are left reset on return.
+void answerStaticQuery(const Router *router, SearchWorkspace *workspace, int *distances, int *previous, int from, int to, int priorities, RouteBuffer *out)
+{
+    const MetroSystem *metro = router->metro;
+    const RouteTable *table = router->table;
+    int valid = from >= 0 && from < metro->numStations && to >= 0 && to < metro->numStations;
+
+    if (valid && table == NULL && alternativeCount == 0)
+    {
+        switch (defaultEngine)
+        {
+        case ENGINE_PARETO:
+            answerParetoQuery(metro, workspace, previous, from, to, priorities, out);
+            return;
+        case ENGINE_CH:
+            if (router->live != NULL && router->live->hierarchiesStale)
+            {
+                break;
+            }
+            answerChQuery(router, workspace, previous, from, to, priorities, out);
+            return;
+        case ENGINE_ALT:
+            answerAltQuery(router, workspace, previous, from, to, priorities, out);
+            return;
+        case ENGINE_DENSE:
+            answerDenseQuery(router, workspace, from, to, priorities, out);
+            return;
+        case ENGINE_DIJKSTRA:
+            break;
+        }
+    }
+
+    for (int priority = 0; priority < 2; priority++)
+    {
+        if (!(priorities & (1 << priority)))
+        {
+            continue;
+        }
+        if (priority == 1 && (priorities & QUERY_TIME))
+        {
+            separateRoutes(out);
+        }
+        if (!valid)
+        {
+            renderRouteStatus(out, ROUTE_INVALID, from, to, priority);
+        }
+        else if (alternativeCount > 0)
+        {
+            answerAlternatives(router, workspace, from, to, priority, out);
+        }
+        else if (table != NULL)
+        {
+            renderRoute(out, metro, table->previous[priority] + (size_t)from * table->numStations, from, to, priority);
+        }
+        else if (router->trees != NULL)
+        {
+            renderCachedTreeRoute(router->trees, metro, workspace, distances, previous, from, to, priority, out);
+        }
+        else
+        {
+            dijkstraSearch(metro, workspace, from, to, distances, previous, priority);
+            renderRoute(out, metro, previous, from, to, priority);
+            resetSearchArrays(workspace, distances, previous);
+        }
+    }
+}
+
+// Answers one origin/destination pair from the line graph for the priorities
+// in the mask, in time, price, transfers order
+void answerLineQuery(const Router *router, SearchWorkspace *workspace, int from, int to, int priorities, RouteBuffer *out)
+{
+    const LineGraph *lines = router->lines;
+    int valid = from >= 0 && from < lines->numStations && to >= 0 && to < lines->numStations;
+    int answered = 0;
+    for (int priority = 0; priority < 3; priority++)
+    {
+        if (!(priorities & (1 << priority)))
+        {
+            continue;
+        }
+        if (answered++ > 0)
+        {
+            separateRoutes(out);
+        }
+        if (!valid)
+        {
+            renderRouteStatus(out, ROUTE_INVALID, from, to, lineRecordPriority(priority));
+            continue;
+        }
+        int end = lineSearch(lines, workspace, from, to, priority);
+        LineWorkspace *scratch = workspace->lines;
+        renderLineRoute(out, router->metro, lines, scratch->previous, from, to, end, priority);
+        resetSearchArrays(&scratch->search, scratch->distances, scratch->previous);
+    }
+}
+
+// Appends the answer for one origin/destination pair to out; with a timetable
+// loaded the time priority comes from the schedule instead of running times,
+// and with a line graph everything comes from it
+void answerQuery(const Router *router, SearchWorkspace *workspace, int *distances, int *previous, int from, int to, int priorities, RouteBuffer *out)
+{
+    if (router->live != NULL)
+    {
+        pthread_rwlock_rdlock(&router->live->lock);
+    }
+    QueryMetrics query;
+    beginQueryMetrics(&query, workspace);
+    int valid = from >= 0 && from < router->metro->numStations && to >= 0 && to < router->metro->numStations;
+    if (router->lines != NULL)
+    {
+        answerLineQuery(router, workspace, from, to, priorities, out);
+    }
+    else if (router->timetable != NULL && valid && (priorities & QUERY_TIME))
+    {
+        answerTimetableQuery(router, workspace, from, to, out);
+        if (priorities & QUERY_PRICE)
+        {
+            separateRoutes(out);
+            answerStaticQuery(router, workspace, distances, previous, from, to, QUERY_PRICE, out);
+        }
+    }
+    else
+    {
+        answerStaticQuery(router, workspace, distances, previous, from, to, priorities, out);
+    }
+    endQueryMetrics(&query, workspace, priorities);
+    if (router->live != NULL)
+    {
+        pthread_rwlock_unlock(&router->live->lock);
+    }
+}
+
+typedef struct
+{
+    int station;
+    int cost;
+    uint32_t color;
+} ReachedStation;
+
+// Answer of one isochrone or one-to-many query, reused across queries:
+// reached stations grouped by line colour (in order of the colours' first
+// appearance in the network) and by increasing cost within a group, plus the
+// requested destinations that are out of reach and those that are not
+// station ids at all
+typedef struct
+{
+    ReachedStation *stations;
+    int numStations;
+    int stationCapacity;
+    int *missing;
+    int numMissing;
+    int missingCapacity;
+    int *invalid;
+    int numInvalid;
+    int invalidCapacity;
+} Isochrone;
+
+void freeIsochrone(Isochrone *isochrone)
+{
+    free(isochrone->stations);
+    free(isochrone->missing);
+    free(isochrone->invalid);
+    memset(isochrone, 0, sizeof(*isochrone));
+}
+
+int compareReachedStations(const void *a, const void *b)
+{
+    const ReachedStation *x = a, *y = b;
+    if (x->color != y->color)
+        return x->color < y->color ? -1 : 1;
+    if (x->cost != y->cost)
+        return x->cost < y->cost ? -1 : 1;
+    return (x->station > y->station) - (x->station < y->station);
+}
+
+void addReachedStation(Isochrone *isochrone, const MetroSystem *metro, int station, int cost)
+{
+    if (isochrone->numStations == isochrone->stationCapacity)
+    {
+        isochrone->stationCapacity = isochrone->stationCapacity ? isochrone->stationCapacity * 2 : 64;
+        isochrone->stations = checkedRealloc(isochrone->stations, (size_t)isochrone->stationCapacity * sizeof(ReachedStation));
+    }
+    ReachedStation *reached = &isochrone->stations[isochrone->numStations++];
+    reached->station = station;
+    reached->cost = cost;
+    reached->color = metro->stations[station].color;
+}
+
+void appendStationId(int **ids, int *count, int *capacity, int station)
+{
+    if (*count == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        *ids = checkedRealloc(*ids, (size_t)*capacity * sizeof(int));
+    }
+    (*ids)[(*count)++] = station;
+}
+
+// One search from origin pruned at budget (INT_MAX for none). Without
+// destinations every station within the budget is reported, the origin
+// included; otherwise only the destinations, as given. distances/previous
+// must be fully reset on entry and are left reset on return.
+void isochroneSearch(const MetroSystem *metro, SearchWorkspace *workspace, int *distances, int *previous, int origin, int priority, int budget,
+                     const int *destinations, int numDestinations, Isochrone *isochrone)
+{
+    isochrone->numStations = 0;
+    isochrone->numMissing = 0;
+    isochrone->numInvalid = 0;
+    dijkstraSearchWithin(metro, workspace, origin, -1, budget, distances, previous, priority);
+
+    if (numDestinations == 0)
+    {
+        for (int t = 0; t < workspace->numTouched; t++)
+        {
+            addReachedStation(isochrone, metro, workspace->touched[t], distances[workspace->touched[t]]);
+        }
+    }
+    for (int d = 0; d < numDestinations; d++)
+    {
+        int station = destinations[d];
+        if (station < 0 || station >= metro->numStations)
+            appendStationId(&isochrone->invalid, &isochrone->numInvalid, &isochrone->invalidCapacity, station);
+        else if (distances[station] == INT_MAX)
+            appendStationId(&isochrone->missing, &isochrone->numMissing, &isochrone->missingCapacity, station);
+        else
+            addReachedStation(isochrone, metro, station, distances[station]);
+    }
+    resetSearchArrays(workspace, distances, previous);
+    if (isochrone->numStations > 1)
+    {
+        qsort(isochrone->stations, (size_t)isochrone->numStations, sizeof(ReachedStation), compareReachedStations);
+    }
+}
+
+// Renders an isochrone in defaultRouteFormat. Text has one block per colour;
+// JSON one object with a group per colour; binary a RouteRecord with to = -1
+// and the budget as the matching total, whose station ids are followed by as
+// many int32 costs, -1 for destinations out of reach and -2 for invalid ids.
+void renderIsochrone(RouteBuffer *out, const MetroSystem *metro, const Isochrone *isochrone, int origin, int priority, int budget)
+{
+    static const char *const units[2] = {"minutes", "rupees"};
+    const ReachedStation *stations = isochrone->stations;
+    int count = isochrone->numStations;
+    uint64_t phaseStart = metricsPhaseStart();
+
+    switch (defaultRouteFormat)
+    {
+    case ROUTE_TEXT:
+        appendString(out, "Reachable from ");
+        appendString(out, stationName(metro, origin));
+        if (budget != INT_MAX)
+        {
+            appendFormat(out, " within %d %s", budget, units[priority]);
+        }
+        appendFormat(out, ": %d stations\n", count);
+        for (int i = 0; i < count; i++)
+        {
+            if (i == 0 || stations[i].color != stations[i - 1].color)
+            {
+                appendString(out, stationColor(metro, stations[i].station));
+                appendString(out, ":\n");
+            }
+            appendString(out, "  ");
+            appendString(out, stationName(metro, stations[i].station));
+            appendString(out, " ");
+            appendInt(out, stations[i].cost);
+            appendString(out, "\n");
+        }
+        if (isochrone->numMissing > 0)
+        {
+            appendString(out, "Out of reach:");
+            for (int m = 0; m < isochrone->numMissing; m++)
+            {
+                appendString(out, m == 0 ? " " : ", ");
+                appendString(out, stationName(metro, isochrone->missing[m]));
+            }
+            appendString(out, "\n");
+        }
+        if (isochrone->numInvalid > 0)
+        {
+            appendString(out, "Invalid station ids:");
+            for (int m = 0; m < isochrone->numInvalid; m++)
+            {
+                appendString(out, m == 0 ? " " : ", ");
+                appendInt(out, isochrone->invalid[m]);
+            }
+            appendString(out, "\n");
+        }
+        break;
+    case ROUTE_JSON:
+        appendString(out, "{\"origin\":");
+        appendInt(out, origin);
+        appendString(out, priority == 0 ? ",\"priority\":\"time\",\"budget\":" : ",\"priority\":\"price\",\"budget\":");
+        if (budget == INT_MAX)
+            appendString(out, "null");
+        else
+            appendInt(out, budget);
+        appendString(out, ",\"status\":\"ok\",\"groups\":[");
+        for (int i = 0; i < count; i++)
+        {
+            int opens = i == 0 || stations[i].color != stations[i - 1].color;
+            if (opens)
+            {
+                appendString(out, i == 0 ? "{\"color\":" : "]},{\"color\":");
+                appendJsonString(out, stationColor(metro, stations[i].station));
+                appendString(out, ",\"stations\":[");
+            }
+            appendString(out, opens ? "{\"id\":" : ",{\"id\":");
+            appendInt(out, stations[i].station);
+            appendString(out, ",\"name\":");
+            appendJsonString(out, stationName(metro, stations[i].station));
+            appendString(out, ",\"cost\":");
+            appendInt(out, stations[i].cost);
+            appendString(out, "}");
+        }
+        appendString(out, count > 0 ? "]}],\"out_of_reach\":[" : "],\"out_of_reach\":[");
+        for (int m = 0; m < isochrone->numMissing; m++)
+        {
+            if (m > 0)
+            {
+                appendString(out, ",");
+            }
+            appendInt(out, isochrone->missing[m]);
+        }
+        appendString(out, "],\"invalid\":[");
+        for (int m = 0; m < isochrone->numInvalid; m++)
+        {
+            if (m > 0)
+            {
+                appendString(out, ",");
+            }
+            appendInt(out, isochrone->invalid[m]);
+        }
+        appendString(out, "]}\n");
+        break;
+    case ROUTE_BINARY:
+    {
+        int limit = budget == INT_MAX ? -1 : budget;
+        int unreached = count + isochrone->numMissing;
+        int total = unreached + isochrone->numInvalid;
+        appendRouteRecord(out, ROUTE_OK, priority, origin, -1, priority == 0 ? limit : -1, priority == 1 ? limit : -1, -1, -1, total);
+        for (int i = 0; i < total; i++)
+        {
+            uint32_t id = (uint32_t)(i < count ? stations[i].station : i < unreached ? isochrone->missing[i - count] : isochrone->invalid[i - unreached]);
+            appendBytes(out, &id, sizeof(id));
+        }
+        for (int i = 0; i < total; i++)
+        {
+            int32_t cost = i < count ? stations[i].cost : i < unreached ? -1 : -2;
+            appendBytes(out, &cost, sizeof(cost));
+        }
+        break;
+    }
+    }
+    metricsPhaseEnd(PHASE_RENDER, phaseStart);
+}
+
+// Allocates the per-thread query scratch: a search workspace plus reset
+// distances/previous arrays
+void initializeQueryScratch(const MetroSystem *metro, SearchWorkspace *workspace, int **distances, int **previous)
+{
+    initializeSearchWorkspace(workspace, metro, defaultQueueKind);
+    *distances = checkedRealloc(NULL, (size_t)(metro->numStations > 0 ? metro->numStations : 1) * sizeof(int));
+    *previous = checkedRealloc(NULL, (size_t)(metro->numStations > 0 ? metro->numStations : 1) * sizeof(int));
+    for (int i = 0; i < metro->numStations; i++)
+    {
+        (*distances)[i] = INT_MAX;
+        (*previous)[i] = -1;
+    }
+}
+
+#define BATCH_CHUNK_SIZE 65536
+#define BATCH_GRAIN 64
+
+typedef struct BatchPool BatchPool;
+
+// Each worker owns its search scratch and output arena for the lifetime of
+// the pool; a chunk's answers stay in the arenas until they are written
+typedef struct
+{
+    BatchPool *pool;
+    pthread_t thread;
+    SearchWorkspace workspace;
+    int *distances;
+    int *previous;
+    RouteBuffer output;
+    Isochrone isochrone;
+} BatchWorker;
+
+// An isochrone chunk: query q searches from origins[q] and asks for
+// destinations[starts[q]] up to destinations[starts[q + 1]], or for every
+// station within budget when that range is empty
+typedef struct
+{
+    const int *origins;
+    const int *starts;
+    const int *destinations;
+    int priority;
+    int budget;
+} IsochroneJob;
+
+struct BatchPool
+{
+    const Router *router;
+    BatchWorker *workers;
+    int numWorkers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+    unsigned generation;
+    int running;
+    int stopping;
+
+    // Current chunk; workers claim BATCH_GRAIN queries at a time through next.
+    // It holds origin/destination pairs, or isochrones when that is set.
+    const int *from;
+    const int *to;
+    const IsochroneJob *isochrones;
+    int count;
+    atomic_int next;
+
+    // Where each answer of the chunk was rendered: worker and arena span
+    int *owners;
+    size_t *offsets;
+    size_t *lengths;
+};
+
+void answerBatchIsochrone(BatchWorker *worker, int q)
+{
+    const MetroSystem *metro = worker->pool->router->metro;
+    const IsochroneJob *job = worker->pool->isochrones;
+    int origin = job->origins[q];
+    QueryMetrics query;
+    beginQueryMetrics(&query, &worker->workspace);
+    if (origin < 0 || origin >= metro->numStations)
+    {
+        renderRouteStatus(&worker->output, ROUTE_INVALID, origin, -1, job->priority);
+    }
+    else
+    {
+        LiveNetwork *live = worker->pool->router->live;
+        if (live != NULL)
+        {
+            pthread_rwlock_rdlock(&live->lock);
+        }
+        isochroneSearch(metro, &worker->workspace, worker->distances, worker->previous, origin, job->priority, job->budget,
+                        job->destinations + job->starts[q], job->starts[q + 1] - job->starts[q], &worker->isochrone);
+        if (live != NULL)
+        {
+            pthread_rwlock_unlock(&live->lock);
+        }
+        renderIsochrone(&worker->output, metro, &worker->isochrone, origin, job->priority, job->budget);
+    }
+    endQueryMetrics(&query, &worker->workspace, 1 << job->priority);
+}
+
+void *batchWorkerMain(void *arg)
+{
+    BatchWorker *worker = arg;
+    BatchPool *pool = worker->pool;
+    unsigned seen = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stopping)
+        {
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+        if (pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        worker->output.size = 0;
+        for (;;)
+        {
+            int begin = atomic_fetch_add(&pool->next, BATCH_GRAIN);
+            if (begin >= pool->count)
+            {
+                break;
+            }
+            int end = begin + BATCH_GRAIN < pool->count ? begin + BATCH_GRAIN : pool->count;
+            for (int q = begin; q < end; q++)
+            {
+                pool->owners[q] = (int)(worker - pool->workers);
+                pool->offsets[q] = worker->output.size;
+                if (pool->isochrones != NULL)
+                {
+                    answerBatchIsochrone(worker, q);
+                }
+                else
+                {
+                    answerQuery(pool->router, &worker->workspace, worker->distances, worker->previous,
+                                pool->from[q], pool->to[q], defaultPriorities(pool->router), &worker->output);
+                }
+                pool->lengths[q] = worker->output.size - pool->offsets[q];
+            }
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+        {
+            pthread_cond_signal(&pool->workDone);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void startBatchPool(BatchPool *pool, const Router *router, int numWorkers)
+{
+    const MetroSystem *metro = router->metro;
+    memset(pool, 0, sizeof(*pool));
+    pool->router = router;
+    pool->numWorkers = numWorkers;
+    pool->workers = calloc((size_t)numWorkers, sizeof(BatchWorker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->workDone, NULL);
+    atomic_init(&pool->next, 0);
+    pool->owners = checkedRealloc(NULL, BATCH_CHUNK_SIZE * sizeof(int));
+    pool->offsets = checkedRealloc(NULL, BATCH_CHUNK_SIZE * sizeof(size_t));
+    pool->lengths = checkedRealloc(NULL, BATCH_CHUNK_SIZE * sizeof(size_t));
+
+    for (int w = 0; w < numWorkers; w++)
+    {
+        BatchWorker *worker = &pool->workers[w];
+        worker->pool = pool;
+        initializeQueryScratch(metro, &worker->workspace, &worker->distances, &worker->previous);
+        initializeRouteBuffer(&worker->output);
+        pthread_create(&worker->thread, NULL, batchWorkerMain, worker);
+    }
+}
+
+// Hands the chunk (at most BATCH_CHUNK_SIZE queries) to the workers and
+// blocks until every query in it is answered: pairs, or with isochrones set
+// isochrone queries
+void runBatchChunk(BatchPool *pool, const int *from, const int *to, const IsochroneJob *isochrones, int count)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->from = from;
+    pool->to = to;
+    pool->isochrones = isochrones;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    pool->running = pool->numWorkers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->workReady);
+    while (pool->running > 0)
+    {
+        pthread_cond_wait(&pool->workDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void stopBatchPool(BatchPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int w = 0; w < pool->numWorkers; w++)
+    {
+        BatchWorker *worker = &pool->workers[w];
+        pthread_join(worker->thread, NULL);
+        freeSearchWorkspace(&worker->workspace);
+        free(worker->distances);
+        free(worker->previous);
+        freeRouteBuffer(&worker->output);
+        freeIsochrone(&worker->isochrone);
+    }
+    free(pool->workers);
+    free(pool->owners);
+    free(pool->offsets);
+    free(pool->lengths);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_cond_destroy(&pool->workDone);
+}
+
+int defaultThreadCount(void)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 0 ? (int)cores : 1;
+}
+
+// Writes the answers of the last chunk in query order; text answers are
+// separated by blank lines
+void writeBatchAnswers(const BatchPool *pool, int count, FILE *output, long *answered)
+{
+    for (int q = 0; q < count; q++)
+    {
+        if ((*answered)++ > 0 && defaultRouteFormat == ROUTE_TEXT)
+        {
+            fputc('\n', output);
+        }
+        fwrite(pool->workers[pool->owners[q]].output.data + pool->offsets[q], 1, pool->lengths[q], output);
+    }
+}
+
+// Streams every pair in inputPath through the worker pool a chunk at a time and
+// writes one answer per pair to outputPath in input order; text answers are
+// separated by blank lines
+int runBatch(const Router *router, const char *inputPath, const char *outputPath, int numThreads)
+{
+    FILE *input = fopen(inputPath, "r");
+    if (input == NULL)
+    {
+        perror("Error opening file");
+        return EXIT_FAILURE;
+    }
+    FILE *output = fopen(outputPath, "w");
+    if (output == NULL)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        fclose(input);
+        return EXIT_FAILURE;
+    }
+
+    int *from = checkedRealloc(NULL, BATCH_CHUNK_SIZE * sizeof(int));
+    int *to = checkedRealloc(NULL, BATCH_CHUNK_SIZE * sizeof(int));
+
+    BatchPool pool;
+    startBatchPool(&pool, router, numThreads);
+
+    long answered = 0;
+    for (;;)
+    {
+        int count = 0;
+        while (count < BATCH_CHUNK_SIZE && fscanf(input, "%d %d", &from[count], &to[count]) == 2)
+        {
+            count++;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+
+        runBatchChunk(&pool, from, to, NULL, count);
+        writeBatchAnswers(&pool, count, output, &answered);
+    }
+
+    stopBatchPool(&pool);
+    free(from);
+    free(to);
+    fclose(input);
+    fclose(output);
+    return 0;
+}
+
+// Isochrones for every line of inputPath, "ORIGIN [DESTINATION...]", computed
+// in parallel a chunk at a time and written to outputPath in input order. A
+// line with destinations is a one-to-many query for just those stations.
+int runIsochroneBatch(const Router *router, const char *inputPath, const char *outputPath, int numThreads, int priority, int budget)
+{
+    FILE *input = fopen(inputPath, "r");
+    if (input == NULL)
+    {
+        perror("Error opening file");
+        return EXIT_FAILURE;
+    }
+    FILE *output = fopen(outputPath, "w");
+    if (output == NULL)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        fclose(input);
+        return EXIT_FAILURE;
+    }
+
+    int *origins = checkedRealloc(NULL, BATCH_CHUNK_SIZE * sizeof(int));
+    int *starts = checkedRealloc(NULL, (BATCH_CHUNK_SIZE + 1) * sizeof(int));
+    int *destinations = NULL;
+    int destinationCapacity = 0;
+    char *line = NULL;
+    size_t lineCapacity = 0;
+
+    BatchPool pool;
+    startBatchPool(&pool, router, numThreads);
+
+    long answered = 0;
+    int more = 1;
+    while (more)
+    {
+        int count = 0, numDestinations = 0;
+        while (count < BATCH_CHUNK_SIZE && (more = (getline(&line, &lineCapacity, input) != -1)))
+        {
+            char *cursor = line, *end;
+            long origin = strtol(cursor, &end, 10);
+            if (end == cursor)
+            {
+                continue;
+            }
+            origins[count] = (int)origin;
+            starts[count] = numDestinations;
+            for (cursor = end;; cursor = end)
+            {
+                long station = strtol(cursor, &end, 10);
+                if (end == cursor)
+                {
+                    break;
+                }
+                if (numDestinations == destinationCapacity)
+                {
+                    destinationCapacity = destinationCapacity ? destinationCapacity * 2 : 1024;
+                    destinations = checkedRealloc(destinations, (size_t)destinationCapacity * sizeof(int));
+                }
+                destinations[numDestinations++] = (int)station;
+            }
+            count++;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        starts[count] = numDestinations;
+
+        IsochroneJob job = {origins, starts, destinations, priority, budget};
+        runBatchChunk(&pool, NULL, NULL, &job, count);
+        writeBatchAnswers(&pool, count, output, &answered);
+    }
+
+    stopBatchPool(&pool);
+    free(origins);
+    free(starts);
+    free(destinations);
+    free(line);
+    fclose(input);
+    fclose(output);
+    return 0;
+}
+
+// One benchmarked query: the engine's search for one priority plus rendering
+// the route into out. Dijkstra goes through the tree cache when there is one.
+void benchmarkQuery(const Router *router, SearchWorkspace *workspace, int *distances, int *previous, QueryEngine engine, int priority,
+                    int from, int to, RouteBuffer *out)
+{
+    const MetroSystem *metro = router->metro;
+    const BidirectionalWorkspace *bidirectional = &workspace->bidirectional;
+
+    switch (engine)
+    {
+    case ENGINE_PARETO:
+    {
+        int count = paretoSearch(metro, workspace, from, to);
+        int label = count == 0 ? -1 : workspace->pareto.frontier[priority == 0 ? 0 : count - 1];
+        if (label != -1)
+        {
+            setParetoPath(workspace, label, previous);
+        }
+        renderRoute(out, metro, previous, from, to, priority);
+        if (label != -1)
+        {
+            clearParetoPath(workspace, label, previous);
+        }
+        return;
+    }
+    case ENGINE_CH:
+    case ENGINE_ALT:
+        if (engine == ENGINE_CH)
+            chQuery(router->hierarchies[priority], workspace, from, to);
+        else
+            altQuery(metro, router->landmarks, workspace, from, to, priority);
+        setPathPrevious(bidirectional->path, bidirectional->pathLength, previous);
+        renderRoute(out, metro, previous, from, to, priority);
+        clearPathPrevious(bidirectional->path, bidirectional->pathLength, previous);
+        return;
+    case ENGINE_DENSE:
+        denseSearch(router->dense, workspace, from, to, priority);
+        renderRoute(out, metro, workspace->dense.previous, from, to, priority);
+        return;
+    case ENGINE_DIJKSTRA:
+        break;
+    }
+
+    if (router->trees != NULL)
+    {
+        renderCachedTreeRoute(router->trees, metro, workspace, distances, previous, from, to, priority, out);
+        return;
+    }
+    dijkstraSearch(metro, workspace, from, to, distances, previous, priority);
+    renderRoute(out, metro, previous, from, to, priority);
+    resetSearchArrays(workspace, distances, previous);
+}
+
+int compareLongLong(const void *a, const void *b)
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted latencies, in microseconds
+double latencyPercentile(const long long *sorted, int count, double percentile)
+{
+    int rank = (int)(percentile / 100.0 * count + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+// Replays numQueries pairs per query mix through each engine in the engines
+// mask (bit 1 << engine) and both priorities on one thread, and writes
+// throughput, latency percentiles and search effort as JSON to stdout. The
+// random mix draws both ends uniformly; the skewed mix models a commute peak,
+// with 80% of trips ending at one of a few hubs, and the outbound mix the
+// evening peak, with 80% starting at one. Hierarchies and landmarks are built
+// here so their preprocessing time is reported too. With a tree cache every
+// Dijkstra run starts from an empty cache and reports its hit rate.
+int runBenchmark(const Router *router, int numQueries, const char *networkName, unsigned engines)
+{
+    const MetroSystem *metro = router->metro;
+    int n = metro->numStations;
+    if (n == 0)
+    {
+        fprintf(stderr, "Error: cannot benchmark an empty network.\n");
+        return EXIT_FAILURE;
+    }
+
+    Router bench = *router;
+    ContractionHierarchy hierarchies[2];
+    LandmarkSet landmarks;
+    memset(hierarchies, 0, sizeof(hierarchies));
+    memset(&landmarks, 0, sizeof(landmarks));
+    double hierarchySeconds = 0, landmarkSeconds = 0;
+    if (engines & (1u << ENGINE_CH))
+    {
+        long long started = monotonicNanoseconds();
+        for (int priority = 0; priority < 2; priority++)
+        {
+            buildContractionHierarchy(&hierarchies[priority], metro, priority);
+            bench.hierarchies[priority] = &hierarchies[priority];
+        }
+        hierarchySeconds = (monotonicNanoseconds() - started) / 1e9;
+    }
+    if (engines & (1u << ENGINE_ALT))
+    {
+        long long started = monotonicNanoseconds();
+        buildLandmarks(&landmarks, metro, ALT_LANDMARKS);
+        bench.landmarks = &landmarks;
+        landmarkSeconds = (monotonicNanoseconds() - started) / 1e9;
+    }
+    DenseNetwork dense;
+    memset(&dense, 0, sizeof(dense));
+    double denseSeconds = 0;
+    if ((engines & (1u << ENGINE_DENSE)) && n <= DENSE_MAX_STATIONS)
+    {
+        long long started = monotonicNanoseconds();
+        if (buildDenseNetwork(&dense, metro))
+        {
+            bench.dense = &dense;
+        }
+        denseSeconds = (monotonicNanoseconds() - started) / 1e9;
+    }
+    if (bench.dense == NULL)
+    {
+        engines &= ~(1u << ENGINE_DENSE);
+    }
+
+    int numHubs = n / 100 > 4 ? n / 100 : 4;
+    int *hubs = checkedRealloc(NULL, (size_t)numHubs * sizeof(int));
+    int *pairs[3];
+    srand(7);
+    for (int h = 0; h < numHubs; h++)
+    {
+        hubs[h] = rand() % n;
+    }
+    for (int mix = 0; mix < 3; mix++)
+    {
+        pairs[mix] = checkedRealloc(NULL, (size_t)numQueries * 2 * sizeof(int));
+        for (int q = 0; q < numQueries; q++)
+        {
+            pairs[mix][q * 2] = (mix == 2 && rand() % 5 != 0) ? hubs[rand() % numHubs] : rand() % n;
+            pairs[mix][q * 2 + 1] = (mix == 1 && rand() % 5 != 0) ? hubs[rand() % numHubs] : rand() % n;
+        }
+    }
+
+    SearchWorkspace workspace;
+    initializeSearchWorkspace(&workspace, metro, defaultQueueKind);
+    initializeBidirectionalWorkspace(&workspace.bidirectional, metro);
+    int *distances = checkedRealloc(NULL, (size_t)n * sizeof(int));
+    int *previous = checkedRealloc(NULL, (size_t)n * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        distances[i] = INT_MAX;
+        previous[i] = -1;
+    }
+    long long *latencies = checkedRealloc(NULL, (size_t)(numQueries > 0 ? numQueries : 1) * sizeof(long long));
+    RouteBuffer output;
+    initializeRouteBuffer(&output);
+
+    printf("{\n  \"network\": {\"name\": \"%s\", \"stations\": %d, \"arcs\": %d},\n", networkName, n, metro->numArcs);
+    printf("  \"queue\": \"%s\",\n  \"queries\": %d,\n", queueKindName(defaultQueueKind), numQueries);
+    printf("  \"tree_cache\": %d,\n", router->trees != NULL ? router->trees->capacity : 0);
+    printf("  \"preprocessing\": {\"ch_seconds\": %.3f, \"ch_shortcuts\": [%d, %d], \"alt_seconds\": %.3f, \"alt_landmarks\": %d, "
+           "\"dense_seconds\": %.3f},\n",
+           hierarchySeconds, hierarchies[0].numShortcuts, hierarchies[1].numShortcuts, landmarkSeconds, landmarks.numLandmarks, denseSeconds);
+    printf("  \"results\": [");
+
+    static const char *const mixNames[3] = {"random", "skewed", "outbound"};
+    static const char *const priorityNames[2] = {"time", "price"};
+    int first = 1;
+    for (int e = ENGINE_DIJKSTRA; e <= ENGINE_DENSE; e++)
+    {
+        // The dense engine runs once per kernel the CPU supports
+        int lastKernel = e == ENGINE_DENSE ? DENSE_AVX2 : DENSE_SCALAR;
+        for (int kernel = DENSE_SCALAR; kernel <= lastKernel && (engines & (1u << e)); kernel++)
+        {
+            if (e == ENGINE_DENSE)
+            {
+                if (!denseKernelSupported((DenseKernel)kernel))
+                {
+                    continue;
+                }
+                setDenseKernel(&dense, (DenseKernel)kernel);
+            }
+            for (int priority = 0; priority < 2; priority++)
+            {
+                for (int mix = 0; mix < 3; mix++)
+                {
+                    if (bench.trees != NULL)
+                    {
+                        resetTreeCache(bench.trees);
+                    }
+                    long settledBefore = workspace.settledNodes, relaxedBefore = workspace.relaxedArcs;
+                    long operationsBefore = workspaceQueueOperations(&workspace);
+                    long long total = 0;
+                    for (int q = 0; q < numQueries; q++)
+                    {
+                        output.size = 0;
+                        long long start = monotonicNanoseconds();
+                        benchmarkQuery(&bench, &workspace, distances, previous, (QueryEngine)e, priority, pairs[mix][q * 2], pairs[mix][q * 2 + 1],
+                                       &output);
+                        latencies[q] = monotonicNanoseconds() - start;
+                        total += latencies[q];
+                    }
+                    qsort(latencies, (size_t)numQueries, sizeof(long long), compareLongLong);
+
+                    int count = numQueries > 0 ? numQueries : 1;
+                    printf("%s\n    {\"engine\": \"%s\", \"priority\": \"%s\", \"mix\": \"%s\", \"queries_per_second\": %.1f, "
+                           "\"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, "
+                           "\"settled_per_query\": %.1f, \"arcs_per_query\": %.1f, \"queue_operations_per_query\": %.1f",
+                           first ? "" : ",", engineName((QueryEngine)e), priorityNames[priority], mixNames[mix],
+                           total > 0 ? numQueries / (total / 1e9) : 0.0, total / 1000.0 / count,
+                           numQueries ? latencyPercentile(latencies, numQueries, 50.0) : 0.0,
+                           numQueries ? latencyPercentile(latencies, numQueries, 99.0) : 0.0,
+                           numQueries ? latencyPercentile(latencies, numQueries, 99.9) : 0.0,
+                           numQueries ? latencies[numQueries - 1] / 1000.0 : 0.0,
+                           (double)(workspace.settledNodes - settledBefore) / count, (double)(workspace.relaxedArcs - relaxedBefore) / count,
+                           (double)(workspaceQueueOperations(&workspace) - operationsBefore) / count);
+                    if (e == ENGINE_DENSE)
+                    {
+                        printf(", \"kernel\": \"%s\"", denseKernelName(dense.kernel));
+                    }
+                    if (bench.trees != NULL && e == ENGINE_DIJKSTRA)
+                    {
+                        printf(", \"cache_hit_rate\": %.3f}", bench.trees->hits / (double)(bench.trees->hits + bench.trees->misses));
+                    }
+                    else
+                    {
+                        printf("}");
+                    }
+                    first = 0;
+                }
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    freeSearchWorkspace(&workspace);
+    free(distances);
+    free(previous);
+    free(latencies);
+    freeRouteBuffer(&output);
+    free(pairs[0]);
+    free(pairs[1]);
+    free(pairs[2]);
+    free(hubs);
+    if (engines & (1u << ENGINE_ALT))
+    {
+        freeLandmarks(&landmarks);
+    }
+    if (bench.dense != NULL)
+    {
+        freeDenseNetwork(&dense);
+    }
+    if (engines & (1u << ENGINE_CH))
+    {
+        freeContractionHierarchy(&hierarchies[0]);
+        freeContractionHierarchy(&hierarchies[1]);
+    }
+    return 0;
+}
+
+typedef struct Server Server;
+typedef struct ServerConnection ServerConnection;
+
+// One request line, a query or a disruption event. It sits in the server's
+// work queue until a worker answers it, and in its connection's pending list
+// until it is written.
+typedef struct ServerRequest
+{
+    ServerConnection *connection;
+    struct ServerRequest *nextQueued;
+    struct ServerRequest *nextPending;
+    int from;
+    int to;
+    int priorities;
+    int disruption;
+    Disruption event;
+    // Owned by the request unless it was borrowed from a worker's arena,
+    // which only happens when the request can be written at once
+    char *response;
+    size_t responseLength;
+    int ownsResponse;
+    int done;
+} ServerRequest;
+
+// A client: stdin/stdout or an accepted socket. Responses leave in request
+// order; whichever thread completes the oldest pending request writes it
+// and any finished ones queued behind it.
+struct ServerConnection
+{
+    Server *server;
+    int inputFd;
+    int outputFd;
+    pthread_mutex_t lock;
+    ServerRequest *pendingHead;
+    ServerRequest *pendingTail;
+    int numPending;
+    int readerDone;
+    int failed;
+    ServerConnection *nextOpen;
+};
+
+typedef struct
+{
+    Server *server;
+    pthread_t thread;
+    SearchWorkspace workspace;
+    int *distances;
+    int *previous;
+    RouteBuffer output;
+} ServerWorker;
+
+struct Server
+{
+    const Router *router;
+    ServerWorker *workers;
+    int numWorkers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t connectionClosed;
+    ServerRequest *queueHead;
+    ServerRequest *queueTail;
+    ServerConnection *openConnections;
+    int stopping;
+    // Requests taken off the queue and not yet answered; while a disruption
+    // event is being applied it is the only one
+    int active;
+    int applyingEvent;
+};
+
+// The work queue is taken in order, and a disruption event is a barrier: it
+// starts once every request queued before it is answered, and the requests
+// queued after it wait until it is applied
+int canStartRequest(const Server *server, const ServerRequest *request)
+{
+    return request->disruption ? server->active == 0 : !server->applyingEvent;
+}
+
+// Parses "FROM TO [time|price|transfers|both]"; returns the priority mask,
+// the router's defaultPriorities without a priority, 0 if malformed
+int parseServerRequest(const Router *router, const char *line, int *from, int *to)
+{
+    char priority[16];
+    int fields = sscanf(line, "%d %d %15s", from, to, priority);
+    if (fields < 2)
+    {
+        return 0;
+    }
+    if (fields == 2)
+        return defaultPriorities(router);
+    if (strcmp(priority, "time") == 0)
+        return QUERY_TIME;
+    if (strcmp(priority, "price") == 0)
+        return QUERY_PRICE;
+    if (strcmp(priority, "transfers") == 0)
+        return QUERY_TRANSFERS;
+    if (strcmp(priority, "both") == 0)
+        return QUERY_TIME | QUERY_PRICE;
+    return 0;
+}
+
+int writeAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            return 0;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 1;
+}
+
+void closeServerConnection(ServerConnection *connection)
+{
+    Server *server = connection->server;
+    pthread_mutex_lock(&server->lock);
+    for (ServerConnection **link = &server->openConnections; *link != NULL; link = &(*link)->nextOpen)
+    {
+        if (*link == connection)
+        {
+            *link = connection->nextOpen;
+            break;
+        }
+    }
+    pthread_cond_broadcast(&server->connectionClosed);
+    pthread_mutex_unlock(&server->lock);
+
+    if (connection->inputFd != STDIN_FILENO)
+    {
+        close(connection->inputFd);
+    }
+    pthread_mutex_destroy(&connection->lock);
+    free(connection);
+}
+
+// Writes out the finished requests at the head of the pending list. Returns
+// 1 when the connection is drained and its reader is done, so the caller
+// (outside the lock) must close it.
+int flushServerConnection(ServerConnection *connection)
+{
+    while (connection->pendingHead != NULL && connection->pendingHead->done)
+    {
+        ServerRequest *request = connection->pendingHead;
+        connection->pendingHead = request->nextPending;
+        if (connection->pendingHead == NULL)
+        {
+            connection->pendingTail = NULL;
+        }
+
+        if (!connection->failed)
+        {
+            connection->failed = !writeAll(connection->outputFd, request->response, request->responseLength);
+        }
+        if (request->ownsResponse)
+        {
+            free(request->response);
+        }
+        free(request);
+        connection->numPending--;
+    }
+    return connection->readerDone && connection->numPending == 0;
+}
+
+// Ends one server response: a "." line, or a ROUTE_END record in binary
+void appendResponseEnd(RouteBuffer *out)
+{
+    if (defaultRouteFormat == ROUTE_BINARY)
+    {
+        appendRouteRecord(out, ROUTE_END, 0, -1, -1, -1, -1, -1, -1, 0);
+    }
+    else
+    {
+        appendString(out, ".\n");
+    }
+}
+
+void *serverWorkerMain(void *arg)
+{
+    ServerWorker *worker = arg;
+    Server *server = worker->server;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        ServerRequest *request;
+        while ((request = server->queueHead) != NULL ? !canStartRequest(server, request) : !server->stopping)
+        {
+            pthread_cond_wait(&server->workReady, &server->lock);
+        }
+        if (request == NULL)
+        {
+            pthread_mutex_unlock(&server->lock);
+            return NULL;
+        }
+        server->queueHead = request->nextQueued;
+        if (server->queueHead == NULL)
+        {
+            server->queueTail = NULL;
+        }
+        server->active++;
+        server->applyingEvent = request->disruption;
+        pthread_mutex_unlock(&server->lock);
+
+        // The whole answer is assembled here so the connection lock only covers one write
+        RouteBuffer *output = &worker->output;
+        output->size = 0;
+        if (request->disruption)
+        {
+            answerDisruption(server->router->live, &request->event, output);
+        }
+        else if (request->priorities == 0)
+        {
+            renderRouteStatus(output, ROUTE_MALFORMED, -1, -1, 0);
+        }
+        else
+        {
+            answerQuery(server->router, &worker->workspace, worker->distances, worker->previous, request->from, request->to,
+                        request->priorities, output);
+        }
+        appendResponseEnd(output);
+
+        // An event waits for active to reach 0, and the queries behind one for it to finish
+        pthread_mutex_lock(&server->lock);
+        server->active--;
+        if (server->active == 0 || request->disruption)
+        {
+            server->applyingEvent = 0;
+            pthread_cond_broadcast(&server->workReady);
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        ServerConnection *connection = request->connection;
+        pthread_mutex_lock(&connection->lock);
+        // The oldest pending answer is flushed below before the lock is
+        // released, so it is written straight from the arena; later ones wait
+        // in a copy
+        request->ownsResponse = connection->pendingHead != request;
+        request->response = output->data;
+        if (request->ownsResponse)
+        {
+            request->response = checkedRealloc(NULL, output->size);
+            memcpy(request->response, output->data, output->size);
+        }
+        request->responseLength = output->size;
+        request->done = 1;
+        int finished = flushServerConnection(connection);
+        pthread_mutex_unlock(&connection->lock);
+        if (finished)
+        {
+            closeServerConnection(connection);
+        }
+    }
+}
+
+// Reads request lines until end of input. Each request is queued for the
+// workers at once, so a client can pipeline any number of them. Disruption
+// events go through the same queue, where canStartRequest orders them
+// against the queries around them.
+void *serverReaderMain(void *arg)
+{
+    ServerConnection *connection = arg;
+    Server *server = connection->server;
+    pthread_detach(pthread_self());
+    FILE *input = fdopen(dup(connection->inputFd), "r");
+    char *line = NULL;
+    size_t lineCapacity = 0;
+
+    while (input != NULL && getline(&line, &lineCapacity, input) != -1)
+    {
+        if (line[0] == '\n')
+        {
+            continue;
+        }
+        ServerRequest *request = calloc(1, sizeof(ServerRequest));
+        if (request == NULL)
+        {
+            fprintf(stderr, "Error: out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+        request->connection = connection;
+        request->priorities = parseServerRequest(server->router, line, &request->from, &request->to);
+        if ((request->priorities & QUERY_TRANSFERS) && server->router->lines == NULL)
+        {
+            request->priorities = 0;
+        }
+
+        request->disruption = request->priorities == 0 && server->router->live != NULL && parseDisruption(line, &request->event);
+
+        pthread_mutex_lock(&connection->lock);
+        if (connection->pendingTail != NULL)
+            connection->pendingTail->nextPending = request;
+        else
+            connection->pendingHead = request;
+        connection->pendingTail = request;
+        connection->numPending++;
+        pthread_mutex_unlock(&connection->lock);
+
+        pthread_mutex_lock(&server->lock);
+        if (server->queueTail != NULL)
+            server->queueTail->nextQueued = request;
+        else
+            server->queueHead = request;
+        server->queueTail = request;
+        pthread_cond_signal(&server->workReady);
+        pthread_mutex_unlock(&server->lock);
+    }
+    free(line);
+    if (input != NULL)
+    {
+        fclose(input);
+    }
+
+    pthread_mutex_lock(&connection->lock);
+    connection->readerDone = 1;
+    int finished = connection->numPending == 0;
+    pthread_mutex_unlock(&connection->lock);
+    if (finished)
+    {
+        closeServerConnection(connection);
+    }
+    return NULL;
+}
+
+// Creates a thread with SIGINT/SIGTERM blocked so they reach the main thread
+void startServerThread(pthread_t *thread, void *(*body)(void *), void *arg)
+{
+    sigset_t signals, saved;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &saved);
+    pthread_create(thread, NULL, body, arg);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
+
+void openServerConnection(Server *server, int inputFd, int outputFd)
+{
+    ServerConnection *connection = calloc(1, sizeof(ServerConnection));
+    if (connection == NULL)
+    {
+        fprintf(stderr, "Error: out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    connection->server = server;
+    connection->inputFd = inputFd;
+    connection->outputFd = outputFd;
+    pthread_mutex_init(&connection->lock, NULL);
+
+    pthread_mutex_lock(&server->lock);
+    connection->nextOpen = server->openConnections;
+    server->openConnections = connection;
+    pthread_mutex_unlock(&server->lock);
+
+    pthread_t reader;
+    startServerThread(&reader, serverReaderMain, connection);
+}
+
+volatile sig_atomic_t serverInterrupted = 0;
+
+void handleServerSignal(int signal)
+{
+    (void)signal;
+    serverInterrupted = 1;
+}
+
+// Serves requests from stdin, or from every client of a Unix socket at
+// socketPath until SIGINT/SIGTERM, with numThreads workers that keep their
+// search buffers for the life of the server. Each request is one line,
+// "FROM TO [time|price|transfers|both]"; without a priority it gets the same
+// ones as output.txt, transfers included with a line graph. Its answer is the
+// route text of the requested priorities, separated by blank lines like
+// output.txt, followed by a line holding a single ".".
+int runServer(const Router *router, const char *socketPath, int numThreads)
+{
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.router = router;
+    server.numWorkers = numThreads;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.workReady, NULL);
+    pthread_cond_init(&server.connectionClosed, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = -1;
+    if (socketPath != NULL)
+    {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(address.sun_path))
+        {
+            fprintf(stderr, "Error: socket path too long: %s\n", socketPath);
+            return EXIT_FAILURE;
+        }
+        strcpy(address.sun_path, socketPath);
+
+        // Only a stale socket is removed; any other file at the path is left alone
+        struct stat info;
+        if (stat(socketPath, &info) == 0 && S_ISSOCK(info.st_mode))
+        {
+            unlink(socketPath);
+        }
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+        {
+            fprintf(stderr, "Error: cannot listen on %s: ", socketPath);
+            perror(NULL);
+            if (listener >= 0)
+            {
+                close(listener);
+            }
+            return EXIT_FAILURE;
+        }
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handleServerSignal;
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
+
+    server.workers = calloc((size_t)numThreads, sizeof(ServerWorker));
+    for (int w = 0; w < numThreads; w++)
+    {
+        ServerWorker *worker = &server.workers[w];
+        worker->server = &server;
+        initializeQueryScratch(router->metro, &worker->workspace, &worker->distances, &worker->previous);
+        initializeRouteBuffer(&worker->output);
+        startServerThread(&worker->thread, serverWorkerMain, worker);
+    }
+
+    if (listener < 0)
+    {
+        openServerConnection(&server, STDIN_FILENO, STDOUT_FILENO);
+    }
+    else
+    {
+        fprintf(stderr, "Serving on %s with %d workers\n", socketPath, numThreads);
+        while (!serverInterrupted)
+        {
+            int client = accept(listener, NULL, NULL);
+            if (client >= 0)
+            {
+                openServerConnection(&server, client, client);
+            }
+        }
+        close(listener);
+        unlink(socketPath);
+
+        // Stop reading from clients; what they already sent is still answered
+        pthread_mutex_lock(&server.lock);
+        for (ServerConnection *connection = server.openConnections; connection != NULL; connection = connection->nextOpen)
+        {
+            shutdown(connection->inputFd, SHUT_RD);
+        }
+        pthread_mutex_unlock(&server.lock);
+    }
+
+    pthread_mutex_lock(&server.lock);
+    while (server.openConnections != NULL)
+    {
+        pthread_cond_wait(&server.connectionClosed, &server.lock);
+    }
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.workReady);
+    pthread_mutex_unlock(&server.lock);
+
+    for (int w = 0; w < numThreads; w++)
+    {
+        ServerWorker *worker = &server.workers[w];
+        pthread_join(worker->thread, NULL);
+        freeSearchWorkspace(&worker->workspace);
+        free(worker->distances);
+        free(worker->previous);
+        freeRouteBuffer(&worker->output);
+    }
+    free(server.workers);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.workReady);
+    pthread_cond_destroy(&server.connectionClosed);
+    return 0;
+}
+
+typedef struct
+{
+    const char *socketPath;
+    int numStations;
+    int numRequests;
+    int pipeline;
+    unsigned seed;
+    long long *latencies;
+    int answered;
+    int failed;
+} LoadClient;
+
+// One client connection: keeps up to pipeline requests in flight and times
+// each from send to the end of its answer
+void *loadClientMain(void *arg)
+{
+    LoadClient *client = arg;
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, client->socketPath, sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        client->failed = 1;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    FILE *input = fdopen(fd, "r");
+    long long *sent = checkedRealloc(NULL, (size_t)client->pipeline * sizeof(long long));
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    static const char *const priorities[3] = {"both", "time", "price"};
+
+    int numSent = 0;
+    while (client->answered < client->numRequests && !client->failed)
+    {
+        while (numSent < client->numRequests && numSent - client->answered < client->pipeline)
+        {
+            char request[64];
+            int from = (int)(rand_r(&client->seed) % (unsigned)client->numStations);
+            int to = (int)(rand_r(&client->seed) % (unsigned)client->numStations);
+            int length = snprintf(request, sizeof(request), "%d %d %s\n", from, to, priorities[numSent % 3]);
+            sent[numSent % client->pipeline] = monotonicNanoseconds();
+            if (!writeAll(fd, request, (size_t)length))
+            {
+                client->failed = 1;
+                break;
+            }
+            numSent++;
+        }
+
+        // Read one whole answer
+        int complete = 0;
+        while (!complete && getline(&line, &lineCapacity, input) != -1)
+        {
+            complete = strcmp(line, ".\n") == 0;
+        }
+        if (!complete)
+        {
+            client->failed = 1;
+            break;
+        }
+        client->latencies[client->answered] = monotonicNanoseconds() - sent[client->answered % client->pipeline];
+        client->answered++;
+    }
+
+    free(line);
+    free(sent);
+    fclose(input);
+    return NULL;
+}
+
+// Load generator for a server on socketPath: numClients connections each
+// send numRequests random pairs with up to pipeline requests in flight,
+// cycling through both/time/price. Prints throughput and latency
+// percentiles as JSON.
+int runLoadGenerator(const char *socketPath, int numStations, int numClients, int numRequests, int pipeline)
+{
+    if (numStations == 0)
+    {
+        fprintf(stderr, "Error: the network has no stations.\n");
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    LoadClient *clients = calloc((size_t)numClients, sizeof(LoadClient));
+    pthread_t *threads = calloc((size_t)numClients, sizeof(pthread_t));
+    long long *latencies = checkedRealloc(NULL, (size_t)numClients * (size_t)numRequests * sizeof(long long));
+
+    long long started = monotonicNanoseconds();
+    for (int c = 0; c < numClients; c++)
+    {
+        LoadClient *client = &clients[c];
+        client->socketPath = socketPath;
+        client->numStations = numStations;
+        client->numRequests = numRequests;
+        client->pipeline = pipeline;
+        client->seed = (unsigned)c + 1;
+        client->latencies = latencies + (size_t)c * numRequests;
+        pthread_create(&threads[c], NULL, loadClientMain, client);
+    }
+
+    int answered = 0, failed = 0;
+    for (int c = 0; c < numClients; c++)
+    {
+        pthread_join(threads[c], NULL);
+        // Compact the answered latencies to the front
+        memmove(latencies + answered, clients[c].latencies, (size_t)clients[c].answered * sizeof(long long));
+        answered += clients[c].answered;
+        failed += clients[c].failed;
+    }
+    double seconds = (monotonicNanoseconds() - started) / 1e9;
+    qsort(latencies, (size_t)answered, sizeof(long long), compareLongLong);
+
+    printf("{\"socket\": \"%s\", \"clients\": %d, \"pipeline\": %d, \"requests\": %d, \"failed_clients\": %d, \"seconds\": %.3f, "
+           "\"requests_per_second\": %.1f, \"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f}\n",
+           socketPath, numClients, pipeline, answered, failed, seconds, seconds > 0 ? answered / seconds : 0.0,
+           answered ? latencyPercentile(latencies, answered, 50.0) : 0.0,
+           answered ? latencyPercentile(latencies, answered, 99.0) : 0.0,
+           answered ? latencyPercentile(latencies, answered, 99.9) : 0.0);
+
+    free(latencies);
+    free(threads);
+    free(clients);
+    return failed == 0 ? 0 : EXIT_FAILURE;
+}
+
+// Splits a CSV line in place into at most maxFields fields, unquoting
+// "quoted, fields" and dropping the line ending; returns the field count
+int splitCsvLine(char *line, char **fields, int maxFields)
+{
+    int count = 0;
+    char *read = line;
+    char *write = line;
+
+    while (count < maxFields)
+    {
+        fields[count++] = write;
+        if (*read == '"')
+        {
+            read++;
+            while (*read != '\0' && !(*read == '"' && read[1] != '"'))
+            {
+                if (*read == '"')
+                {
+                    read++;
+                }
+                *write++ = *read++;
+            }
+            if (*read == '"')
+            {
+                read++;
+            }
+        }
+        while (*read != '\0' && *read != ',' && *read != '\r' && *read != '\n')
+        {
+            *write++ = *read++;
+        }
+        if (*read != ',')
+        {
+            *write = '\0';
+            break;
+        }
+        *write++ = '\0';
+        read++;
+    }
+    return count;
+}
+
+#define MAX_CSV_FIELDS 32
+
+// Streams a CSV file line by line; the callback returns 0 to abort the load
+typedef int (*CsvRowHandler)(void *context, char **fields, int numFields, long lineNumber);
+
+int readCsvFile(const char *path, CsvRowHandler handler, void *context)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Error opening %s: ", path);
+        perror(NULL);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    long lineNumber = 0;
+    int ok = 1;
+    char *fields[MAX_CSV_FIELDS];
+
+    while (ok && getline(&line, &lineCapacity, file) != -1)
+    {
+        lineNumber++;
+        if (line[0] == '\n' || (line[0] == '\r' && line[1] == '\n'))
+        {
+            continue;
+        }
+        int numFields = splitCsvLine(line, fields, MAX_CSV_FIELDS);
+        ok = handler(context, fields, numFields, lineNumber);
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+// Returns the index of name in a CSV header row, or -1
+int csvColumn(char **fields, int numFields, const char *name)
+{
+    for (int i = 0; i < numFields; i++)
+    {
+        // GTFS files may start with a UTF-8 byte order mark
+        const char *field = fields[i];
+        if (i == 0 && strncmp(field, "\xEF\xBB\xBF", 3) == 0)
+        {
+            field += 3;
+        }
+        if (strcmp(field, name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *csvField(char **fields, int numFields, int column)
+{
+    return (column >= 0 && column < numFields) ? fields[column] : "";
+}
+
+typedef struct
+{
+    MetroSystem *metro;
+    const char *path;
+} CsvNetworkContext;
+
+int handleStationRow(void *context, char **fields, int numFields, long lineNumber)
+{
+    CsvNetworkContext *csv = context;
+    if (lineNumber == 1 && strcmp(fields[0], "name") == 0)
+    {
+        return 1;
+    }
+    if (numFields < 2 || fields[0][0] == '\0')
+    {
+        fprintf(stderr, "Error: %s:%ld: expected name,color\n", csv->path, lineNumber);
+        return 0;
+    }
+    addStation(csv->metro, fields[0], fields[1]);
+    return 1;
+}
+
+int handleConnectionRow(void *context, char **fields, int numFields, long lineNumber)
+{
+    CsvNetworkContext *csv = context;
+    if (lineNumber == 1 && strcmp(fields[0], "from") == 0)
+    {
+        return 1;
+    }
+
+    // The stations file is read first, so the network's size is known
+    int limit = maxConnectionWeight(csv->metro->numStations);
+    char *end;
+    long time = numFields >= 4 ? strtol(fields[2], &end, 10) : -1;
+    if (numFields < 4 || *end != '\0' || time < 0 || time > limit)
+    {
+        fprintf(stderr, "Error: %s:%ld: expected from,to,time,price with a time from 0 to %d\n", csv->path, lineNumber, limit);
+        return 0;
+    }
+    float price = strtof(fields[3], &end);
+    if (*end != '\0' || !(price >= 0 && (double)price <= limit))
+    {
+        fprintf(stderr, "Error: %s:%ld: bad price \"%s\", expected 0 to %d\n", csv->path, lineNumber, fields[3], limit);
+        return 0;
+    }
+    addConnection(csv->metro, fields[0], fields[1], (int)time, price);
+    return 1;
+}
+
+// Loads a network from two CSV files, each with an optional header row:
+//   stations:    name,color
+//   connections: from,to,time,price    (minutes, rupees; price truncated like addConnection)
+int loadNetworkCsv(MetroSystem *metro, const char *stationsPath, const char *connectionsPath)
+{
+    initializeMetroSystem(metro);
+
+    CsvNetworkContext context = {metro, stationsPath};
+    if (!readCsvFile(stationsPath, handleStationRow, &context))
+    {
+        return 0;
+    }
+    context.path = connectionsPath;
+    if (!readCsvFile(connectionsPath, handleConnectionRow, &context))
+    {
+        return 0;
+    }
+
+    finalizeMetroSystem(metro);
+    return 1;
+}
+
+enum
+{
+    SCHEDULE_LINE,
+    SCHEDULE_STATIONS,
+    SCHEDULE_DEPARTURES,
+    SCHEDULE_FIRST,
+    SCHEDULE_LAST,
+    SCHEDULE_HEADWAY
+};
+
+#define MAX_SCHEDULE_ITEMS 1024
+
+typedef struct
+{
+    Timetable *timetable;
+    const MetroSystem *metro;
+    const char *path;
+    int columns[6];
+    char *items[MAX_SCHEDULE_ITEMS];
+} ScheduleContext;
+
+// Splits a ';'-separated list in place; returns the item count, or -1 if
+// there are more than maxItems
+int splitList(char *text, char **items, int maxItems)
+{
+    int count = 0;
+    char *state = NULL;
+    for (char *item = strtok_r(text, ";", &state); item != NULL; item = strtok_r(NULL, ";", &state))
+    {
+        if (count == maxItems)
+        {
+            return -1;
+        }
+        items[count++] = item;
+    }
+    return count;
+}
+
+int handleScheduleRow(void *context, char **fields, int numFields, long lineNumber)
+{
+    ScheduleContext *schedule = context;
+    const MetroSystem *metro = schedule->metro;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"line", "stations", "departures", "first", "last", "headway"};
+        for (int c = 0; c < 6; c++)
+        {
+            schedule->columns[c] = csvColumn(fields, numFields, names[c]);
+        }
+        if (schedule->columns[SCHEDULE_LINE] == -1 || schedule->columns[SCHEDULE_STATIONS] == -1 ||
+            (schedule->columns[SCHEDULE_DEPARTURES] == -1 &&
+             (schedule->columns[SCHEDULE_FIRST] == -1 || schedule->columns[SCHEDULE_LAST] == -1 || schedule->columns[SCHEDULE_HEADWAY] == -1)))
+        {
+            fprintf(stderr, "Error: %s: expected a line,stations,departures or line,stations,first,last,headway header\n", schedule->path);
+            return 0;
+        }
+        return 1;
+    }
+
+    char **items = schedule->items;
+    int stations[MAX_SCHEDULE_ITEMS], runTimes[MAX_SCHEDULE_ITEMS];
+    int numStops = splitList((char *)csvField(fields, numFields, schedule->columns[SCHEDULE_STATIONS]), items, MAX_SCHEDULE_ITEMS);
+    if (numStops == -1)
+    {
+        fprintf(stderr, "Error: %s:%ld: a line has at most %d stations\n", schedule->path, lineNumber, MAX_SCHEDULE_ITEMS);
+        return 0;
+    }
+    for (int i = 0; i < numStops; i++)
+    {
+        stations[i] = findStation(metro, items[i]);
+        int arc = (i > 0 && stations[i] != -1) ? findArc(metro, stations[i - 1], stations[i]) : 0;
+        if (stations[i] == -1 || arc == -1)
+        {
+            fprintf(stderr, "Error: %s:%ld: %s \"%s\"\n", schedule->path, lineNumber,
+                    stations[i] == -1 ? "unknown station" : "no connection to", items[i]);
+            return 0;
+        }
+        runTimes[i] = i > 0 ? metro->times[arc] * 60 : 0;
+    }
+    if (numStops < 2)
+    {
+        fprintf(stderr, "Error: %s:%ld: a line needs at least two stations\n", schedule->path, lineNumber);
+        return 0;
+    }
+
+    int departures[MAX_SCHEDULE_ITEMS], numDepartures = 0;
+    if (schedule->columns[SCHEDULE_DEPARTURES] != -1 && csvField(fields, numFields, schedule->columns[SCHEDULE_DEPARTURES])[0] != '\0')
+    {
+        int count = splitList((char *)csvField(fields, numFields, schedule->columns[SCHEDULE_DEPARTURES]), items, MAX_SCHEDULE_ITEMS);
+        if (count == -1)
+        {
+            fprintf(stderr, "Error: %s:%ld: a line has at most %d departures\n", schedule->path, lineNumber, MAX_SCHEDULE_ITEMS);
+            return 0;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            departures[numDepartures] = parseClock(items[i]);
+            if (departures[numDepartures++] < 0)
+            {
+                fprintf(stderr, "Error: %s:%ld: bad departure time \"%s\"\n", schedule->path, lineNumber, items[i]);
+                return 0;
+            }
+        }
+    }
+    else
+    {
+        int first = parseClock(csvField(fields, numFields, schedule->columns[SCHEDULE_FIRST]));
+        int last = parseClock(csvField(fields, numFields, schedule->columns[SCHEDULE_LAST]));
+        int headway = atoi(csvField(fields, numFields, schedule->columns[SCHEDULE_HEADWAY])) * 60;
+        if (first < 0 || last < first || headway <= 0)
+        {
+            fprintf(stderr, "Error: %s:%ld: expected first,last as HH:MM and a headway in minutes\n", schedule->path, lineNumber);
+            return 0;
+        }
+        if ((last - first) / headway >= MAX_SCHEDULE_ITEMS)
+        {
+            fprintf(stderr, "Error: %s:%ld: a line has at most %d departures\n", schedule->path, lineNumber, MAX_SCHEDULE_ITEMS);
+            return 0;
+        }
+        for (int time = first; time <= last; time += headway)
+        {
+            departures[numDepartures++] = time;
+        }
+    }
+
+    const char *line = csvField(fields, numFields, schedule->columns[SCHEDULE_LINE]);
+    for (int i = 0; i < numDepartures; i++)
+    {
+        for (int direction = 0; direction < 2; direction++)
+        {
+            int trip = addTimetableTrip(schedule->timetable, line);
+            int time = departures[i];
+            for (int k = 1; k < numStops; k++)
+            {
+                int a = direction == 0 ? k - 1 : numStops - k;
+                int b = direction == 0 ? k : numStops - k - 1;
+                int run = runTimes[direction == 0 ? k : numStops - k];
+                addTimetableConnection(schedule->timetable, trip, stations[a], stations[b], time, time + run);
+                time += run;
+            }
+        }
+    }
+    return 1;
+}
+
+// Loads a line schedule for a network. The header row names the columns:
+//   line,stations,departures            explicit departure times
+//   line,stations,first,last,headway    a train every headway minutes
+// stations lists the stops in order and departures lists HH:MM times, both
+// ';'-separated. Each departure runs the line end to end in both directions
+// with the network's connection times.
+int loadSchedule(Timetable *timetable, const MetroSystem *metro, const char *path)
+{
+    ScheduleContext context = {timetable, metro, path, {0}, {0}};
+    if (!readCsvFile(path, handleScheduleRow, &context))
+    {
+        return 0;
+    }
+    finalizeTimetable(timetable);
+    return 1;
+}
+
+// Open-addressing set of unordered station pairs, used to add each GTFS segment once
+typedef struct
+{
+    uint64_t *keys;
+    size_t capacity;
+    size_t count;
+} PairSet;
+
+#define EMPTY_PAIR UINT64_MAX
+
+int insertPair(PairSet *set, int a, int b)
+{
+    if ((set->count + 1) * 2 > set->capacity)
+    {
+        uint64_t *old = set->keys;
+        size_t oldCapacity = set->capacity;
+        set->capacity = oldCapacity ? oldCapacity * 2 : 1024;
+        set->keys = checkedRealloc(NULL, set->capacity * sizeof(uint64_t));
+        for (size_t i = 0; i < set->capacity; i++)
+        {
+            set->keys[i] = EMPTY_PAIR;
+        }
+        set->count = 0;
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (old[i] != EMPTY_PAIR)
+            {
+                insertPair(set, (int)(old[i] >> 32), (int)(old[i] & 0xFFFFFFFFu));
+            }
+        }
+        free(old);
+    }
+
+    uint64_t key = a < b ? ((uint64_t)a << 32) | (uint32_t)b : ((uint64_t)b << 32) | (uint32_t)a;
+    size_t index = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 17) & (set->capacity - 1);
+    while (set->keys[index] != EMPTY_PAIR)
+    {
+        if (set->keys[index] == key)
+        {
+            return 0;
+        }
+        index = (index + 1) & (set->capacity - 1);
+    }
+    set->keys[index] = key;
+    set->count++;
+    return 1;
+}
+
+typedef struct
+{
+    uint32_t color;
+    int fare;
+} GtfsRoute;
+
+// Lookup tables shared by the GTFS file handlers. ids maps prefixed GTFS ids
+// ("r:" route, "t:" trip, "s:" stop, "f:" fare, "z:" zone pair) to their value.
+typedef struct
+{
+    MetroSystem *metro;
+    const char *path;
+    StringPool ids;
+    GtfsRoute *routes;
+    int numRoutes;
+    uint32_t *stationZones;
+    uint32_t noColor;
+    int columns[8];
+
+    PairSet segments;
+    Timetable *timetable;
+    int timetableTrip;
+    int previousTrip;
+    int previousStation;
+    int previousDeparture;
+} GtfsContext;
+
+enum
+{
+    GTFS_ROUTE_ID,
+    GTFS_ROUTE_SHORT_NAME,
+    GTFS_ROUTE_COLOR
+};
+
+enum
+{
+    GTFS_FARE_ID,
+    GTFS_FARE_PRICE
+};
+
+enum
+{
+    GTFS_RULE_FARE_ID,
+    GTFS_RULE_ROUTE_ID,
+    GTFS_RULE_ORIGIN_ID,
+    GTFS_RULE_DESTINATION_ID
+};
+
+enum
+{
+    GTFS_STOP_ID,
+    GTFS_STOP_NAME,
+    GTFS_STOP_ZONE_ID,
+    GTFS_STOP_LOCATION_TYPE
+};
+
+enum
+{
+    GTFS_TRIP_ID,
+    GTFS_TRIP_ROUTE_ID
+};
+
+enum
+{
+    GTFS_TIME_TRIP_ID,
+    GTFS_TIME_ARRIVAL,
+    GTFS_TIME_DEPARTURE,
+    GTFS_TIME_STOP_ID
+};
+
+// Reads the header row into columns[]; returns 0 if a required column is missing
+int readGtfsHeader(GtfsContext *gtfs, char **fields, int numFields, const char **names, int numNames, int numRequired)
+{
+    for (int c = 0; c < numNames; c++)
+    {
+        gtfs->columns[c] = csvColumn(fields, numFields, names[c]);
+        if (c < numRequired && gtfs->columns[c] == -1)
+        {
+            fprintf(stderr, "Error: %s has no %s column\n", gtfs->path, names[c]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void setGtfsId(GtfsContext *gtfs, const char *prefix, const char *id, int value)
+{
+    char key[1024];
+    snprintf(key, sizeof(key), "%s%s", prefix, id);
+    internString(&gtfs->ids, key)->value = value;
+}
+
+int getGtfsId(const GtfsContext *gtfs, const char *prefix, const char *id)
+{
+    char key[1024];
+    snprintf(key, sizeof(key), "%s%s", prefix, id);
+    return lookupString(&gtfs->ids, key);
+}
+
+#define GTFS_FIELD(name) csvField(fields, numFields, gtfs->columns[name])
+
+int handleGtfsRoute(void *context, char **fields, int numFields, long lineNumber)
+{
+    GtfsContext *gtfs = context;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"route_id", "route_short_name", "route_color"};
+        return readGtfsHeader(gtfs, fields, numFields, names, 3, 1);
+    }
+
+    // Prefer the short name ("Purple") the built-in network uses as its line colour
+    const char *color = GTFS_FIELD(GTFS_ROUTE_SHORT_NAME);
+    if (color[0] == '\0')
+        color = GTFS_FIELD(GTFS_ROUTE_COLOR);
+    if (color[0] == '\0')
+        color = GTFS_FIELD(GTFS_ROUTE_ID);
+
+    gtfs->routes = checkedRealloc(gtfs->routes, (size_t)(gtfs->numRoutes + 1) * sizeof(GtfsRoute));
+    gtfs->routes[gtfs->numRoutes].color = internString(&gtfs->metro->names, color)->string;
+    gtfs->routes[gtfs->numRoutes].fare = 0;
+    setGtfsId(gtfs, "r:", GTFS_FIELD(GTFS_ROUTE_ID), gtfs->numRoutes++);
+    return 1;
+}
+
+int handleGtfsFareAttribute(void *context, char **fields, int numFields, long lineNumber)
+{
+    GtfsContext *gtfs = context;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"fare_id", "price"};
+        return readGtfsHeader(gtfs, fields, numFields, names, 2, 2);
+    }
+    float price = strtof(GTFS_FIELD(GTFS_FARE_PRICE), NULL);
+    if (!(price >= 0 && (double)price <= INT_MAX))
+    {
+        fprintf(stderr, "Error: %s:%ld: bad price \"%s\"\n", gtfs->path, lineNumber, GTFS_FIELD(GTFS_FARE_PRICE));
+        return 0;
+    }
+    setGtfsId(gtfs, "f:", GTFS_FIELD(GTFS_FARE_ID), (int)price);
+    return 1;
+}
+
+int handleGtfsFareRule(void *context, char **fields, int numFields, long lineNumber)
+{
+    GtfsContext *gtfs = context;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"fare_id", "route_id", "origin_id", "destination_id"};
+        return readGtfsHeader(gtfs, fields, numFields, names, 4, 1);
+    }
+
+    int price = getGtfsId(gtfs, "f:", GTFS_FIELD(GTFS_RULE_FARE_ID));
+    if (price == -1)
+    {
+        fprintf(stderr, "Warning: %s:%ld: unknown fare_id \"%s\"\n", gtfs->path, lineNumber, GTFS_FIELD(GTFS_RULE_FARE_ID));
+        return 1;
+    }
+
+    const char *origin = GTFS_FIELD(GTFS_RULE_ORIGIN_ID);
+    const char *destination = GTFS_FIELD(GTFS_RULE_DESTINATION_ID);
+    if (origin[0] != '\0' && destination[0] != '\0')
+    {
+        char key[512];
+        snprintf(key, sizeof(key), "%s\x1f%s", origin, destination);
+        setGtfsId(gtfs, "z:", key, price);
+        snprintf(key, sizeof(key), "%s\x1f%s", destination, origin);
+        if (getGtfsId(gtfs, "z:", key) == -1)
+        {
+            setGtfsId(gtfs, "z:", key, price);
+        }
+    }
+    else
+    {
+        int route = getGtfsId(gtfs, "r:", GTFS_FIELD(GTFS_RULE_ROUTE_ID));
+        if (route != -1)
+        {
+            gtfs->routes[route].fare = price;
+        }
+    }
+    return 1;
+}
+
+int handleGtfsStop(void *context, char **fields, int numFields, long lineNumber)
+{
+    GtfsContext *gtfs = context;
+    MetroSystem *metro = gtfs->metro;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"stop_id", "stop_name", "zone_id", "location_type"};
+        return readGtfsHeader(gtfs, fields, numFields, names, 4, 2);
+    }
+
+    // Parent stations, entrances and nodes carry no stop_times
+    const char *locationType = GTFS_FIELD(GTFS_STOP_LOCATION_TYPE);
+    if (locationType[0] != '\0' && strcmp(locationType, "0") != 0)
+    {
+        return 1;
+    }
+
+    int station = metro->numStations;
+    addStation(metro, GTFS_FIELD(GTFS_STOP_NAME), "");
+    if (metro->numStations == station)
+    {
+        return 0;
+    }
+    setGtfsId(gtfs, "s:", GTFS_FIELD(GTFS_STOP_ID), station);
+
+    gtfs->stationZones = checkedRealloc(gtfs->stationZones, (size_t)metro->numStations * sizeof(uint32_t));
+    gtfs->stationZones[station] = internString(&gtfs->ids, GTFS_FIELD(GTFS_STOP_ZONE_ID))->string;
+    return 1;
+}
+
+int handleGtfsTrip(void *context, char **fields, int numFields, long lineNumber)
+{
+    GtfsContext *gtfs = context;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"trip_id", "route_id"};
+        return readGtfsHeader(gtfs, fields, numFields, names, 2, 2);
+    }
+
+    int route = getGtfsId(gtfs, "r:", GTFS_FIELD(GTFS_TRIP_ROUTE_ID));
+    if (route == -1)
+    {
+        fprintf(stderr, "Warning: %s:%ld: unknown route_id \"%s\"\n", gtfs->path, lineNumber, GTFS_FIELD(GTFS_TRIP_ROUTE_ID));
+        return 1;
+    }
+    setGtfsId(gtfs, "t:", GTFS_FIELD(GTFS_TRIP_ID), route);
+    return 1;
+}
+
+// Returns seconds after midnight for HH:MM:SS (hours may exceed 23), or -1
+int parseGtfsTime(const char *text)
+{
+    int hours, minutes, seconds;
+    if (sscanf(text, "%d:%d:%d", &hours, &minutes, &seconds) != 3 || hours < 0 || hours > INT_MAX / 3600 - 1 || minutes < 0 || minutes > 59 ||
+        seconds < 0 || seconds > 59)
+    {
+        return -1;
+    }
+    return hours * 3600 + minutes * 60 + seconds;
+}
+
+// Consecutive rows of a trip become a connection; the first trip to use a
+// segment sets its running time, and its fare comes from a zone-pair fare
+// rule, else from the route's fare, else 0. With a timetable every hop of
+// every trip is also kept there with its scheduled times.
+int handleGtfsStopTime(void *context, char **fields, int numFields, long lineNumber)
+{
+    GtfsContext *gtfs = context;
+    MetroSystem *metro = gtfs->metro;
+    if (lineNumber == 1)
+    {
+        const char *names[] = {"trip_id", "arrival_time", "departure_time", "stop_id"};
+        gtfs->previousTrip = -1;
+        return readGtfsHeader(gtfs, fields, numFields, names, 4, 4);
+    }
+
+    // A trip's value is its route; the pool offset of its key identifies the trip itself
+    char key[512];
+    snprintf(key, sizeof(key), "t:%s", GTFS_FIELD(GTFS_TIME_TRIP_ID));
+    const InternSlot *trip = gtfs->ids.numSlots ? findInternSlot(&gtfs->ids, key) : NULL;
+    int station = getGtfsId(gtfs, "s:", GTFS_FIELD(GTFS_TIME_STOP_ID));
+    int arrival = parseGtfsTime(GTFS_FIELD(GTFS_TIME_ARRIVAL));
+    int departure = parseGtfsTime(GTFS_FIELD(GTFS_TIME_DEPARTURE));
+    if (trip == NULL || trip->value == -1)
+    {
+        gtfs->previousTrip = -1;
+        return 1;
+    }
+    // A stop missing from stops.txt is skipped; the trip runs on to its next known stop
+    if (station == -1)
+    {
+        return 1;
+    }
+
+    int tripKey = (int)trip->string;
+    const GtfsRoute *route = &gtfs->routes[trip->value];
+
+    if (metro->stations[station].color == gtfs->noColor)
+    {
+        metro->stations[station].color = route->color;
+    }
+
+    if (gtfs->timetable != NULL && tripKey != gtfs->previousTrip)
+    {
+        gtfs->timetableTrip = addTimetableTrip(gtfs->timetable, metro->names.data + route->color);
+    }
+    if (gtfs->timetable != NULL && tripKey == gtfs->previousTrip && arrival >= 0 && gtfs->previousDeparture >= 0)
+    {
+        addTimetableConnection(gtfs->timetable, gtfs->timetableTrip, gtfs->previousStation, station, gtfs->previousDeparture, arrival);
+    }
+
+    if (tripKey == gtfs->previousTrip && gtfs->previousStation != station && arrival >= 0 && gtfs->previousDeparture >= 0 &&
+        insertPair(&gtfs->segments, gtfs->previousStation, station))
+    {
+        int price = route->fare;
+        snprintf(key, sizeof(key), "%s\x1f%s", gtfs->ids.data + gtfs->stationZones[gtfs->previousStation],
+                 gtfs->ids.data + gtfs->stationZones[station]);
+        int zoneFare = getGtfsId(gtfs, "z:", key);
+        if (zoneFare != -1)
+        {
+            price = zoneFare;
+        }
+        int time = (arrival - gtfs->previousDeparture + 30) / 60;
+        int limit = maxConnectionWeight(metro->numStations);
+        if (time < 0 || time > limit || price > limit)
+        {
+            fprintf(stderr, "Error: %s:%ld: running time %d or fare %d outside 0 to %d\n", gtfs->path, lineNumber, time, price, limit);
+            return 0;
+        }
+        addEdge(metro, gtfs->previousStation, station, time, price);
+    }
+
+    gtfs->previousTrip = tripKey;
+    gtfs->previousStation = station;
+    gtfs->previousDeparture = departure >= 0 ? departure : arrival;
+    return 1;
+}
+
+// Loads a network from a GTFS feed directory: routes.txt, stops.txt, trips.txt
+// and stop_times.txt, plus fare_attributes.txt/fare_rules.txt when present.
+// stop_times.txt must list each trip's stops contiguously in stop_sequence
+// order, which is how feeds are normally exported. timetable, when not NULL,
+// receives the trips of stop_times.txt.
+int loadGtfs(MetroSystem *metro, const char *directory, Timetable *timetable)
+{
+    initializeMetroSystem(metro);
+
+    GtfsContext gtfs;
+    memset(&gtfs, 0, sizeof(gtfs));
+    gtfs.metro = metro;
+    gtfs.noColor = internString(&metro->names, "")->string;
+    gtfs.timetable = timetable;
+
+    const char *files[] = {"routes.txt", "fare_attributes.txt", "fare_rules.txt", "stops.txt", "trips.txt", "stop_times.txt"};
+    CsvRowHandler handlers[] = {handleGtfsRoute, handleGtfsFareAttribute, handleGtfsFareRule, handleGtfsStop, handleGtfsTrip, handleGtfsStopTime};
+    int ok = 1;
+
+    for (int f = 0; f < 6 && ok; f++)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", directory, files[f]);
+        gtfs.path = path;
+
+        if ((f == 1 || f == 2) && access(path, R_OK) != 0)
+        {
+            continue;
+        }
+        ok = readCsvFile(path, handlers[f], &gtfs);
+    }
+
+    freeStringPool(&gtfs.ids);
+    free(gtfs.routes);
+    free(gtfs.stationZones);
+    free(gtfs.segments.keys);
+
+    if (ok)
+    {
+        finalizeMetroSystem(metro);
+        if (timetable != NULL)
+        {
+            finalizeTimetable(timetable);
+        }
+    }
+    return ok;
+}
+
+#define NETWORK_IMAGE_MAGIC "BLRGRAPH"
+#define NETWORK_IMAGE_VERSION 1
+
+// A compiled network: this header, then stations, the name index slots,
+// the CSR offsets/neighbors/times/prices and finally the string pool, laid
+// out so that loading is a single mmap with no parsing or rehashing
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numStations;
+    uint32_t numArcs;
+    uint32_t numSlots;
+    uint64_t stringsSize;
+    uint64_t payloadChecksum;
+} NetworkImageHeader;
+
+int writeNetworkImage(const MetroSystem *metro, const char *path)
+{
+    int n = metro->numStations;
+    const void *sections[] = {metro->stations, metro->names.slots, metro->offsets, metro->neighbors, metro->times, metro->prices, metro->names.data};
+    size_t sizes[] = {
+        (size_t)n * sizeof(Station),
+        (size_t)metro->names.numSlots * sizeof(InternSlot),
+        (size_t)(n + 1) * sizeof(int),
+        (size_t)metro->numArcs * sizeof(int),
+        (size_t)metro->numArcs * sizeof(int),
+        (size_t)metro->numArcs * sizeof(int),
+        metro->names.size,
+    };
+
+    NetworkImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, NETWORK_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = NETWORK_IMAGE_VERSION;
+    header.numStations = (uint32_t)n;
+    header.numArcs = (uint32_t)metro->numArcs;
+    header.numSlots = metro->names.numSlots;
+    header.stringsSize = metro->names.size;
+    header.payloadChecksum = HASH_SEED;
+    for (int s = 0; s < 7; s++)
+    {
+        header.payloadChecksum = hashBytes(header.payloadChecksum, sections[s], sizes[s]);
+    }
+
+    // Written next to path and renamed over it, like route tables
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        perror("Error opening file");
+        return EXIT_FAILURE;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int s = 0; s < 7 && ok; s++)
+    {
+        ok = sizes[s] == 0 || fwrite(sections[s], sizes[s], 1, file) == 1;
+    }
+    if (fclose(file) != 0 || !ok || rename(temporary, path) != 0)
+    {
+        fprintf(stderr, "Error writing network image %s.\n", path);
+        unlink(temporary);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+// Maps a compiled network. The mapping is private and writable, so in-place
+// changes stay local to this process; anything that grows the network first
+// copies it to the heap (see ownMetroStorage). Only the header and the size
+// are checked unless verifySnapshots asks for the payload checksum too.
+int loadNetworkImage(MetroSystem *metro, const char *path)
+{
+    initializeMetroSystem(metro);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("Error opening network image");
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(NetworkImageHeader))
+    {
+        fprintf(stderr, "Error: network image %s is truncated.\n", path);
+        close(fd);
+        return 0;
+    }
+    void *mapping = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        perror("Error mapping network image");
+        return 0;
+    }
+
+    const NetworkImageHeader *header = mapping;
+    size_t n = header->numStations;
+    size_t expected = sizeof(NetworkImageHeader) + n * sizeof(Station) + (size_t)header->numSlots * sizeof(InternSlot) +
+                      (n + 1) * sizeof(int) + 3 * (size_t)header->numArcs * sizeof(int) + header->stringsSize;
+    const char *problem = NULL;
+
+    if (memcmp(header->magic, NETWORK_IMAGE_MAGIC, sizeof(header->magic)) != 0)
+        problem = "is not a network image";
+    else if (header->version != NETWORK_IMAGE_VERSION)
+        problem = "has an unsupported version";
+    else if ((size_t)info.st_size != expected)
+        problem = "is truncated";
+    else if (verifySnapshots && hashBytes(HASH_SEED, header + 1, expected - sizeof(NetworkImageHeader)) != header->payloadChecksum)
+        problem = "is corrupt";
+
+    if (problem != NULL)
+    {
+        fprintf(stderr, "Error: network image %s %s; rerun --compile.\n", path, problem);
+        munmap(mapping, (size_t)info.st_size);
+        return 0;
+    }
+
+    char *cursor = (char *)(header + 1);
+    metro->stations = (Station *)cursor;
+    cursor += n * sizeof(Station);
+    metro->names.slots = (InternSlot *)cursor;
+    cursor += (size_t)header->numSlots * sizeof(InternSlot);
+    metro->offsets = (int *)cursor;
+    cursor += (n + 1) * sizeof(int);
+    metro->neighbors = (int *)cursor;
+    cursor += (size_t)header->numArcs * sizeof(int);
+    metro->times = (int *)cursor;
+    cursor += (size_t)header->numArcs * sizeof(int);
+    metro->prices = (int *)cursor;
+    cursor += (size_t)header->numArcs * sizeof(int);
+    metro->names.data = cursor;
+
+    metro->numStations = (int)n;
+    metro->stationCapacity = (int)n;
+    metro->numArcs = (int)header->numArcs;
+    metro->names.numSlots = header->numSlots;
+    metro->names.size = header->stringsSize;
+    metro->names.capacity = header->stringsSize;
+    for (uint32_t i = 0; i < header->numSlots; i++)
+    {
+        metro->names.count += metro->names.slots[i].string != EMPTY_SLOT;
+    }
+    metro->finalized = 1;
+    metro->image = mapping;
+    metro->imageSize = (size_t)info.st_size;
+    return 1;
+}
+
+// Answers the last pair in inputPath and writes both routes to outputPath
+int answerInputFile(const Router *router, const char *inputPath, const char *outputPath)
+{
+    const MetroSystem *metro = router->metro;
+    int startStation = 0, endStation = 0;
+    FILE *file = fopen(inputPath, "r");
+
+    if (file == NULL)
+    {
+        perror("Error opening file");
+        return 1;
+    }
+
+    int from, to;
+
+    while (fscanf(file, "%d %d", &from, &to) == 2)
+    {
+        startStation = from;
+        endStation = to;
+    }
+    fclose(file);
+
+    SearchWorkspace workspace;
+    int *distances, *previous;
+    initializeQueryScratch(metro, &workspace, &distances, &previous);
+    RouteBuffer output;
+    initializeRouteBuffer(&output);
 
+    answerQuery(router, &workspace, distances, previous, startStation, endStation, defaultPriorities(router), &output);
+    freeSearchWorkspace(&workspace);
+    free(distances);
+    free(previous);
+
+    FILE *file2 = fopen(outputPath, "w");
+    if (file2 == NULL)
+    {
+        fprintf(stderr, "Error opening file.\n");
+        freeRouteBuffer(&output);
+        return EXIT_FAILURE;
+    }
+
+    fwrite(output.data, 1, output.size, file2);
+    fclose(file2);
+    freeRouteBuffer(&output);
     return 0;
+}
+
+void buildBengaluruMetro(MetroSystem *metro)
+{
+    initializeMetroSystem(metro);
+
+    // purple line
+    addStation(metro, "Challaghatta", "Purple");
+    addStation(metro, "Kengeri", "Purple");
+    addStation(metro, "Kengeri Bus Terminal", "Purple");
+    addStation(metro, "Pattanagere", "Purple");
+    addStation(metro, "Jnanabharathi", "Purple");
+    addStation(metro, "Rajarajeshwari nagar", "Purple");
+    addStation(metro, "Nayandahalli", "Purple");
+    addStation(metro, "Mysuru Road", "Purple");
+    addStation(metro, "Deepanjali Nagar", "Purple");
+    addStation(metro, "Attiguppe", "Purple");
+    addStation(metro, "Vijaynagar", "Purple");
+    addStation(metro, "Hosahalli", "Purple");
+    addStation(metro, "Magadi Road", "Purple");
+    addStation(metro, "KSR City Railway Stn", "Purple");
+    addStation(metro, "Kempegowda Stn. Majestic -junction", "Purple"); // Intersection w greenline
+    addStation(metro, "Central college", "Purple");
+    addStation(metro, "Vidhana soudha", "Purple");
+    addStation(metro, "Cubbon park", "Purple");
+    addStation(metro, "Mahatma Gandhi Road -junction", "Purple"); // Intersection w pink line
+    addStation(metro, "Triniti", "Purple");
+    addStation(metro, "Halasuru", "Purple");
+    addStation(metro, "Indiranagar", "Purple");
+    addStation(metro, "Swami Vivekananda Road", "Purple");
+    addStation(metro, "Bayappanahalli", "Purple");
+    addStation(metro, "Benniganahalli", "Purple");
+    addStation(metro, "KR Pura-junction", "Purple"); // Intersection w blue line
+    addStation(metro, "Singayyaapalya", "Purple");
+    addStation(metro, "Garudacharpalya", "Purple");
+    addStation(metro, "Hoodi", "Purple");
+    addStation(metro, "Seetharam Palya", "Purple");
+    addStation(metro, "Kundalahalli", "Purple");
+    addStation(metro, "NallurHalli", "Purple");
+    addStation(metro, "Sri Sathya Sai Hospital", "Purple");
+    addStation(metro, "Pattandur Agrahara", "Purple");
+    addStation(metro, "Kadugodi Tree Park", "Purple");
+    addStation(metro, "Channasandra (Hopefarm)", "Purple");
+    addStation(metro, "Whitefield Kadugodi", "Purple");
+
+    // green line
+    addStation(metro, "Madavara", "Green");
+    addStation(metro, "Chikkabidarakallu", "Green");
+    addStation(metro, "Manjunathanagar", "Green");
+    addStation(metro, "Nagasandra", "Green");
+    addStation(metro, "Dasarahalli", "Green");
+    addStation(metro, "Jalahalli", "Green");
+    addStation(metro, "Peenya Industry", "Green");
+    addStation(metro, "Peenya", "Green");
+    addStation(metro, "Goraguntepalya", "Green");
+    addStation(metro, "Yeshawanthpur", "Green");
+    addStation(metro, "Sandal Soap Factory", "Green");
+    addStation(metro, "Mahalakshmi", "Green");
+    addStation(metro, "Rajaji Nagar", "Green");
+    addStation(metro, "Kuvempu Road", "Green");
+    addStation(metro, "Srirampura", "Green");
+    addStation(metro, "Sampige Road", "Green");
+    addStation(metro, "Kempegowda Stn. Majestic -junction", "Green"); // Intersection w purpleline
+    addStation(metro, "Chickpete", "Green");
+    addStation(metro, "Krishna Rajendra Market", "Green");
+    addStation(metro, "National College", "Green");
+    addStation(metro, "Lalbagh", "Green");
+    addStation(metro, "South End Cirle", "Green");
+    addStation(metro, "Jayanagar", "Green");
+    addStation(metro, "Rashtreeya Vidyalaya Road -junction", "Green"); // Intersection w yellow line
+    addStation(metro, "Banashankari", "Green");
+    addStation(metro, "Jayaprakash Nagar", "Green");
+    addStation(metro, "Yelachenahalli", "Green");
+    addStation(metro, "Konanakunte Cross", "Green");
+    addStation(metro, "Doddakallasandra", "Green");
+    addStation(metro, "Vajarahalli", "Green");
+    addStation(metro, "Thalaghattapura", "Green");
+    addStation(metro, "Silk Institute", "Green");
+
+    // pink line
+    addStation(metro, "Nagawara -junction", "Pink"); // Intersection w blue line
+    addStation(metro, "Kadagundanahalli", "Pink");
+    addStation(metro, "Venkateshpura", "Pink");
+    addStation(metro, "Tannery Road", "Pink");
+    addStation(metro, "Pottery Town", "Pink");
+    addStation(metro, "Cantonment", "Pink");
+    addStation(metro, "Shivajinagar", "Pink");
+    addStation(metro, "Mahatma Ghandi Road", "Pink"); // Intersection w purple line
+    addStation(metro, "Rashtriya Military School", "Pink");
+    addStation(metro, "Langford Town", "Pink");
+    addStation(metro, "Lakhasandra", "Pink");
+    addStation(metro, "Dairy Circle", "Pink");
+    addStation(metro, "Tavarekere", "Pink");
+    addStation(metro, "Jayadeva Hospital -junction", "Pink"); // Intersection w yellow line
+    addStation(metro, "JP Nagar 4th Phase", "Pink");
+    addStation(metro, "IIM Bangalore", "Pink");
+    addStation(metro, "Hullmavu", "Pink");
+    addStation(metro, "Kalena Agrahara", "Pink");
+
+    // yellow line
+    addStation(metro, "Rashtreeya Vidyalaya Road -junction", "Yellow"); // Intersection w green line
+    addStation(metro, "Ragigudda", "Yellow");
+    addStation(metro, "Jayadeva Hospital -junction", "Yellow"); // Intersection w pink line
+    addStation(metro, "BTM Layout", "Yellow");
+    addStation(metro, "Central Silk Board-junction", "Yellow"); // Intersection w blue line
+    addStation(metro, "Bommanahalli", "Yellow");
+    addStation(metro, "Hongasandra", "Yellow");
+    addStation(metro, "Kudlu Gate", "Yellow");
+    addStation(metro, "Singasandra", "Yellow");
+    addStation(metro, "Hosa Road", "Yellow");
+    addStation(metro, "Beratena Agrahara", "Yellow");
+    addStation(metro, "Electronic City", "Yellow");
+    addStation(metro, "Konnapana Agrahara", "Yellow");
+    addStation(metro, "Huskur Road", "Yellow");
+    addStation(metro, "Hebbagodi", "Yellow");
+    addStation(metro, "Bommasandra", "Yellow");
+
+    // blue line
+    addStation(metro, "Kempegowda International Airport", "Blue");
+    addStation(metro, "Airport City", "Blue");
+    addStation(metro, "Doddajala", "Blue");
+    addStation(metro, "Bettahalasuru", "Blue");
+    addStation(metro, "Bagalur Cross", "Blue");
+    addStation(metro, "Yelahanka", "Blue");
+    addStation(metro, "Jakkur Cross", "Blue");
+    addStation(metro, "Kodigerehalli", "Blue");
+    addStation(metro, "Hebbal", "Blue");
+    addStation(metro, "Kempapura", "Blue");
+    addStation(metro, "Veerannapalya", "Blue");
+    addStation(metro, "Nagawara -junction", "Blue"); // intersection w pink line
+    addStation(metro, "HBR Layout", "Blue");
+    addStation(metro, "Kalyan Nagar", "Blue");
+    addStation(metro, "HRBR Layout", "Blue");
+    addStation(metro, "Horamavu", "Blue");
+    addStation(metro, "Kasturinagar", "Blue");
+    addStation(metro, "KR Pura-junction", "Blue"); // intersection w purple line
+    addStation(metro, "Mahadevapura", "Blue");
+    addStation(metro, "DRDO Sports Complex", "Blue");
+    addStation(metro, "Doddanekundi", "Blue");
+    addStation(metro, "ISRO (Karthik Nagar)", "Blue");
+    addStation(metro, "Marathahalli", "Blue");
+    addStation(metro, "Kadubeesanahalli", "Blue");
+    addStation(metro, "Devarabeesanahalli", "Blue");
+    addStation(metro, "Bellandur", "Blue");
+    addStation(metro, "Iblur", "Blue");
+    addStation(metro, "Agara Lake", "Blue");
+    addStation(metro, "HSR Layout", "Blue");
+    addStation(metro, "Central Silk Board-junction", "Blue"); // intersection w yellow line
+
+    // purple line connections
+    addConnection(metro, "Challaghatta", "Kengeri", 3, 3.2);
+    addConnection(metro, "Kengeri", "Kengeri Bus Terminal", 2, 2.6);
+    addConnection(metro, "Kengeri Bus Terminal", "Pattanagere", 2, 2.8);
+    addConnection(metro, "Pattanagere", "Jnanabharathi", 1, 3.1);
+    addConnection(metro, "Jnanabharathi", "Rajarajeshwari nagar", 3, 3.3);
+    addConnection(metro, "Rajarajeshwari nagar", "Nayandahalli", 3, 2.7);
+    addConnection(metro, "Nayandahalli", "Mysuru Road", 1, 2.9);
+    addConnection(metro, "Mysuru Road", "Deepanjali Nagar", 4, 2.5);
+    addConnection(metro, "Deepanjali Nagar", "Attiguppe", 1, 2.8);
+    addConnection(metro, "Attiguppe", "Vijaynagar", 3, 3.0);
+    addConnection(metro, "Vijaynagar", "Hosahalli", 4, 3.2);
+    addConnection(metro, "Hosahalli", "Magadi Road", 2, 3.1);
+    addConnection(metro, "Magadi Road", "KSR City Railway Stn", 6, 2.6);
+    addConnection(metro, "KSR City Railway Stn", "Kempegowda Stn. Majestic -junction", 1, 3.3);
+    addConnection(metro, "Kempegowda Stn. Majestic -junction", "Central college", 3, 3.4);
+    addConnection(metro, "Central college", "Vidhana soudha", 1, 2.9);
+    addConnection(metro, "Vidhana soudha", "Cubbon park", 2, 2.7);
+    addConnection(metro, "Cubbon park", "Mahatma Gandhi Road -junction", 1, 3.0);
+    addConnection(metro, "Mahatma Gandhi Road -junction", "Triniti", 4, 2.8);
+    addConnection(metro, "Triniti", "Halasuru", 3, 3.2);
+    addConnection(metro, "Halasuru", "Indiranagar", 4, 3.1);
+    addConnection(metro, "Indiranagar", "Swami Vivekananda Road", 2, 3.4);
+    addConnection(metro, "Swami Vivekananda Road", "Bayappanahalli", 3, 3.3);
+    addConnection(metro, "Bayappanahalli", "Benniganahalli", 3, 3.2);
+    addConnection(metro, "Benniganahalli", "KR Pura-junction", 4, 3.0);
+    addConnection(metro, "KR Pura-junction", "Singayyaapalya", 4, 3.1);
+    addConnection(metro, "Singayyaapalya", "Garudacharpalya", 3, 2.9);
+    addConnection(metro, "Garudacharpalya", "Hoodi", 2, 3.3);
+    addConnection(metro, "Hoodi", "Seetharam Palya", 4, 3.0);
+    addConnection(metro, "Seetharam Palya", "Kundalahalli", 1, 2.7);
+    addConnection(metro, "Kundalahalli", "NallurHalli", 3, 3.2);
+    addConnection(metro, "NallurHalli", "Sri Sathya Sai Hospital", 1, 2.8);
+    addConnection(metro, "Sri Sathya Sai Hospital", "Pattandur Agrahara", 2, 2.6);
+    addConnection(metro, "Pattandur Agrahara", "Kadugodi Tree Park", 3, 2.9);
+    addConnection(metro, "Kadugodi Tree Park", "Channasandra (Hopefarm)", 4, 3.0);
+    addConnection(metro, "Channasandra (Hopefarm)", "Whitefield Kadugodi", 2, 2.7);
+
+    // green line connections
+    addConnection(metro, "Madavara", "Chikkabidarakallu", 1, 3.4);
+    addConnection(metro, "Chikkabidarakallu", "Manjunathanagar", 2, 2.9);
+    addConnection(metro, "Manjunathanagar", "Nagasandra", 3, 3.1);
+    addConnection(metro, "Nagasandra", "Dasarahalli", 2, 2.8);
+    addConnection(metro, "Dasarahalli", "Jalahalli", 1, 2.7);
+    addConnection(metro, "Jalahalli", "Peenya Industry", 3, 3.0);
+    addConnection(metro, "Peenya Industry", "Peenya", 4, 2.9);
+    addConnection(metro, "Peenya", "Goraguntepalya", 3, 3.2);
+    addConnection(metro, "Goraguntepalya", "Yeshawanthpur", 3, 3.1);
+    addConnection(metro, "Yeshawanthpur", "Sandal Soap Factory", 4, 3.3);
+    addConnection(metro, "Sandal Soap Factory", "Mahalakshmi", 4, 3.0);
+    addConnection(metro, "Mahalakshmi", "Rajaji Nagar", 3, 3.2);
+    addConnection(metro, "Rajaji Nagar", "Kuvempu Road", 2, 2.9);
+    addConnection(metro, "Kuvempu Road", "Srirampura", 1, 3.1);
+    addConnection(metro, "Srirampura", "Sampige Road", 3, 3.0);
+    addConnection(metro, "Sampige Road", "Kempegowda Stn. Majestic", 4, 2.8); // Intersection w Purple Line
+    addConnection(metro, "Kempegowda Stn. Majestic", "Chickpete", 2, 2.7);
+    addConnection(metro, "Chickpete", "Krishna Rajendra Market", 1, 2.9);
+    addConnection(metro, "Krishna Rajendra Market", "National College", 3, 2.6);
+    addConnection(metro, "National College", "Lalbagh", 3, 3.0);
+    addConnection(metro, "Lalbagh", "South End Circle", 2, 2.8);
+    addConnection(metro, "South End Circle", "Jayanagar", 3, 3.2);
+    addConnection(metro, "Jayanagar", "Rashtreeya Vidyalaya Road -junction", 4, 3.1); // Intersection w Yellow Line
+    addConnection(metro, "Rashtreeya Vidyalaya Road -junction", "Banashankari", 4, 3.3);
+    addConnection(metro, "Banashankari", "Jayaprakash Nagar", 3, 2.9);
+    addConnection(metro, "Jayaprakash Nagar", "Yelachenahalli", 2, 3.1);
+    addConnection(metro, "Yelachenahalli", "Konanakunte Cross", 1, 2.8);
+    addConnection(metro, "Konanakunte Cross", "Doddakallasandra", 3, 3.0);
+    addConnection(metro, "Doddakallasandra", "Vajarahalli", 3, 2.9);
+    addConnection(metro, "Vajarahalli", "Thalaghattapura", 2, 3.2);
+    addConnection(metro, "Thalaghattapura", "Silk Institute", 3, 3.1);
+
+    // pink line connections
+    addConnection(metro, "Nagawara -junction", "Kadagundanahalli", 1, 3.5);
+    addConnection(metro, "Kadagundanahalli", "Venkateshpura", 2, 3.0);
+    addConnection(metro, "Venkateshpura", "Tannery Road", 3, 3.2);
+    addConnection(metro, "Tannery Road", "Pottery Town", 2, 2.9);
+    addConnection(metro, "Pottery Town", "Cantonment", 1, 3.1);
+    addConnection(metro, "Cantonment", "Shivajinagar", 3, 3.0);
+    addConnection(metro, "Shivajinagar", "Mahatma Gandhi Road -junction", 1, 2.7); // Intersection w Purple Line
+    addConnection(metro, "Mahatma Gandhi Road -junction", "Rashtriya Military School", 2, 2.6);
+    addConnection(metro, "Rashtriya Military School", "Langford Town", 8, 2.9);
+    addConnection(metro, "Langford Town", "Lakhasandra", 3, 3.3);
+    addConnection(metro, "Lakhasandra", "Dairy Circle", 2, 3.1);
+    addConnection(metro, "Dairy Circle", "Tavarekere", 4, 2.8);
+    addConnection(metro, "Tavarekere", "Jayadeva Hospital -junction", 3, 3.0); // Intersection w Yellow Line
+    addConnection(metro, "Jayadeva Hospital -junction", "JP Nagar 4th Phase", 4, 3.2);
+    addConnection(metro, "JP Nagar 4th Phase", "IIM Bangalore", 3, 2.9);
+    addConnection(metro, "IIM Bangalore", "Hullmavu", 2, 3.1);
+    addConnection(metro, "Hullmavu", "Kalena Agrahara", 1, 2.8);
+
+    // yellow line connections
+    addConnection(metro, "Rashtreeya Vidyalaya Road -junction", "Ragigudda", 3, 2.9);
+    addConnection(metro, "Ragigudda", "Jayadeva Hospital -junction", 2, 3.1); // Intersection w Yellow Line
+    addConnection(metro, "Jayadeva Hospital -junction", "BTM Layout", 1, 2.8);
+    addConnection(metro, "BTM Layout", "Central Silk Board-junction", 3, 2.7); // Intersection w Blue Line
+    addConnection(metro, "Central Silk Board-junction", "Bommanahalli", 4, 2.9);
+    addConnection(metro, "Bommanahalli", "Hongasandra", 3, 3.0);
+    addConnection(metro, "Hongasandra", "Kudlu Gate", 2, 2.8);
+    addConnection(metro, "Kudlu Gate", "Singasandra", 1, 3.1);
+    addConnection(metro, "Singasandra", "Hosa Road", 3, 2.9);
+    addConnection(metro, "Hosa Road", "Beratena Agrahara", 2, 3.0);
+    addConnection(metro, "Beratena Agrahara", "Electronic City", 2, 3.2);
+    addConnection(metro, "Electronic City", "Konnapana Agrahara", 3, 2.7);
+    addConnection(metro, "Konnapana Agrahara", "Huskur Road", 2, 3.1);
+    addConnection(metro, "Huskur Road", "Hebbagodi", 1, 2.8);
+    addConnection(metro, "Hebbagodi", "Bommasandra", 3, 3.0);
+
+    // blue line connections
+    addConnection(metro, "Kempegowda International Airport", "Airport City", 3, 2.8);
+    addConnection(metro, "Airport City", "Doddajala", 2, 3.0);
+    addConnection(metro, "Doddajala", "Bettahalasuru", 1, 2.9);
+    addConnection(metro, "Bettahalasuru", "Bagalur Cross", 3, 3.1);
+    addConnection(metro, "Bagalur Cross", "Yelahanka", 2, 2.8);
+    addConnection(metro, "Yelahanka", "Jakkur Cross", 1, 3.0);
+    addConnection(metro, "Jakkur Cross", "Kodigerehalli", 3, 2.9);
+    addConnection(metro, "Kodigerehalli", "Hebbal", 2, 3.1);
+    addConnection(metro, "Hebbal", "Kempapura", 1, 2.8);
+    addConnection(metro, "Kempapura", "Veerannapalya", 3, 3.0);
+    addConnection(metro, "Veerannapalya", "Nagawara -junction", 2, 2.9); // Intersection w Pink Line
+    addConnection(metro, "Nagawara -junction", "HBR Layout", 1, 3.1);
+    addConnection(metro, "HBR Layout", "Kalyan Nagar", 3, 2.8);
+    addConnection(metro, "Kalyan Nagar", "HRBR Layout", 2, 3.0);
+    addConnection(metro, "HRBR Layout", "Horamavu", 1, 2.9);
+    addConnection(metro, "Horamavu", "Kasturinagar", 3, 3.1);
+    addConnection(metro, "Kasturinagar", "KR Pura-junction", 2, 2.8); // Intersection w Purple Line
+    addConnection(metro, "KR Pura-junction", "Mahadevapura", 1, 3.0);
+    addConnection(metro, "Mahadevapura", "DRDO Sports Complex", 3, 2.9);
+    addConnection(metro, "DRDO Sports Complex", "Doddanekundi", 2, 3.1);
+    addConnection(metro, "Doddanekundi", "ISRO (Karthik Nagar)", 1, 2.8);
+    addConnection(metro, "ISRO (Karthik Nagar)", "Marathahalli", 3, 3.0);
+    addConnection(metro, "Marathahalli", "Kadubeesanahalli", 2, 2.9);
+    addConnection(metro, "Kadubeesanahalli", "Devarabeesanahalli", 1, 3.1);
+    addConnection(metro, "Devarabeesanahalli", "Bellandur", 3, 2.8);
+    addConnection(metro, "Bellandur", "Iblur", 2, 3.0);
+    addConnection(metro, "Iblur", "Agara Lake", 1, 2.9);
+    addConnection(metro, "Agara Lake", "HSR Layout", 3, 3.1);
+    addConnection(metro, "HSR Layout", "Central Silk Board-junction", 2, 2.8);
+
+    finalizeMetroSystem(metro);
+}
+
+// Builds a metro-like network of numStations stations for benchmarks. Lines
+// of 20-60 stops each start at an interchange of an earlier line and cross
+// other interchanges on the way, so the network is connected. Running times
+// (1-5 minutes) and fares (2-4 rupees) are in the range of the built-in
+// network, and a given size always produces the same network.
+void generateSyntheticMetro(MetroSystem *metro, int numStations)
+{
+    initializeMetroSystem(metro);
+    srand((unsigned)numStations);
+
+    int *interchanges = checkedRealloc(NULL, (size_t)(numStations > 0 ? numStations : 1) * sizeof(int));
+    int numInterchanges = 0;
+    char name[64], color[32];
+
+    for (int line = 1; metro->numStations < numStations; line++)
+    {
+        snprintf(color, sizeof(color), "Line %d", line);
+        int length = 20 + rand() % 41;
+        int previous = numInterchanges > 0 ? interchanges[rand() % numInterchanges] : -1;
+
+        for (int stop = 1; stop <= length && metro->numStations < numStations; stop++)
+        {
+            int station;
+            if (numInterchanges > 1 && rand() % 12 == 0)
+            {
+                station = interchanges[rand() % numInterchanges];
+            }
+            else
+            {
+                int junction = rand() % 8 == 0;
+                snprintf(name, sizeof(name), junction ? "L%d-%d -junction" : "L%d-%d", line, stop);
+                station = metro->numStations;
+                addStation(metro, name, color);
+                if (junction)
+                {
+                    interchanges[numInterchanges++] = station;
+                }
+            }
+            if (previous != -1 && previous != station)
+            {
+                // Some hops are free, as a rounded schedule or a fare-free line
+                // makes them, so every engine is exercised on zero weights too
+                int time = 1 + rand() % 5, price = 2 + rand() % 3;
+                addEdge(metro, previous, station, stop % 16 == 0 ? 0 : time, line % 5 == 0 ? 0 : price);
+            }
+            previous = station;
+        }
+    }
+
+    free(interchanges);
+    finalizeMetroSystem(metro);
+}
+
+int main(int argc, char **argv)
+{
+    int batch = 0;
+    int numThreads = defaultThreadCount();
+    const char *precomputePath = NULL;
+    const char *tablePath = NULL;
+    const char *stationsPath = NULL;
+    const char *connectionsPath = NULL;
+    const char *gtfsPath = NULL;
+    const char *imagePath = NULL;
+    const char *compilePath = NULL;
+    int validatePairs = 0;
+    const char *schedulePath = NULL;
+    int syntheticStations = 0;
+    int benchmarkQueries = 0;
+    int engineSelected = 0;
+    int serve = 0;
+    const char *socketPath = NULL;
+    const char *loadSocketPath = NULL;
+    int loadClients = 4, loadRequests = 10000, loadPipeline = 16;
+    int departure = -1, lastDeparture = -1, transferMinutes = -1;
+    int cacheTrees = 0;
+    int isochronePriority = -1, isochroneBudget = INT_MAX;
+    const char *disruptionsPath = NULL;
+    const char *metricsPath = NULL;
+    int metricsInterval = 10;
+    int useLines = 0, lineTransferTime = 5, lineTransferPrice = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--queue=", 8) == 0 && parseQueueKind(argv[i] + 8, &defaultQueueKind))
+        {
+            continue;
+        }
+        if (strncmp(argv[i], "--engine=", 9) == 0 && parseEngine(argv[i] + 9, &defaultEngine))
+        {
+            engineSelected = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "--dense-kernel=", 15) == 0 && parseDenseKernel(argv[i] + 15, &defaultDenseKernel))
+        {
+            continue;
+        }
+        if (strncmp(argv[i], "--format=", 9) == 0 && parseRouteFormat(argv[i] + 9, &defaultRouteFormat))
+        {
+            continue;
+        }
+        if (strncmp(argv[i], "--isochrone=", 12) == 0)
+        {
+            const char *spec = argv[i] + 12;
+            size_t length = strcspn(spec, ":");
+            int priority = length == 4 && strncmp(spec, "time", 4) == 0 ? 0 : length == 5 && strncmp(spec, "price", 5) == 0 ? 1 : -1;
+            int budget = spec[length] == ':' ? atoi(spec + length + 1) : INT_MAX;
+            if (priority != -1 && budget >= 0)
+            {
+                isochronePriority = priority;
+                isochroneBudget = budget;
+                continue;
+            }
+        }
+        if (strncmp(argv[i], "--alternatives=", 15) == 0)
+        {
+            int count = 0;
+            double overlap = alternativeOverlap, stretch = alternativeStretch;
+            if (sscanf(argv[i] + 15, "%d:%lf:%lf", &count, &overlap, &stretch) >= 1 && count >= 1 && count <= MAX_ALTERNATIVES && overlap >= 0 &&
+                overlap <= 1 && stretch >= 0)
+            {
+                alternativeCount = count;
+                alternativeOverlap = overlap;
+                alternativeStretch = stretch;
+                continue;
+            }
+        }
+        if (strcmp(argv[i], "--lines") == 0 || strncmp(argv[i], "--lines=", 8) == 0)
+        {
+            // --lines=MINUTES[:RUPEES] sets the transfer penalties
+            int minutes = lineTransferTime, rupees = lineTransferPrice;
+            if (argv[i][7] == '\0' || (sscanf(argv[i] + 8, "%d:%d", &minutes, &rupees) >= 1 && minutes >= 0 && rupees >= 0))
+            {
+                useLines = 1;
+                lineTransferTime = minutes;
+                lineTransferPrice = rupees;
+                continue;
+            }
+        }
+        if (strncmp(argv[i], "--disruptions=", 14) == 0)
+        {
+            disruptionsPath = argv[i] + 14;
+            continue;
+        }
+        if (strncmp(argv[i], "--metrics=", 10) == 0 && argv[i][10] != '\0')
+        {
+            // FILE[:SECONDS]; a colon not followed by a positive number stays part of the name
+            char *colon = strrchr(argv[i] + 10, ':');
+            if (colon != NULL && atoi(colon + 1) > 0 && colon[1 + strspn(colon + 1, "0123456789")] == '\0')
+            {
+                metricsInterval = atoi(colon + 1);
+                *colon = '\0';
+            }
+            metricsPath = argv[i] + 10;
+            continue;
+        }
+        if (strncmp(argv[i], "--cache=", 8) == 0 && atoi(argv[i] + 8) > 0)
+        {
+            cacheTrees = atoi(argv[i] + 8);
+            continue;
+        }
+        if (strncmp(argv[i], "--validate=", 11) == 0 && atoi(argv[i] + 11) > 0)
+        {
+            validatePairs = atoi(argv[i] + 11);
+            continue;
+        }
+        if (strcmp(argv[i], "--verify") == 0)
+        {
+            verifySnapshots = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--batch") == 0)
+        {
+            batch = 1;
+            continue;
+        }
+        if (strncmp(argv[i], "--threads=", 10) == 0 && atoi(argv[i] + 10) > 0)
+        {
+            numThreads = atoi(argv[i] + 10);
+            continue;
+        }
+        if (strncmp(argv[i], "--precompute=", 13) == 0)
+        {
+            precomputePath = argv[i] + 13;
+            continue;
+        }
+        if (strncmp(argv[i], "--table=", 8) == 0)
+        {
+            tablePath = argv[i] + 8;
+            continue;
+        }
+        if (strncmp(argv[i], "--stations=", 11) == 0)
+        {
+            stationsPath = argv[i] + 11;
+            continue;
+        }
+        if (strncmp(argv[i], "--connections=", 14) == 0)
+        {
+            connectionsPath = argv[i] + 14;
+            continue;
+        }
+        if (strncmp(argv[i], "--gtfs=", 7) == 0)
+        {
+            gtfsPath = argv[i] + 7;
+            continue;
+        }
+        if (strncmp(argv[i], "--image=", 8) == 0)
+        {
+            imagePath = argv[i] + 8;
+            continue;
+        }
+        if (strncmp(argv[i], "--compile=", 10) == 0)
+        {
+            compilePath = argv[i] + 10;
+            continue;
+        }
+        if (strncmp(argv[i], "--synthetic=", 12) == 0 && atoi(argv[i] + 12) > 0)
+        {
+            syntheticStations = atoi(argv[i] + 12);
+            continue;
+        }
+        if (strncmp(argv[i], "--benchmark=", 12) == 0 && atoi(argv[i] + 12) > 0)
+        {
+            benchmarkQueries = atoi(argv[i] + 12);
+            continue;
+        }
+        if (strcmp(argv[i], "--serve") == 0 || strncmp(argv[i], "--serve=", 8) == 0)
+        {
+            serve = 1;
+            socketPath = argv[i][7] == '=' ? argv[i] + 8 : NULL;
+            continue;
+        }
+        if (strncmp(argv[i], "--load=", 7) == 0)
+        {
+            loadSocketPath = argv[i] + 7;
+            continue;
+        }
+        if (strncmp(argv[i], "--clients=", 10) == 0 && atoi(argv[i] + 10) > 0)
+        {
+            loadClients = atoi(argv[i] + 10);
+            continue;
+        }
+        if (strncmp(argv[i], "--requests=", 11) == 0 && atoi(argv[i] + 11) > 0)
+        {
+            loadRequests = atoi(argv[i] + 11);
+            continue;
+        }
+        if (strncmp(argv[i], "--pipeline=", 11) == 0 && atoi(argv[i] + 11) > 0)
+        {
+            loadPipeline = atoi(argv[i] + 11);
+            continue;
+        }
+        if (strncmp(argv[i], "--timetable=", 12) == 0)
+        {
+            schedulePath = argv[i] + 12;
+            continue;
+        }
+        if (strncmp(argv[i], "--depart=", 9) == 0 && (departure = parseClock(argv[i] + 9)) >= 0)
+        {
+            lastDeparture = -1;
+            continue;
+        }
+        if (strncmp(argv[i], "--profile=", 10) == 0 && strchr(argv[i], '-') != NULL)
+        {
+            departure = parseClock(argv[i] + 10);
+            lastDeparture = parseClock(strchr(argv[i] + 10, '-') + 1);
+            if (departure >= 0 && lastDeparture >= departure)
+            {
+                continue;
+            }
+        }
+        if (strncmp(argv[i], "--transfer=", 11) == 0 && atoi(argv[i] + 11) >= 0)
+        {
+            transferMinutes = atoi(argv[i] + 11);
+            continue;
+        }
+        fprintf(stderr, "Usage: %s [--engine=dijkstra|pareto|ch|alt|dense] [--dense-kernel=scalar|sse4|avx2] [--queue=binary|quad|bucket] [--batch] [--validate=PAIRS]\n"
+                        "       [--threads=N] [--precompute=FILE] [--table=FILE] [--verify]\n"
+                        "       [--format=text|json|binary] [--cache=TREES] [--isochrone=time|price[:BUDGET]] [--alternatives=K[:OVERLAP[:STRETCH]]]\n"
+                        "       [--lines[=MINUTES[:RUPEES]]] [--disruptions=FILE] [--metrics=FILE[:SECONDS]]\n"
+                        "       [--stations=FILE --connections=FILE | --gtfs=DIR | --image=FILE | --synthetic=STATIONS] [--compile=FILE]\n"
+                        "       [--benchmark=QUERIES] [--serve[=SOCKET]] [--load=SOCKET [--clients=N] [--requests=N] [--pipeline=N]]\n"
+                        "       [--timetable=FILE] [--depart=HH:MM | --profile=HH:MM-HH:MM] [--transfer=MINUTES]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((stationsPath == NULL) != (connectionsPath == NULL))
+    {
+        fprintf(stderr, "Error: --stations and --connections must be given together.\n");
+        return EXIT_FAILURE;
+    }
+    int useTimetable = departure >= 0;
+    if (useTimetable && schedulePath == NULL && gtfsPath == NULL)
+    {
+        fprintf(stderr, "Error: --depart/--profile need a --timetable file or a --gtfs feed.\n");
+        return EXIT_FAILURE;
+    }
+    if (alternativeCount > 0 && tablePath == NULL && defaultEngine != ENGINE_DIJKSTRA)
+    {
+        fprintf(stderr, "Error: --alternatives needs the dijkstra engine or a route table.\n");
+        return EXIT_FAILURE;
+    }
+    if (useLines && (defaultEngine != ENGINE_DIJKSTRA || tablePath != NULL || cacheTrees > 0 || alternativeCount > 0 || useTimetable ||
+                     isochronePriority != -1))
+    {
+        fprintf(stderr, "Error: --lines cannot be combined with another engine, --table, --cache, --alternatives, --isochrone or a timetable.\n");
+        return EXIT_FAILURE;
+    }
+    if (!useTimetable && schedulePath != NULL)
+    {
+        fprintf(stderr, "Error: --timetable needs --depart or --profile.\n");
+        return EXIT_FAILURE;
+    }
+
+    if (metricsPath != NULL && !enableMetrics(metricsPath, metricsInterval))
+    {
+        return EXIT_FAILURE;
+    }
+    uint64_t buildStart = metricsPhaseStart();
+
+    Timetable timetable;
+    initializeTimetable(&timetable);
+    if (transferMinutes >= 0)
+    {
+        timetable.transferTime = transferMinutes * 60;
+    }
+
+    MetroSystem metro;
+    int loaded = 1;
+    if (imagePath != NULL)
+    {
+        loaded = loadNetworkImage(&metro, imagePath);
+    }
+    else if (gtfsPath != NULL)
+    {
+        loaded = loadGtfs(&metro, gtfsPath, useTimetable ? &timetable : NULL);
+    }
+    else if (stationsPath != NULL)
+    {
+        loaded = loadNetworkCsv(&metro, stationsPath, connectionsPath);
+    }
+    else if (syntheticStations > 0)
+    {
+        generateSyntheticMetro(&metro, syntheticStations);
+    }
+    else
+    {
+        buildBengaluruMetro(&metro);
+    }
+    if (loaded && schedulePath != NULL)
+    {
+        loaded = loadSchedule(&timetable, &metro, schedulePath);
+    }
+    if (!loaded)
+    {
+        freeTimetable(&timetable);
+        freeMetroSystem(&metro);
+        return EXIT_FAILURE;
+    }
+
+    if (compilePath != NULL)
+    {
+        int status = writeNetworkImage(&metro, compilePath);
+        freeTimetable(&timetable);
+        freeMetroSystem(&metro);
+        return status;
+    }
+
+    if (loadSocketPath != NULL)
+    {
+        int status = runLoadGenerator(loadSocketPath, metro.numStations, loadClients, loadRequests, loadPipeline);
+        freeTimetable(&timetable);
+        freeMetroSystem(&metro);
+        return status;
+    }
+
+    if (precomputePath != NULL)
+    {
+        int status = precomputeRouteTable(&metro, precomputePath, numThreads);
+        freeTimetable(&timetable);
+        freeMetroSystem(&metro);
+        return status;
+    }
+
+    Router router;
+    memset(&router, 0, sizeof(router));
+    router.metro = &metro;
+    router.timetable = useTimetable ? &timetable : NULL;
+    router.departure = departure;
+    router.lastDeparture = lastDeparture;
+
+    RouteTable routeTable;
+    if (tablePath != NULL)
+    {
+        if (!loadRouteTable(&routeTable, &metro, tablePath))
+        {
+            freeTimetable(&timetable);
+            freeMetroSystem(&metro);
+            return EXIT_FAILURE;
+        }
+        router.table = &routeTable;
+    }
+
+    TreeCache trees;
+    if (cacheTrees > 0)
+    {
+        initializeTreeCache(&trees, metro.numStations, cacheTrees);
+        router.trees = &trees;
+    }
+
+    // A disruption file is applied before hierarchies and landmarks are
+    // built, so only the route table needs repairing for it
+    LiveNetwork live;
+    int setupFailed = 0;
+    metricsPhaseEnd(PHASE_BUILD, buildStart);
+    if (serve || disruptionsPath != NULL)
+    {
+        initializeLiveNetwork(&live, &metro, router.table != NULL ? &routeTable : NULL, router.trees, NULL);
+        router.live = &live;
+        setupFailed = disruptionsPath != NULL && !applyDisruptionFile(&live, disruptionsPath);
+        live.hierarchiesStale = 0;
+    }
+    buildStart = metricsPhaseStart();
+
+    LineGraph lines;
+    if (useLines && !setupFailed)
+    {
+        if (buildLineGraph(&lines, &metro, lineTransferTime, lineTransferPrice))
+        {
+            router.lines = &lines;
+            if (router.live != NULL)
+            {
+                live.lines = &lines;
+                int lineLimit = maxConnectionWeight(lines.graph.numStations);
+                live.maxWeight = lineLimit < live.maxWeight ? lineLimit : live.maxWeight;
+            }
+        }
+        else
+        {
+            setupFailed = 1;
+        }
+    }
+
+    ContractionHierarchy hierarchies[2];
+    int useHierarchies = (defaultEngine == ENGINE_CH && router.table == NULL && benchmarkQueries == 0) || validatePairs > 0;
+    if (useHierarchies)
+    {
+        for (int priority = 0; priority < 2; priority++)
+        {
+            buildContractionHierarchy(&hierarchies[priority], &metro, priority);
+            router.hierarchies[priority] = &hierarchies[priority];
+        }
+    }
+
+    LandmarkSet landmarks;
+    int useLandmarks = (defaultEngine == ENGINE_ALT && router.table == NULL && benchmarkQueries == 0) || validatePairs > 0;
+    if (useLandmarks)
+    {
+        buildLandmarks(&landmarks, &metro, ALT_LANDMARKS);
+        router.landmarks = &landmarks;
+        if (router.live != NULL)
+        {
+            live.landmarks = &landmarks;
+        }
+    }
+
+    DenseNetwork dense;
+    int useDense = (defaultEngine == ENGINE_DENSE && router.table == NULL && benchmarkQueries == 0) ||
+                   (validatePairs > 0 && metro.numStations <= DENSE_MAX_STATIONS);
+    if (useDense && buildDenseNetwork(&dense, &metro))
+    {
+        router.dense = &dense;
+        if (router.live != NULL)
+        {
+            live.dense = &dense;
+            live.maxWeight = dense.maxWeight < live.maxWeight ? dense.maxWeight : live.maxWeight;
+        }
+    }
+    else if (useDense && validatePairs == 0)
+    {
+        setupFailed = 1;
+    }
+
+    metricsPhaseEnd(PHASE_BUILD, buildStart);
+    startMetricsExporter();
+
+    int status;
+    if (setupFailed)
+    {
+        status = EXIT_FAILURE;
+    }
+    else if (validatePairs > 0)
+    {
+        status = validateEngines(&router, validatePairs) == 0 ? 0 : EXIT_FAILURE;
+    }
+    else if (benchmarkQueries > 0)
+    {
+        char networkName[32] = "bengaluru";
+        if (syntheticStations > 0)
+        {
+            snprintf(networkName, sizeof(networkName), "synthetic-%d", syntheticStations);
+        }
+        const char *source = imagePath ? imagePath : gtfsPath ? gtfsPath : stationsPath ? stationsPath : networkName;
+        status = runBenchmark(&router, benchmarkQueries, source, engineSelected ? 1u << defaultEngine : ~0u);
+    }
+    else if (serve)
+    {
+        status = runServer(&router, socketPath, numThreads);
+    }
+    else if (isochronePriority != -1)
+    {
+        status = runIsochroneBatch(&router, "input.txt", "output.txt", numThreads, isochronePriority, isochroneBudget);
+    }
+    else if (batch)
+    {
+        status = runBatch(&router, "input.txt", "output.txt", numThreads);
+    }
+    else
+    {
+        status = answerInputFile(&router, "input.txt", "output.txt");
+    }
+    if (!stopMetrics())
+    {
+        status = EXIT_FAILURE;
+    }
+
+    if (router.trees != NULL)
+    {
+        if (benchmarkQueries == 0 && validatePairs == 0)
+        {
+            printTreeCacheStats(&trees, stderr);
+        }
+        freeTreeCache(&trees);
+    }
+    if (router.live != NULL)
+    {
+        freeLiveNetwork(&live);
+    }
+    if (useHierarchies)
+    {
+        freeContractionHierarchy(&hierarchies[0]);
+        freeContractionHierarchy(&hierarchies[1]);
+    }
+    if (useLandmarks)
+    {
+        freeLandmarks(&landmarks);
+    }
+    if (router.dense != NULL)
+    {
+        freeDenseNetwork(&dense);
+    }
+    if (router.lines != NULL)
+    {
+        freeLineGraph(&lines);
+    }
+    if (router.table != NULL)
+    {
+        unloadRouteTable(&routeTable);
+    }
+    freeTimetable(&timetable);
+    freeMetroSystem(&metro);
+    return status;
 }
\ No newline at end of file